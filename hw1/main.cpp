@@ -16,6 +16,10 @@
 #include <atomic>
 #include <unistd.h>
 #include <cassert>
+#include <fstream>
+
+#include "ring_buffer.hpp"
+#include "profiler.hpp"
 
 std::string to_string(std::string_view str) {
     return std::string(str.begin(), str.end());
@@ -124,9 +128,8 @@ typedef std::pair <float, float> v2;
 #define x first
 #define y second
 
-std::vector<v2> point_pos, isol_point_pos;
-std::vector<color> point_col;
-std::vector <uint32_t> ind, isol_ind;
+std::vector<v2> point_pos;
+std::vector <uint32_t> ind;
 std::vector <float> isol_vals = { 0.25, 0.5, 0.33, 0.9, 0.75, 0.1 };
 std::vector <std::array <uint32_t, 5>> isol_point_id;
 
@@ -187,11 +190,10 @@ std::vector <uint32_t> gen_indices(size_t W_RES, size_t H_RES) {
     return res;
 }
 
-void recalc_positions_and_colors(
-    float x1, float y1, float x2, float y2, float t,
+void recalc_positions(
+    float x1, float y1, float x2, float y2,
     size_t W_RES, size_t H_RES,
-    GLuint pos_vbo, GLuint col_vbo, GLuint ebo,
-    bool recalc_pos = false, bool recalc_col = true
+    GLuint pos_vbo, GLuint ebo
 ) {
     float size_w = x2 - x1, size_h = y2 - y1;
     float cell_size_w = size_w / W_RES, cell_size_h = size_h / H_RES;
@@ -201,28 +203,34 @@ void recalc_positions_and_colors(
     for (size_t i = 0, ptr = 0; i <= H_RES; i++, cur_y += cell_size_h) {
         float cur_x = x1;
         for  (size_t j = 0; j <= W_RES; j++, cur_x += cell_size_w, ptr++) {
-            if (recalc_pos) {
-                point_pos[ptr] = {
-                    (cur_x - center_x) / size_w * 2.0,
-                    (cur_y - center_y) / size_h * 2.0
-                };
-            }
-
-            if (recalc_col) {
-                point_col[ptr] = calc_color(f(cur_x, cur_y, t));
-            }
+            point_pos[ptr] = {
+                (cur_x - center_x) / size_w * 2.0,
+                (cur_y - center_y) / size_h * 2.0
+            };
         }
     }
 
-    if (recalc_pos) {
-        update_vbo(pos_vbo, point_pos);
-        
-        ind = gen_indices(W_RES, H_RES);
-        ind.shrink_to_fit();
-        update_ebo(ebo, ind);
-    }
-    if (recalc_col) {
-        update_vbo(col_vbo, point_col);
+    update_vbo(pos_vbo, point_pos);
+
+    ind = gen_indices(W_RES, H_RES);
+    ind.shrink_to_fit();
+    update_ebo(ebo, ind);
+}
+
+// Colors change every frame, they are written straight into a ring allocation of (W_RES + 1) * (H_RES + 1).
+void write_colors(
+    float x1, float y1, float x2, float y2, float t,
+    size_t W_RES, size_t H_RES,
+    color *col
+) {
+    float cell_size_w = (x2 - x1) / W_RES, cell_size_h = (y2 - y1) / H_RES;
+
+    float cur_y = y1;
+    for (size_t i = 0, ptr = 0; i <= H_RES; i++, cur_y += cell_size_h) {
+        float cur_x = x1;
+        for  (size_t j = 0; j <= W_RES; j++, cur_x += cell_size_w, ptr++) {
+            col[ptr] = calc_color(f(cur_x, cur_y, t));
+        }
     }
 }
 
@@ -264,20 +272,14 @@ void recalc_isoline_indices(size_t W_RES, size_t H_RES) {
 }
 
 void recalc_grid(
-    float x1, float y1, float x2, float y2, float t,
+    float x1, float y1, float x2, float y2,
     size_t W_RES, size_t H_RES, size_t POINTS_CNT,
-    GLuint pos_vbo, GLuint col_vbo, GLuint ebo
+    GLuint pos_vbo, GLuint ebo
 ) {
     point_pos.resize(POINTS_CNT);
     point_pos.shrink_to_fit();
 
-    point_col.resize(POINTS_CNT);
-    point_col.shrink_to_fit();
-
-    recalc_positions_and_colors(x1, y1, x2, y2, t, W_RES, H_RES, pos_vbo, col_vbo, ebo, true, true);
-
-    isol_point_pos.resize(W_RES * (H_RES + 1) + (W_RES + 1) * H_RES + W_RES * H_RES);
-    isol_point_pos.shrink_to_fit();
+    recalc_positions(x1, y1, x2, y2, W_RES, H_RES, pos_vbo, ebo);
 
     isol_point_id.resize(W_RES * H_RES);
     isol_point_id.shrink_to_fit();
@@ -306,7 +308,7 @@ void update_isoline_triangle(
     v2 p1, v2 p2, v2 p3,
     uint32_t ind12, uint32_t ind23, uint32_t ind31,
     float x1, float y1, float x2, float y2,
-    float val, float t, std::vector <uint32_t> &ans
+    float val, float t, v2 *pos, uint32_t *&ans
 ) {
     float center_x = (x1 + x2) / 2, center_y = (y1 + y2) / 2;
     float size_w = x2 - x1, size_h = y2 - y1;
@@ -325,46 +327,42 @@ void update_isoline_triangle(
         mask |= 4;
     }
 
-    v2 &ip12 = isol_point_pos[ind12];
-    v2 &ip23 = isol_point_pos[ind23];
-    v2 &ip31 = isol_point_pos[ind31];
-
-    if (mask == 0b000 || mask == 0b111) {
-        return;
-    }
+    // pos is mapped for writing only, every point is normalized before it's stored
+    auto normalize = [&](v2 p) -> v2 {
+        return { (p.x - center_x) / size_w * 2, (p.y - center_y) / size_h * 2 };
+    };
 
     if (mask == 0b001 || mask == 0b110) {
-        ip12 = interpolate(p1, f(p1.x, p1.y, t), p2, f(p2.x, p2.y, t), val);
-        ip31 = interpolate(p1, f(p1.x, p1.y, t), p3, f(p3.x, p3.y, t), val);
+        pos[ind12] = normalize(interpolate(p1, f(p1.x, p1.y, t), p2, f(p2.x, p2.y, t), val));
+        pos[ind31] = normalize(interpolate(p1, f(p1.x, p1.y, t), p3, f(p3.x, p3.y, t), val));
 
-        ans.push_back(ind12); ans.push_back(ind31);
+        *ans++ = ind12; *ans++ = ind31;
     }
 
     if (mask == 0b101 || mask == 0b010) {
-        ip12 = interpolate(p1, f(p1.x, p1.y, t), p2, f(p2.x, p2.y, t), val);
-        ip23 = interpolate(p2, f(p2.x, p2.y, t), p3, f(p3.x, p3.y, t), val);
+        pos[ind12] = normalize(interpolate(p1, f(p1.x, p1.y, t), p2, f(p2.x, p2.y, t), val));
+        pos[ind23] = normalize(interpolate(p2, f(p2.x, p2.y, t), p3, f(p3.x, p3.y, t), val));
 
-        ans.push_back(ind12); ans.push_back(ind23);
+        *ans++ = ind12; *ans++ = ind23;
     }
 
     if (mask == 0b100 || mask == 0b011) {
-        ip23 = interpolate(p3, f(p3.x, p3.y, t), p2, f(p2.x, p2.y, t), val);
-        ip31 = interpolate(p1, f(p1.x, p1.y, t), p3, f(p3.x, p3.y, t), val);
+        pos[ind23] = normalize(interpolate(p3, f(p3.x, p3.y, t), p2, f(p2.x, p2.y, t), val));
+        pos[ind31] = normalize(interpolate(p1, f(p1.x, p1.y, t), p3, f(p3.x, p3.y, t), val));
 
-        ans.push_back(ind23); ans.push_back(ind31);
+        *ans++ = ind23; *ans++ = ind31;
     }
-
-    ip12 = { (ip12.x - center_x) / size_w * 2, (ip12.y - center_y) / size_h * 2 };
-    ip23 = { (ip23.x - center_x) / size_w * 2, (ip23.y - center_y) / size_h * 2 };
-    ip31 = { (ip31.x - center_x) / size_w * 2, (ip31.y - center_y) / size_h * 2 };
 }
 
-std::vector <uint32_t> build_isoline(
+// Writes the crossed edges' points into pos and the segments into ans, at most 4 indices per cell;
+// returns the number of indices written.
+size_t build_isoline(
     float x1, float y1, float x2, float y2,
     float val, float t,
-    size_t W_RES, size_t H_RES
+    size_t W_RES, size_t H_RES,
+    v2 *pos, uint32_t *ans
 ) {
-    std::vector <uint32_t> ans;
+    uint32_t *ans_begin = ans;
 
     for (size_t i = 0, p_ptr = 0; i < H_RES; i++) {
         for (size_t j = 0; j < W_RES; j++, p_ptr++) {
@@ -375,41 +373,51 @@ std::vector <uint32_t> build_isoline(
                 point_pos[w[0]], point_pos[w[1]], point_pos[w[2]],
                 isol_point_id[cell_ptr][2], isol_point_id[cell_ptr][4], isol_point_id[cell_ptr][1],
                 x1, y1, x2, y2,
-                val, t, ans
+                val, t, pos, ans
             );
 
             update_isoline_triangle(
                 point_pos[w[1]], point_pos[w[2]], point_pos[w[3]],
                 isol_point_id[cell_ptr][4], isol_point_id[cell_ptr][0], isol_point_id[cell_ptr][3],
                 x1, y1, x2, y2,
-                val, t, ans
+                val, t, pos, ans
             );
         }
 
         p_ptr++;
     }
 
-    return ans;
+    return ans - ans_begin;
 }
 
 void draw_isolines(
     size_t isolines_cnt,
     float x1, float y1, float x2, float y2, float t,
     size_t W_RES, size_t H_RES,
-    GLuint isol_pos_vbo, GLuint isol_ebo, GLuint isol_vao,
+    ring_buffer::ring_buffer_t &stream_ring, GLuint isol_vao,
     GLuint isol_program
 ) {
+    size_t points_cnt = W_RES * (H_RES + 1) + (W_RES + 1) * H_RES + W_RES * H_RES;
+
     for (size_t i = 0; i < isolines_cnt; i++) {
         float val = isol_vals[i];
-        isol_ind = build_isoline(x1, y1, x2, y2, val, t, W_RES, H_RES);
 
-        update_vbo(isol_pos_vbo, isol_point_pos);
-        update_ebo(isol_ebo, isol_ind);
+        // points then indices in one allocation, the ring hands out one at a time; the index count
+        // is only known after building, the allocation covers the worst case
+        size_t pos_bytes = sizeof(v2) * points_cnt;
+        ring_buffer::allocation_t isol = stream_ring.allocate(pos_bytes + sizeof(uint32_t) * 4 * W_RES * H_RES, sizeof(v2));
+        size_t isol_ind_cnt = build_isoline(
+            x1, y1, x2, y2, val, t, W_RES, H_RES,
+            isol.as<v2>(), reinterpret_cast<uint32_t *>(isol.as<unsigned char>() + pos_bytes)
+        );
+        stream_ring.commit(isol);
 
         glUseProgram(isol_program);
         glBindVertexArray(isol_vao);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, isol_ebo);
-        glDrawElements(GL_LINES, isol_ind.size(), GL_UNSIGNED_INT, (void*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, isol.buffer);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(v2), (void*)isol.offset);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, isol.buffer);
+        glDrawElements(GL_LINES, isol_ind_cnt, GL_UNSIGNED_INT, (void*)(isol.offset + pos_bytes));
     }
 }
 
@@ -451,12 +459,13 @@ int main() try {
 
     GLuint pos_vbo;
     glGenBuffers(1, &pos_vbo);
-    GLuint col_vbo;
-    glGenBuffers(1, &col_vbo);
     GLuint ebo;
     glGenBuffers(1, &ebo);
     
-    recalc_grid(X1, Y1, X2, Y2, 0, W_RES, H_RES, POINTS_CNT, pos_vbo, col_vbo, ebo);
+    recalc_grid(X1, Y1, X2, Y2, W_RES, H_RES, POINTS_CNT, pos_vbo, ebo);
+
+    // colors and isolines are rebuilt every frame, they live in the ring
+    ring_buffer::ring_buffer_t stream_ring("hw1 stream", 1 << 20);
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
@@ -464,21 +473,12 @@ int main() try {
     glBindBuffer(GL_ARRAY_BUFFER, pos_vbo);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(v2), (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, col_vbo);
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(color), (void*)0);
-
-    GLuint isol_pos_vbo;
-    glGenBuffers(1, &isol_pos_vbo);
-    GLuint isol_ebo;
-    glGenBuffers(1, &isol_ebo);
 
     GLuint isol_vao;
     glGenVertexArrays(1, &isol_vao);
     glBindVertexArray(isol_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, isol_pos_vbo);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(v2), (void*)0);
     
     GLuint vertex_sh = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
     GLuint fragment_sh = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
@@ -487,6 +487,9 @@ int main() try {
     GLuint isol_program = create_program(isol_vertex_sh, fragment_sh);
 
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
+
+    profiler::profiler_t frame_profiler;
+
     bool running = true;
     while (running) {
         bool recalc = false;
@@ -531,6 +534,11 @@ int main() try {
                     isolines_cnt++;
                 }
                 break;
+            case SDLK_t: {
+                std::ofstream trace("trace.json");
+                frame_profiler.write_chrome_trace(trace);
+                break;
+            }
             }
             break;
         case SDL_WINDOWEVENT: switch (event.window.event) {
@@ -554,30 +562,44 @@ int main() try {
         if (!running)
             break;
 
+        frame_profiler.begin_frame();
+
         float time = (float)clock() / CLOCKS_PER_SEC * 5;
+        frame_profiler.push("grid");
         if (recalc) {
             POINTS_CNT = (W_RES + 1) * (H_RES + 1);
-            recalc_grid(X1, Y1, X2, Y2, time, W_RES, H_RES, POINTS_CNT, pos_vbo, col_vbo, ebo);
-        } else {
-            recalc_positions_and_colors(X1, Y1, X2, Y2, time, W_RES, H_RES, pos_vbo, col_vbo, ebo);
+            recalc_grid(X1, Y1, X2, Y2, W_RES, H_RES, POINTS_CNT, pos_vbo, ebo);
         }
 
+        stream_ring.next_frame();
+        ring_buffer::allocation_t col = stream_ring.allocate(sizeof(color) * POINTS_CNT, sizeof(color));
+        write_colors(X1, Y1, X2, Y2, time, W_RES, H_RES, col.as<color>());
+        stream_ring.commit(col);
+        frame_profiler.pop();
+
+        frame_profiler.push("draw");
         glClear(GL_COLOR_BUFFER_BIT);
 
         glUseProgram(program);
         glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, col.buffer);
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(color), (void*)col.offset);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
         glDrawElements(GL_TRIANGLES, ind.size(), GL_UNSIGNED_INT, (void*)0);
 
+        frame_profiler.push("isolines");
         draw_isolines(
             isolines_cnt,
             X1, Y1, X2, Y2, time,
             W_RES, H_RES,
-            isol_pos_vbo, isol_ebo, isol_vao,
+            stream_ring, isol_vao,
             isol_program
         );
+        frame_profiler.pop();
+        frame_profiler.pop();
 
         SDL_GL_SwapWindow(window);
+        frame_profiler.end_frame();
     }
 
     SDL_GL_DeleteContext(gl_context);
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+
+namespace profiler {
+
+// Last `capacity` samples of a scope, in milliseconds.
+struct stats_t {
+    std::vector <double> samples;
+    std::size_t next = 0;
+
+    void add(double ms, std::size_t capacity) {
+        if (samples.size() < capacity) {
+            samples.push_back(ms);
+        } else {
+            samples[next] = ms;
+            next = (next + 1) % capacity;
+        }
+    }
+
+    double min() const {
+        return samples.empty() ? 0.0 : *std::min_element(samples.begin(), samples.end());
+    }
+
+    double avg() const {
+        double sum = 0.0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        return samples.empty() ? 0.0 : sum / samples.size();
+    }
+
+    double p99() const {
+        if (samples.empty()) {
+            return 0.0;
+        }
+        std::vector <double> sorted = samples;
+        std::size_t index = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+};
+
+// Nested named scopes timed on the CPU with steady_clock and on the GPU with GL_TIMESTAMP queries.
+// Timestamps (unlike GL_TIME_ELAPSED) can nest, every scope takes a query at its begin and end.
+// Queries of a frame are read back only once they're available, a few frames later, so the
+// profiler never stalls the pipeline; query objects are recycled through a pool.
+//
+// Scopes are identified by their path, e.g. "frame/draw/roses". Must be used from the GL thread.
+struct profiler_t {
+    bool gpu = true;
+
+    // rolling window of stats_t and how often report() is printed, 0 disables reporting
+    std::size_t window = 240;
+    int report_period = 600;
+
+    // trace events kept for write_chrome_trace, the oldest are dropped first
+    std::size_t max_trace_events = 200000;
+
+    std::map <std::string, stats_t> cpu_stats, gpu_stats;
+
+    profiler_t() {
+        start = std::chrono::steady_clock::now();
+    }
+
+    profiler_t(const profiler_t &) = delete;
+    profiler_t &operator=(const profiler_t &) = delete;
+
+    // Collects GPU results of earlier frames that are ready and opens the "frame" scope.
+    void begin_frame() {
+        if (gpu && !clock_synced) {
+            // maps GPU timestamps onto the CPU timeline of the trace
+            GLint64 gpu_now;
+            glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+            gpu_offset_us = cpu_us(std::chrono::steady_clock::now()) - gpu_now / 1e3;
+            clock_synced = true;
+        }
+
+        collect();
+
+        current.scopes.clear();
+        push("frame");
+    }
+
+    void end_frame() {
+        pop();
+
+        if (gpu && !current.scopes.empty()) {
+            pending.push_back(std::move(current));
+            current = frame_t();
+        }
+
+        if (report_period > 0 && ++frames_since_report >= report_period) {
+            report(std::cerr);
+            frames_since_report = 0;
+        }
+    }
+
+    void push(const std::string &name) {
+        open_scope_t scope;
+        scope.path = open.empty() ? name : open.back().path + "/" + name;
+        scope.start = std::chrono::steady_clock::now();
+
+        if (gpu) {
+            scope.gpu_index = current.scopes.size();
+            current.scopes.push_back({scope.path, query(), 0});
+            glQueryCounter(current.scopes.back().begin_query, GL_TIMESTAMP);
+        }
+
+        open.push_back(std::move(scope));
+    }
+
+    void pop() {
+        open_scope_t scope = std::move(open.back());
+        open.pop_back();
+
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - scope.start).count();
+        cpu_stats[scope.path].add(ms, window);
+        trace(scope.path, "cpu", cpu_us(scope.start), ms * 1e3);
+
+        if (gpu) {
+            GLuint end_query = query();
+            glQueryCounter(end_query, GL_TIMESTAMP);
+            current.scopes[scope.gpu_index].end_query = end_query;
+        }
+    }
+
+    struct scope_t {
+        profiler_t &owner;
+
+        scope_t(profiler_t &owner, const std::string &name) : owner(owner) {
+            owner.push(name);
+        }
+
+        scope_t(const scope_t &) = delete;
+
+        ~scope_t() {
+            owner.pop();
+        }
+    };
+
+    // frames whose GPU results haven't been read yet
+    std::size_t latency() const {
+        return pending.size();
+    }
+
+    void report(std::ostream &out) const {
+        out << std::fixed << std::setprecision(3) << "scope: cpu min/avg/p99 ms | gpu min/avg/p99 ms" << std::endl;
+        for (const auto &[path, cpu] : cpu_stats) {
+            std::size_t depth = std::count(path.begin(), path.end(), '/');
+            out << std::string(2 * depth, ' ') << path.substr(path.rfind('/') + 1) << ": " \
+                << cpu.min() << " / " << cpu.avg() << " / " << cpu.p99();
+            if (auto it = gpu_stats.find(path); it != gpu_stats.end()) {
+                out << " | " << it->second.min() << " / " << it->second.avg() << " / " << it->second.p99();
+            }
+            out << std::endl;
+        }
+    }
+
+    // Trace Event Format, open with chrome://tracing or ui.perfetto.dev. CPU and GPU scopes are
+    // shown as two threads of one process.
+    // Written by hand, so that targets without a JSON library can use the header as well.
+    void write_chrome_trace(std::ostream &out) const {
+        auto flags = out.flags();
+        auto precision = out.precision();
+        out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+        for (std::size_t i = 0; i < events.size(); i++) {
+            const event_t &event = events[i];
+            out << (i == 0 ? "" : ",") << "{\"name\":\"";
+            for (char c : event.path.substr(event.path.rfind('/') + 1)) {
+                if (c == '"' || c == '\\') {
+                    out << '\\';
+                }
+                if ((unsigned char)c >= 0x20) {
+                    out << c;
+                }
+            }
+            out << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"ts\":" << event.ts_us \
+                << ",\"dur\":" << event.duration_us << ",\"pid\":1,\"tid\":" << (event.category[0] == 'c' ? 1 : 2) << "}";
+        }
+        out << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    struct open_scope_t {
+        std::string path;
+        std::chrono::steady_clock::time_point start;
+        std::size_t gpu_index = 0;
+    };
+
+    struct gpu_scope_t {
+        std::string path;
+        GLuint begin_query, end_query;
+    };
+
+    struct frame_t {
+        std::vector <gpu_scope_t> scopes;
+    };
+
+    struct event_t {
+        std::string path;
+        const char *category;
+        double ts_us, duration_us;
+    };
+
+    std::vector <open_scope_t> open;
+    frame_t current;
+    std::deque <frame_t> pending;
+    std::vector <GLuint> free_queries;
+
+    std::deque <event_t> events;
+
+    std::chrono::steady_clock::time_point start;
+    bool clock_synced = false;
+    double gpu_offset_us = 0.0;
+    int frames_since_report = 0;
+
+    double cpu_us(std::chrono::steady_clock::time_point time) const {
+        return std::chrono::duration<double, std::micro>(time - start).count();
+    }
+
+    GLuint query() {
+        if (free_queries.empty()) {
+            GLuint result;
+            glGenQueries(1, &result);
+            return result;
+        }
+        GLuint result = free_queries.back();
+        free_queries.pop_back();
+        return result;
+    }
+
+    void trace(const std::string &path, const char *category, double ts_us, double duration_us) {
+        events.push_back({path, category, ts_us, duration_us});
+        if (events.size() > max_trace_events) {
+            events.pop_front();
+        }
+    }
+
+    // Frames finish in order and so do their queries: once the last query of a frame is
+    // available, all of its queries are.
+    void collect() {
+        while (!pending.empty()) {
+            frame_t &frame = pending.front();
+
+            GLint available = 0;
+            glGetQueryObjectiv(frame.scopes.front().end_query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                return;
+            }
+
+            for (auto &scope : frame.scopes) {
+                GLuint64 begin, end;
+                glGetQueryObjectui64v(scope.begin_query, GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(scope.end_query, GL_QUERY_RESULT, &end);
+
+                double ms = (end - begin) / 1e6;
+                gpu_stats[scope.path].add(ms, window);
+                trace(scope.path, "gpu", begin / 1e3 + gpu_offset_us, ms * 1e3);
+
+                free_queries.push_back(scope.begin_query);
+                free_queries.push_back(scope.end_query);
+            }
+
+            pending.pop_front();
+        }
+    }
+};
+
+}
@@ -38,10 +38,12 @@ struct mesh {
         }
     };
 
+    // only kept for meshes imported by assimp, cached ones are uploaded from the mapped file
     std::vector <vertex> vertices;
     std::vector <uint32_t> indices;
 
     GLuint vao, vbo, ebo;
+    uint32_t index_cnt;
     uint32_t material_id;
 
     float min_x, max_x;
@@ -114,13 +116,35 @@ struct mesh {
 
         material_id = src->mMaterialIndex;
 
+        upload(vertices.data(), vertices.size(), indices.data(), indices.size());
+    }
+
+    // a mesh flattened by an earlier import, see scene_cache.h
+    void init(const vertex *src_vertices, uint32_t vertex_cnt, const uint32_t *src_indices, uint32_t src_index_cnt,
+              uint32_t material, const std::array <float, 6> &bounds) {
+        min_x = bounds[0]; max_x = bounds[1];
+        min_y = bounds[2]; max_y = bounds[3];
+        min_z = bounds[4]; max_z = bounds[5];
+
+        x_size = max_x - min_x;
+        y_size = max_y - min_y;
+        z_size = max_z - min_z;
+
+        material_id = material;
+
+        upload(src_vertices, vertex_cnt, src_indices, src_index_cnt);
+    }
+
+    void upload(const vertex *src_vertices, std::size_t vertex_cnt, const uint32_t *src_indices, std::size_t src_index_cnt) {
+        index_cnt = src_index_cnt;
+
         glBindVertexArray(vao);
 
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertices[0]), vertices.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertex_cnt * sizeof(vertex), src_vertices, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), indices.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_cnt * sizeof(uint32_t), src_indices, GL_STATIC_DRAW);
 
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(mesh::vertex), (void*)(offsetof(mesh::vertex, mesh::vertex::position)));
@@ -148,6 +172,6 @@ struct mesh {
 
         glUniform1f(power_location, tex_params[material_id].power);
 
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, nullptr);
+        glDrawElements(GL_TRIANGLES, index_cnt, GL_UNSIGNED_INT, nullptr);
     }
 };
\ No newline at end of file
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "mesh.h"
-#include "stb_image.h"
+#include "texture_cache.h"
+#include "scene_cache.h"
 
 #include <algorithm>
 #include <cmath>
@@ -21,6 +22,8 @@
 struct scene {
     std::vector <mesh> objects;
     std::vector <mesh::texture_params> tex_params;
+    std::vector <scene_cache::material> materials;
+    texture_cache textures;
 
     float min_x, max_x;
     float min_y, max_y;
@@ -35,14 +38,57 @@ struct scene {
     float near, far;
 
     scene(const aiScene *src, std::string object_path) {
-        min_x = std::numeric_limits <float>::infinity(); max_x = -std::numeric_limits <float>::infinity();
-        min_y = std::numeric_limits <float>::infinity(); max_y = -std::numeric_limits <float>::infinity();
-        min_z = std::numeric_limits <float>::infinity(); max_z = -std::numeric_limits <float>::infinity();
-
         for (uint32_t i = 0; i < src->mNumMeshes; i++) {
             mesh obj(src->mMeshes[i]);
             objects.push_back(obj);
+        }
+
+        for (uint32_t i = 0; i < src->mNumMaterials; i++) {
+            scene_cache::material material;
+            aiString tmp;
+
+            // without a texture of its own, a material gets the previous path whitened
+            src->mMaterials[i]->GetTexture(aiTextureType_AMBIENT, 0, &tmp);
+            material.albedo_path = tmp.C_Str();
+            std::replace(material.albedo_path.begin(), material.albedo_path.end(), '\\', '/');
+            material.albedo_blank = src->mMaterials[i]->GetTextureCount(aiTextureType_AMBIENT) == 0;
+
+            src->mMaterials[i]->GetTexture(aiTextureType_OPACITY, 0, &tmp);
+            material.opacity_path = tmp.C_Str();
+            std::replace(material.opacity_path.begin(), material.opacity_path.end(), '\\', '/');
+            material.opacity_blank = src->mMaterials[i]->GetTextureCount(aiTextureType_OPACITY) == 0;
+
+            aiColor4D specular;
+            src->mMaterials[i]->Get(AI_MATKEY_COLOR_SPECULAR, specular);
+            material.glossiness = {specular.r, specular.g, specular.b};
+
+            src->mMaterials[i]->Get(AI_MATKEY_SHININESS, material.power);
 
+            materials.push_back(std::move(material));
+        }
+
+        init(object_path);
+    }
+
+    // the meshes and materials of an earlier import, see scene_cache.h
+    scene(const scene_cache &src, std::string object_path) {
+        for (const auto &it : src.meshes) {
+            mesh obj;
+            obj.init(it.vertices, it.vertex_cnt, it.indices, it.index_cnt, it.material_id, it.bounds);
+            objects.push_back(obj);
+        }
+
+        materials = src.materials;
+
+        init(object_path);
+    }
+
+    void init(const std::string &object_path) {
+        min_x = std::numeric_limits <float>::infinity(); max_x = -std::numeric_limits <float>::infinity();
+        min_y = std::numeric_limits <float>::infinity(); max_y = -std::numeric_limits <float>::infinity();
+        min_z = std::numeric_limits <float>::infinity(); max_z = -std::numeric_limits <float>::infinity();
+
+        for (const auto &obj : objects) {
             min_x = std::min(min_x, obj.min_x); max_x = std::max(max_x, obj.max_x);
             min_y = std::min(min_y, obj.min_y); max_y = std::max(max_y, obj.max_y);
             min_z = std::min(min_z, obj.min_z); max_z = std::max(max_z, obj.max_z);
@@ -60,83 +106,23 @@ struct scene {
         near = min_size / 10;
         far = max_size * 10;
 
-        int CHANNELS[] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
-
-        std::cerr << "trying to load " << src->mNumMaterials << " materials" << std::endl;
-        for (int i = 0; i < src->mNumMaterials; i++) {
-            aiString tmp;
-
-            src->mMaterials[i]->GetTexture(aiTextureType_AMBIENT, 0, &tmp);
-            std::string albedo_path(tmp.C_Str());
-            std::replace(albedo_path.begin(), albedo_path.end(), '\\', '/');
-            albedo_path = object_path + "/" + albedo_path;
-            int width, height, ch_cnt;
-            unsigned char *albedo_data = stbi_load(albedo_path.c_str(), &width, &height, &ch_cnt, 0);
-
-            glActiveTexture(GL_TEXTURE0);
-            GLuint albedo_tex;
-            glGenTextures(1, &albedo_tex);
-            if (albedo_data != nullptr) {
-                if (src->mMaterials[i]->GetTextureCount(aiTextureType_AMBIENT) == 0) {
-                    memset(albedo_data, 255, width * height);
-                    std::cerr << "ambient texture for " << albedo_path << " is missing" << std::endl;
-                } else {
-                    std::cerr << "loaded texture "
-                          << width << "x" << height << " with " << ch_cnt << " channels from "
-                          << albedo_path << std::endl;
-                }
-
-                glBindTexture(GL_TEXTURE_2D, albedo_tex);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, CHANNELS[ch_cnt], GL_UNSIGNED_BYTE, albedo_data);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-                glGenerateMipmap(GL_TEXTURE_2D);
-            } else {
-                std::cerr << "ambient texture for " << albedo_path << " is missing" << std::endl;
-            }
-            stbi_image_free(albedo_data);
-
-            src->mMaterials[i]->GetTexture(aiTextureType_OPACITY, 0, &tmp);
-            std::string opacity_path(tmp.C_Str());
-            std::replace(opacity_path.begin(), opacity_path.end(), '\\', '/');
-            opacity_path = object_path + "/" + opacity_path;
-            unsigned char *opacity_data = stbi_load(opacity_path.c_str(), &width, &height, &ch_cnt, 0);
-
-            glActiveTexture(GL_TEXTURE1);
-            GLuint opacity_tex;
-            glGenTextures(1, &opacity_tex);
-            if (opacity_data != nullptr) {
-                if (src->mMaterials[i]->GetTextureCount(aiTextureType_OPACITY) == 0) {
-                    memset(opacity_data, 255, width * height);
-                    std::cerr << "opacity texture for " << opacity_path << " is missing" << std::endl;
-                } else {
-                    std::cerr << "loaded texture "
-                          << width << "x" << height << " with " << ch_cnt << " channels from "
-                          << opacity_path << std::endl;
-                }
-
-                glBindTexture(GL_TEXTURE_2D, opacity_tex);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, CHANNELS[ch_cnt], GL_UNSIGNED_BYTE, opacity_data);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            } else {
-                std::cerr << "opacity texture for " << opacity_path << " is missing" << std::endl;
-            }
-            stbi_image_free(opacity_data);
-
-            aiColor4D specular;
-            src->mMaterials[i]->Get(AI_MATKEY_COLOR_SPECULAR, specular);
-
-            float power;
-            src->mMaterials[i]->Get(AI_MATKEY_SHININESS, power);
+        std::cerr << "trying to load " << materials.size() << " materials" << std::endl;
+        for (const auto &material : materials) {
+            GLuint albedo_tex = textures.get(
+                object_path + "/" + material.albedo_path, texture_cache::usage::albedo, material.albedo_blank
+            );
+            GLuint opacity_tex = textures.get(
+                object_path + "/" + material.opacity_path, texture_cache::usage::opacity, material.opacity_blank
+            );
 
             tex_params.push_back(mesh::texture_params(
                 albedo_tex,
                 opacity_tex,
-                glm::vec3(specular.r, specular.g, specular.b),
-                power
+                glm::vec3(material.glossiness[0], material.glossiness[1], material.glossiness[2]),
+                material.power
             ));
         }
+        textures.report(std::cerr);
     }
 
     void draw(GLuint glossiness_location, GLuint power_location) {
@@ -0,0 +1,333 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <array>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <filesystem>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <assimp/DefaultIOSystem.h>
+
+// The scene as it comes out of assimp and its post-processing, flattened into one binary file next
+// to the model (`sponza.obj` is cached in `sponza.obj.scene`): every file the import read, the
+// material table with texture paths relative to the objects directory, then each mesh with its
+// bounds, vertices and indices. Later launches map the file and upload meshes straight from it
+// instead of importing again.
+//
+// The cache is stale when any of the files the import read changed size or modification time, or
+// when it was made with other post-processing flags.
+struct scene_cache {
+    struct source {
+        std::string path;
+        std::uint64_t size;
+        std::int64_t time;
+    };
+
+    struct material {
+        std::string albedo_path, opacity_path;
+
+        // the material has no texture of this kind, see texture_cache::key
+        bool albedo_blank, opacity_blank;
+
+        std::array <float, 3> glossiness;
+        float power;
+    };
+
+    struct mesh_view {
+        const mesh::vertex *vertices;
+        uint32_t vertex_cnt;
+        const uint32_t *indices;
+        uint32_t index_cnt;
+        uint32_t material_id;
+
+        // min x, max x, min y, max y, min z, max z
+        std::array <float, 6> bounds;
+    };
+
+    // Remembers every file assimp opens, so that the .obj's .mtl invalidates the cache as well.
+    struct recording_io_system : Assimp::DefaultIOSystem {
+        std::vector <source> &sources;
+
+        explicit recording_io_system(std::vector <source> &sources) : sources(sources) {}
+
+        Assimp::IOStream *Open(const char *file, const char *mode = "rb") override {
+            Assimp::IOStream *result = Assimp::DefaultIOSystem::Open(file, mode);
+            if (result != nullptr) {
+                // importers may open a file more than once
+                source stamp = stamp_of(file);
+                if (!stamp.path.empty() && (sources.empty() || sources.back().path != stamp.path)) {
+                    sources.push_back(std::move(stamp));
+                }
+            }
+            return result;
+        }
+    };
+
+    // Views into the mapped file, valid while the cache is open.
+    std::vector <material> materials;
+    std::vector <mesh_view> meshes;
+
+    scene_cache() = default;
+    scene_cache(const scene_cache &) = delete;
+    scene_cache &operator=(const scene_cache &) = delete;
+
+    ~scene_cache() {
+        close();
+    }
+
+    static std::filesystem::path path_for(const std::filesystem::path &model) {
+        std::filesystem::path result = model;
+        result += ".scene";
+        return result;
+    }
+
+    // False if the cache is missing, stale, of another version or damaged.
+    bool open(const std::filesystem::path &path, uint32_t process_flags) {
+        close();
+        if (!map(path) || !parse(process_flags)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        materials.clear();
+        meshes.clear();
+#ifndef WIN32
+        if (begin != nullptr) {
+            munmap(const_cast<std::byte *>(begin), bytes);
+        }
+#endif
+        storage.clear();
+        begin = nullptr;
+        bytes = 0;
+    }
+
+    std::size_t size() const {
+        return bytes;
+    }
+
+    // Meshes are written as they were uploaded, so they have to come from assimp (see mesh::init).
+    static void save(const std::filesystem::path &path, uint32_t process_flags, const std::vector <source> &sources,
+                     const std::vector <material> &materials, const std::vector <mesh> &meshes) {
+        // the cache is only an optimization, a read-only directory just means importing every launch
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
+        std::ofstream output(temporary, std::ios::binary);
+        if (!output) {
+            return;
+        }
+
+        auto write = [&](const void *data, std::size_t size) {
+            output.write(reinterpret_cast<const char *>(data), size);
+        };
+        auto write_u32 = [&](uint32_t value) {
+            write(&value, sizeof(value));
+        };
+        auto write_string = [&](const std::string &value) {
+            write_u32(value.size());
+            write(value.data(), value.size());
+        };
+        auto pad = [&]() {
+            static const char zeros[alignment] = {};
+            write(zeros, (alignment - (std::size_t)output.tellp() % alignment) % alignment);
+        };
+
+        write(magic, sizeof(magic));
+        write_u32(version);
+        write_u32(process_flags);
+        write_u32(sources.size());
+        write_u32(materials.size());
+        write_u32(meshes.size());
+
+        for (const auto &it : sources) {
+            write(&it.size, sizeof(it.size));
+            write(&it.time, sizeof(it.time));
+            write_string(it.path);
+        }
+
+        for (const auto &it : materials) {
+            write_string(it.albedo_path);
+            write_string(it.opacity_path);
+            write_u32(it.albedo_blank);
+            write_u32(it.opacity_blank);
+            write(it.glossiness.data(), sizeof(it.glossiness));
+            write(&it.power, sizeof(it.power));
+        }
+
+        for (const auto &it : meshes) {
+            std::array <float, 6> bounds = {it.min_x, it.max_x, it.min_y, it.max_y, it.min_z, it.max_z};
+            write_u32(it.vertices.size());
+            write_u32(it.indices.size());
+            write_u32(it.material_id);
+            write(bounds.data(), sizeof(bounds));
+            pad();
+            write(it.vertices.data(), it.vertices.size() * sizeof(it.vertices[0]));
+            write(it.indices.data(), it.indices.size() * sizeof(it.indices[0]));
+        }
+
+        output.close();
+        std::error_code error;
+        if (output) {
+            std::filesystem::rename(temporary, path, error);
+        } else {
+            std::filesystem::remove(temporary, error);
+        }
+    }
+
+    static source stamp_of(const std::string &path) {
+        std::error_code error;
+        source result{path, std::filesystem::file_size(path, error), 0};
+        if (!error) {
+            result.time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        }
+        if (error) {
+            result.path.clear();
+        }
+        return result;
+    }
+
+private:
+    static constexpr char magic[4] = {'S', 'C', 'N', 'E'};
+    static constexpr uint32_t version = 1;
+
+    // vertices start at a multiple of this
+    static constexpr std::size_t alignment = 16;
+
+    const std::byte *begin = nullptr;
+    std::size_t bytes = 0;
+
+    // without mmap the file is read into memory instead
+    std::vector <std::byte> storage;
+
+    bool map(const std::filesystem::path &path) {
+#ifndef WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        void *data = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        begin = static_cast<const std::byte *>(data);
+        bytes = info.st_size;
+#else
+        std::ifstream input(path, std::ios::binary | std::ios::ate);
+        if (!input) {
+            return false;
+        }
+        storage.resize(input.tellg());
+        input.seekg(0);
+        input.read(reinterpret_cast<char *>(storage.data()), storage.size());
+        if (!input || storage.empty()) {
+            return false;
+        }
+        begin = storage.data();
+        bytes = storage.size();
+#endif
+        return true;
+    }
+
+    bool parse(uint32_t process_flags) {
+        std::size_t offset = 0;
+        bool ok = true;
+
+        auto take = [&](std::size_t size) -> const std::byte * {
+            if (!ok || size > bytes - offset) {
+                ok = false;
+                return nullptr;
+            }
+            const std::byte *result = begin + offset;
+            offset += size;
+            return result;
+        };
+        auto read = [&](void *data, std::size_t size) {
+            if (const std::byte *p = take(size)) {
+                memcpy(data, p, size);
+            }
+        };
+        auto read_u32 = [&]() {
+            uint32_t value = 0;
+            read(&value, sizeof(value));
+            return value;
+        };
+        auto read_string = [&]() {
+            uint32_t size = read_u32();
+            const std::byte *p = take(size);
+            return p ? std::string(reinterpret_cast<const char *>(p), size) : std::string();
+        };
+
+        char stored_magic[4] = {};
+        read(stored_magic, sizeof(stored_magic));
+        uint32_t stored_version = read_u32();
+        uint32_t stored_flags = read_u32();
+        uint32_t sources_cnt = read_u32();
+        uint32_t materials_cnt = read_u32();
+        uint32_t meshes_cnt = read_u32();
+        if (!ok || memcmp(stored_magic, magic, sizeof(magic)) != 0 || stored_version != version \
+            || stored_flags != process_flags) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < sources_cnt && ok; i++) {
+            source stored;
+            read(&stored.size, sizeof(stored.size));
+            read(&stored.time, sizeof(stored.time));
+            stored.path = read_string();
+
+            source current = stamp_of(stored.path);
+            if (current.path.empty() || current.size != stored.size || current.time != stored.time) {
+                return false;
+            }
+        }
+
+        for (uint32_t i = 0; i < materials_cnt && ok; i++) {
+            material it;
+            it.albedo_path = read_string();
+            it.opacity_path = read_string();
+            it.albedo_blank = read_u32() != 0;
+            it.opacity_blank = read_u32() != 0;
+            read(it.glossiness.data(), sizeof(it.glossiness));
+            read(&it.power, sizeof(it.power));
+            materials.push_back(std::move(it));
+        }
+
+        for (uint32_t i = 0; i < meshes_cnt && ok; i++) {
+            mesh_view it;
+            it.vertex_cnt = read_u32();
+            it.index_cnt = read_u32();
+            it.material_id = read_u32();
+            read(it.bounds.data(), sizeof(it.bounds));
+            take((alignment - offset % alignment) % alignment);
+
+            it.vertices = reinterpret_cast<const mesh::vertex *>(take((std::size_t)it.vertex_cnt * sizeof(mesh::vertex)));
+            it.indices = reinterpret_cast<const uint32_t *>(take((std::size_t)it.index_cnt * sizeof(uint32_t)));
+            if (ok && it.material_id >= materials_cnt) {
+                ok = false;
+            }
+            meshes.push_back(it);
+        }
+
+        return ok && offset == bytes;
+    }
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "stb_image.h"
+#include "mip_chain.hpp"
+#include "thread_pool.hpp"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <compare>
+#include <filesystem>
+#include <iostream>
+
+#include <GL/glew.h>
+
+// Textures of the scene's materials by file. Sponza-like scenes reuse a few images across many
+// materials, each of them is decoded and uploaded once. The scene lives as long as the program,
+// so textures are never evicted.
+//
+// Mip chains are generated on the CPU (gamma-correct for albedo, keeping the coverage of opacity
+// masks) and cached next to the image, see mip_chain.hpp.
+//
+// The shader only reads the color of both kinds, so textures are uploaded without alpha, and
+// opacity masks whose channels repeat each other (or are missing) as a single channel.
+struct texture_cache {
+    enum class usage {
+        albedo,     // trilinear
+        opacity,    // nearest texels, linear between levels
+    };
+
+    struct key {
+        std::string path;
+        usage use;
+
+        // the material has no texture of this kind, the image is whitened (see load())
+        bool blank;
+
+        auto operator<=>(const key &) const = default;
+    };
+
+    struct stats {
+        std::uint64_t hits = 0, misses = 0;
+        std::size_t bytes = 0;
+        // what the same levels would take as RGBA8
+        std::size_t rgba8_bytes = 0;
+    };
+
+    std::map <key, GLuint> textures;
+    stats cache_stats;
+
+    thread_pool::thread_pool_t workers;
+
+    GLuint get(const std::string &path, usage use, bool blank) {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+        key k{error ? path : canonical.string(), use, blank};
+
+        if (auto it = textures.find(k); it != textures.end()) {
+            cache_stats.hits++;
+            return it->second;
+        }
+
+        cache_stats.misses++;
+        GLuint result = load(path, use, blank);
+        textures.emplace(std::move(k), result);
+        return result;
+    }
+
+    void report(std::ostream &out) const {
+        out << "textures: " << textures.size() << " loaded, " << cache_stats.bytes / (1024 * 1024) << " MiB (" \
+            << (cache_stats.rgba8_bytes - cache_stats.bytes) / (1024 * 1024) << " MiB less than RGBA8), " \
+            << cache_stats.hits << " hits, " << cache_stats.misses << " misses" << std::endl;
+    }
+
+private:
+    static mip_settings settings_for(usage use) {
+        mip_settings result;
+        if (use == usage::opacity) {
+            // about where the shader starts discarding, the mask is in the color channels
+            result.srgb = false;
+            result.coverage_cutoff = 0.05f;
+            result.coverage_in_color = true;
+        }
+        return result;
+    }
+
+    // what GL makes of an image with fewer channels: missing color is 0, missing alpha is 1
+    static std::vector <unsigned char> expand_to_rgba(const unsigned char *data, int width, int height, int ch_cnt) {
+        std::vector <unsigned char> result(4 * (std::size_t)width * height);
+        for (std::size_t i = 0; i < (std::size_t)width * height; i++) {
+            for (int c = 0; c < 4; c++) {
+                result[4 * i + c] = c < ch_cnt ? data[i * ch_cnt + c] : (c == 3 ? 255 : 0);
+            }
+        }
+        return result;
+    }
+
+    // How the levels are stored on the GPU: the channels kept of the expanded RGBA and the swizzle
+    // giving the shader the color it saw with RGBA8.
+    struct layout {
+        int ch_cnt;
+        GLint swizzle[4];
+    };
+
+    static layout choose_layout(const std::vector <mip_level> &levels, usage use) {
+        layout result{3, {GL_RED, GL_GREEN, GL_BLUE, GL_ONE}};
+        if (use != usage::opacity) {
+            return result;
+        }
+
+        // single channel files expand to (r, 0, 0), grey ones to (r, r, r)
+        bool red_only = true, grey = true;
+        for (const auto &level : levels) {
+            for (std::size_t i = 0; i < level.data.size(); i += 4) {
+                const std::uint8_t *p = &level.data[i];
+                red_only = red_only && p[1] == 0 && p[2] == 0;
+                grey = grey && p[1] == p[0] && p[2] == p[0];
+            }
+        }
+        if (red_only) {
+            result = {1, {GL_RED, GL_ZERO, GL_ZERO, GL_ONE}};
+        } else if (grey) {
+            result = {1, {GL_RED, GL_RED, GL_RED, GL_ONE}};
+        }
+        return result;
+    }
+
+    static std::vector <unsigned char> pack_channels(const mip_level &level, int ch_cnt) {
+        std::vector <unsigned char> result(ch_cnt * (std::size_t)level.width * level.height);
+        for (std::size_t i = 0; i < (std::size_t)level.width * level.height; i++) {
+            memcpy(&result[i * ch_cnt], &level.data[4 * i], ch_cnt);
+        }
+        return result;
+    }
+
+    GLuint load(const std::string &path, usage use, bool blank) {
+        const char *kind = use == usage::albedo ? "ambient" : "opacity";
+        mip_settings settings = settings_for(use);
+
+        // whitened images aren't what the file holds, they don't go to the disk cache
+        std::vector <mip_level> levels;
+        if (!blank && load_mips(levels, settings, cached_mips_path(path), path)) {
+            std::cerr << "loaded " << levels.size() << " mip levels of " << levels[0].width << "x" << levels[0].height \
+                      << " from " << cached_mips_path(path).string() << std::endl;
+        } else {
+            int width, height, ch_cnt;
+            unsigned char *data = stbi_load(path.c_str(), &width, &height, &ch_cnt, 0);
+            if (data != nullptr) {
+                if (blank) {
+                    memset(data, 255, width * height);
+                    std::cerr << kind << " texture for " << path << " is missing" << std::endl;
+                } else {
+                    std::cerr << "loaded texture "
+                              << width << "x" << height << " with " << ch_cnt << " channels from "
+                              << path << std::endl;
+                }
+
+                std::vector <unsigned char> rgba = expand_to_rgba(data, width, height, ch_cnt);
+                levels = generate_mips(rgba.data(), width, height, settings, &workers);
+                if (!blank) {
+                    save_mips(levels, settings, cached_mips_path(path));
+                }
+            } else {
+                std::cerr << kind << " texture for " << path << " is missing" << std::endl;
+            }
+            stbi_image_free(data);
+        }
+
+        GLuint tex;
+        glGenTextures(1, &tex);
+        if (!levels.empty()) {
+            layout format = choose_layout(levels, use);
+            GLint internal_format = format.ch_cnt == 1 ? GL_R8 : GL_RGB8;
+            GLenum data_format = format.ch_cnt == 1 ? GL_RED : GL_RGB;
+
+            std::size_t bytes = 0, rgba8_bytes = 0;
+            glBindTexture(GL_TEXTURE_2D, tex);
+            // rows of packed levels aren't 4 byte aligned
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (std::size_t level = 0; level < levels.size(); level++) {
+                std::vector <unsigned char> data = pack_channels(levels[level], format.ch_cnt);
+                glTexImage2D(GL_TEXTURE_2D, level, internal_format, levels[level].width, levels[level].height, 0, \
+                             data_format, GL_UNSIGNED_BYTE, data.data());
+                bytes += data.size();
+                rgba8_bytes += levels[level].data.size();
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels.size() - 1);
+
+            cache_stats.bytes += bytes;
+            cache_stats.rgba8_bytes += rgba8_bytes;
+            std::cerr << kind << " texture " << path << ": " << (format.ch_cnt == 1 ? "R8" : "RGB8") << ", " \
+                      << bytes / 1024 << " KiB, " << (rgba8_bytes - bytes) / 1024 << " KiB less than RGBA8" << std::endl;
+            if (use == usage::albedo) {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            } else {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+            }
+        }
+
+        return tex;
+    }
+};
@@ -1,5 +1,6 @@
 #include "scene.h"
 #include "shaders.h"
+#include "profiler.hpp"
 
 #ifdef WIN32
 #include <SDL.h>
@@ -19,6 +20,7 @@
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <optional>
 
 #include <GL/glew.h>
 
@@ -112,12 +114,41 @@ int main(int argc, char **argv) try {
     std::string project_root = PROJECT_ROOT;
     std::string model_path = project_root + "/objects/" + argv[1];
 
-    Assimp::Importer Importer;
-    const aiScene* pScene = Importer.ReadFile(
-        model_path.c_str(),
-        iProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices
-    );
-    scene sc(pScene, project_root + "/objects");
+    // `hw2 sponza.obj --no-scene-cache` imports with assimp every launch, e.g. to compare startup times
+    bool use_scene_cache = !(argc > 2 && std::string_view(argv[2]) == "--no-scene-cache");
+    const uint32_t process_flags =
+        aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices;
+
+    auto load_start = std::chrono::high_resolution_clock::now();
+    auto ms_since = [](auto start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    std::filesystem::path cache_path = scene_cache::path_for(model_path);
+    std::optional <scene> loaded;
+    scene_cache cache;
+    if (use_scene_cache && cache.open(cache_path, process_flags)) {
+        std::cerr << "mapped " << cache.size() / 1024 << " KiB of scene from " << cache_path.string() << " in " \
+                  << ms_since(load_start) << " ms" << std::endl;
+        loaded.emplace(cache, project_root + "/objects");
+        cache.close();
+    } else {
+        std::vector <scene_cache::source> sources;
+        Assimp::Importer Importer;
+        Importer.SetIOHandler(new scene_cache::recording_io_system(sources));
+        const aiScene* pScene = Importer.ReadFile(model_path.c_str(), process_flags);
+        if (pScene == nullptr) {
+            throw std::runtime_error(std::string("assimp: ") + Importer.GetErrorString());
+        }
+        std::cerr << "imported " << model_path << " with assimp in " << ms_since(load_start) << " ms" << std::endl;
+
+        loaded.emplace(pScene, project_root + "/objects");
+        if (use_scene_cache) {
+            scene_cache::save(cache_path, process_flags, sources, loaded->materials, loaded->objects);
+        }
+    }
+    scene &sc = *loaded;
+    std::cerr << "scene ready in " << ms_since(load_start) << " ms" << std::endl;
     
     auto last_frame_start = std::chrono::high_resolution_clock::now();
     float time = 0.f;
@@ -125,6 +156,8 @@ int main(int argc, char **argv) try {
     std::map<SDL_Keycode, bool> button_down;
     bool slow_mode = false;
 
+    profiler::profiler_t frame_profiler;
+
     bool running = true;
     while (running) {
         for (SDL_Event event; SDL_PollEvent(&event);)
@@ -142,6 +175,10 @@ int main(int argc, char **argv) try {
                     break;
                 case SDL_KEYDOWN:
                     button_down[event.key.keysym.sym] = true;
+                    if (event.key.keysym.sym == SDLK_t) {
+                        std::ofstream trace("trace.json");
+                        frame_profiler.write_chrome_trace(trace);
+                    }
                     break;
                 case SDL_KEYUP:
                     button_down[event.key.keysym.sym] = false;
@@ -151,6 +188,8 @@ int main(int argc, char **argv) try {
         if (!running)
             break;
 
+        frame_profiler.begin_frame();
+
         auto now = std::chrono::high_resolution_clock::now();
         float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
         last_frame_start = now;
@@ -197,6 +236,8 @@ int main(int argc, char **argv) try {
             slow_mode = !slow_mode;
         }
 
+        frame_profiler.push("draw");
+
         glViewport(0, 0, width, height);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glClearColor(0.8f, 0.8f, 1.f, 0.f);
@@ -252,8 +293,10 @@ int main(int argc, char **argv) try {
         glUniform1i(opacity_texture_location, 1);
 
         sc.draw(glossiness_location, power_location);
+        frame_profiler.pop();
 
         SDL_GL_SwapWindow(window);
+        frame_profiler.end_frame();
     }
 
     SDL_GL_DeleteContext(gl_context);
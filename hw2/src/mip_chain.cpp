@@ -0,0 +1,376 @@
+#include "mip_chain.hpp"
+
+#include "thread_pool.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_CHAIN_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+char const mips_magic[4] = {'M', 'I', 'P', 'S'};
+std::uint32_t const mips_version = 1;
+
+// rows of a level filtered by one task
+std::size_t const rows_per_task = 16;
+
+// RGBA, 4 floats per pixel, color in linear space
+struct float_image
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> data;
+
+    float * pixel(int x, int y)
+    {
+        return data.data() + 4 * ((std::size_t)y * width + x);
+    }
+};
+
+float const * srgb_to_linear_table()
+{
+    static float const * table = []
+    {
+        static float result[256];
+        for (int i = 0; i < 256; ++i)
+        {
+            float c = i / 255.f;
+            result[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return result;
+    }();
+    return table;
+}
+
+int const linear_to_srgb_steps = 4096;
+
+std::uint8_t const * linear_to_srgb_table()
+{
+    static std::uint8_t const * table = []
+    {
+        static std::uint8_t result[linear_to_srgb_steps + 1];
+        for (int i = 0; i <= linear_to_srgb_steps; ++i)
+        {
+            float c = (float)i / linear_to_srgb_steps;
+            float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+            result[i] = (std::uint8_t)std::lround(std::clamp(s, 0.f, 1.f) * 255.f);
+        }
+        return result;
+    }();
+    return table;
+}
+
+// Kaiser-windowed sinc for a 2:1 reduction, the taps sit at -3.5 .. 3.5 source pixels from the
+// center of the destination pixel.
+int const kaiser_taps = 8;
+
+float const * kaiser_weights()
+{
+    static float const * weights = []
+    {
+        auto bessel_i0 = [](double x)
+        {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; k < 32; ++k)
+            {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+
+        double const pi = 3.14159265358979323846;
+        double const beta = 4.0;
+        double const radius = kaiser_taps / 2.0;
+
+        static float result[kaiser_taps];
+        double total = 0.0;
+        for (int k = 0; k < kaiser_taps; ++k)
+        {
+            double d = k - (kaiser_taps - 1) / 2.0;
+            double x = pi * d / 2.0;
+            double sinc = std::sin(x) / x;
+            double window = bessel_i0(beta * std::sqrt(1.0 - (d / radius) * (d / radius))) / bessel_i0(beta);
+            result[k] = (float)(sinc * window);
+            total += result[k];
+        }
+        for (int k = 0; k < kaiser_taps; ++k)
+            result[k] = (float)(result[k] / total);
+        return result;
+    }();
+    return weights;
+}
+
+// out = sum of weights[k] * pixels[k], a pixel being 4 floats
+void weighted_sum(float const * const * pixels, float const * weights, int taps, float * out)
+{
+#ifdef MIP_CHAIN_SSE2
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < taps; ++k)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(pixels[k])));
+    _mm_storeu_ps(out, sum);
+#else
+    float sum[4] = {};
+    for (int k = 0; k < taps; ++k)
+        for (int c = 0; c < 4; ++c)
+            sum[c] += weights[k] * pixels[k][c];
+    std::copy(sum, sum + 4, out);
+#endif
+}
+
+template <typename F>
+void for_rows(thread_pool::thread_pool_t * pool, int rows, F && f)
+{
+    auto task = [&](std::size_t, std::size_t begin, std::size_t end)
+    {
+        for (std::size_t y = begin; y < end; ++y)
+            f((int)y);
+    };
+
+    if (pool)
+        pool->parallel_for(rows, rows_per_task, task);
+    else
+        task(0, 0, rows);
+}
+
+float_image box_reduce(float_image & source, int width, int height, thread_pool::thread_pool_t * pool)
+{
+    static float const weights[4] = {.25f, .25f, .25f, .25f};
+
+    float_image result{width, height, std::vector<float>(4 * (std::size_t)width * height)};
+    for_rows(pool, height, [&](int y)
+    {
+        int y0 = std::min(2 * y, source.height - 1), y1 = std::min(2 * y + 1, source.height - 1);
+        for (int x = 0; x < width; ++x)
+        {
+            int x0 = std::min(2 * x, source.width - 1), x1 = std::min(2 * x + 1, source.width - 1);
+            float const * pixels[4] = {source.pixel(x0, y0), source.pixel(x1, y0), source.pixel(x0, y1), source.pixel(x1, y1)};
+            weighted_sum(pixels, weights, 4, result.pixel(x, y));
+        }
+    });
+    return result;
+}
+
+// separable: rows first, then columns; a side of 1 pixel is left as is
+float_image kaiser_reduce(float_image & source, int width, int height, thread_pool::thread_pool_t * pool)
+{
+    float const * weights = kaiser_weights();
+    int const first_tap = -(kaiser_taps / 2 - 1);
+
+    float_image rows{width, source.height, {}};
+    if (width == source.width)
+    {
+        rows.data = source.data;
+    }
+    else
+    {
+        rows.data.resize(4 * (std::size_t)width * source.height);
+        for_rows(pool, source.height, [&](int y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                float const * pixels[kaiser_taps];
+                for (int k = 0; k < kaiser_taps; ++k)
+                    pixels[k] = source.pixel(std::clamp(2 * x + first_tap + k, 0, source.width - 1), y);
+                weighted_sum(pixels, weights, kaiser_taps, rows.pixel(x, y));
+            }
+        });
+    }
+
+    if (height == rows.height)
+        return rows;
+
+    float_image result{width, height, std::vector<float>(4 * (std::size_t)width * height)};
+    for_rows(pool, height, [&](int y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            float const * pixels[kaiser_taps];
+            for (int k = 0; k < kaiser_taps; ++k)
+                pixels[k] = rows.pixel(x, std::clamp(2 * y + first_tap + k, 0, rows.height - 1));
+            weighted_sum(pixels, weights, kaiser_taps, result.pixel(x, y));
+        }
+    });
+    return result;
+}
+
+float mask_value(float const * pixel, mip_settings const & settings)
+{
+    return settings.coverage_in_color ? pixel[0] : pixel[3];
+}
+
+float coverage(float_image const & image, mip_settings const & settings, float scale)
+{
+    std::size_t covered = 0, pixels = (std::size_t)image.width * image.height;
+    for (std::size_t i = 0; i < pixels; ++i)
+        if (mask_value(image.data.data() + 4 * i, settings) * scale >= settings.coverage_cutoff)
+            ++covered;
+    return (float)covered / pixels;
+}
+
+// mask scale that brings the coverage of `image` closest to `target`, found by bisection
+float coverage_scale(float_image const & image, mip_settings const & settings, float target)
+{
+    float low = 0.f, high = 4.f;
+    for (int iteration = 0; iteration < 12; ++iteration)
+    {
+        float middle = (low + high) / 2.f;
+        if (coverage(image, settings, middle) < target)
+            low = middle;
+        else
+            high = middle;
+    }
+    return high;
+}
+
+mip_level quantize(float_image const & image, mip_settings const & settings, float mask_scale)
+{
+    std::uint8_t const * to_srgb = linear_to_srgb_table();
+
+    mip_level result{image.width, image.height, std::vector<std::uint8_t>(4 * (std::size_t)image.width * image.height)};
+    std::size_t pixels = (std::size_t)image.width * image.height;
+    for (std::size_t i = 0; i < pixels; ++i)
+    {
+        float const * pixel = image.data.data() + 4 * i;
+        for (int c = 0; c < 4; ++c)
+        {
+            bool masked = settings.coverage_in_color ? c < 3 : c == 3;
+            float value = std::clamp(masked ? pixel[c] * mask_scale : pixel[c], 0.f, 1.f);
+            if (settings.srgb && c < 3)
+                result.data[4 * i + c] = to_srgb[(int)std::lround(value * linear_to_srgb_steps)];
+            else
+                result.data[4 * i + c] = (std::uint8_t)std::lround(value * 255.f);
+        }
+    }
+    return result;
+}
+
+}
+
+std::vector<mip_level> generate_mips(std::uint8_t const * rgba, int width, int height, mip_settings const & settings,
+    thread_pool::thread_pool_t * pool)
+{
+    std::vector<mip_level> result;
+    result.push_back({width, height, std::vector<std::uint8_t>(rgba, rgba + 4 * (std::size_t)width * height)});
+
+    float const * to_linear = srgb_to_linear_table();
+    float_image level{width, height, std::vector<float>(4 * (std::size_t)width * height)};
+    for (std::size_t i = 0; i < level.data.size(); ++i)
+        level.data[i] = settings.srgb && i % 4 != 3 ? to_linear[rgba[i]] : rgba[i] / 255.f;
+
+    bool preserve_coverage = settings.coverage_cutoff >= 0.f;
+    float target_coverage = preserve_coverage ? coverage(level, settings, 1.f) : 0.f;
+
+    while (level.width > 1 || level.height > 1)
+    {
+        int next_width = std::max(1, level.width / 2);
+        int next_height = std::max(1, level.height / 2);
+        level = settings.filter == mip_filter::box
+            ? box_reduce(level, next_width, next_height, pool)
+            : kaiser_reduce(level, next_width, next_height, pool);
+
+        // scaled only on output, the next level is filtered from the unscaled one
+        float scale = preserve_coverage ? coverage_scale(level, settings, target_coverage) : 1.f;
+        result.push_back(quantize(level, settings, scale));
+    }
+
+    return result;
+}
+
+mip_settings mip_settings_for(std::filesystem::path const & path)
+{
+    std::string name = path.filename().string();
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+    mip_settings result;
+    for (char const * data : {"normal", "rough", "opacity"})
+        if (name.find(data) != std::string::npos)
+            result.srgb = false;
+    return result;
+}
+
+std::filesystem::path cached_mips_path(std::filesystem::path const & source)
+{
+    std::filesystem::path result = source;
+    result += ".mips";
+    return result;
+}
+
+void save_mips(std::vector<mip_level> const & levels, mip_settings const & settings, std::filesystem::path const & path)
+{
+    // the cache is only an optimization, a read-only directory just means generating every launch
+    std::ofstream output(path, std::ios::binary);
+    if (!output)
+        return;
+
+    std::uint32_t count = (std::uint32_t)levels.size();
+    std::uint32_t flags[3] = {(std::uint32_t)settings.filter, settings.srgb, settings.coverage_in_color};
+    output.write(mips_magic, sizeof(mips_magic));
+    output.write(reinterpret_cast<char const *>(&mips_version), sizeof(mips_version));
+    output.write(reinterpret_cast<char const *>(flags), sizeof(flags));
+    output.write(reinterpret_cast<char const *>(&settings.coverage_cutoff), sizeof(settings.coverage_cutoff));
+    output.write(reinterpret_cast<char const *>(&count), sizeof(count));
+    for (auto const & level : levels)
+    {
+        output.write(reinterpret_cast<char const *>(&level.width), sizeof(level.width));
+        output.write(reinterpret_cast<char const *>(&level.height), sizeof(level.height));
+        output.write(reinterpret_cast<char const *>(level.data.data()), level.data.size());
+    }
+}
+
+bool load_mips(std::vector<mip_level> & levels, mip_settings const & settings, std::filesystem::path const & path,
+    std::filesystem::path const & source)
+{
+    std::error_code error;
+    auto cached_time = std::filesystem::last_write_time(path, error);
+    if (error)
+        return false;
+    auto source_time = std::filesystem::last_write_time(source, error);
+    if (!error && cached_time < source_time)
+        return false;
+
+    std::ifstream input(path, std::ios::binary);
+
+    char magic[4];
+    std::uint32_t version, flags[3], count;
+    mip_settings stored;
+    input.read(magic, sizeof(magic));
+    input.read(reinterpret_cast<char *>(&version), sizeof(version));
+    input.read(reinterpret_cast<char *>(flags), sizeof(flags));
+    input.read(reinterpret_cast<char *>(&stored.coverage_cutoff), sizeof(stored.coverage_cutoff));
+    input.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!input || std::memcmp(magic, mips_magic, sizeof(magic)) != 0 || version != mips_version || count == 0 || count > 32)
+        return false;
+
+    stored.filter = (mip_filter)flags[0];
+    stored.srgb = flags[1] != 0;
+    stored.coverage_in_color = flags[2] != 0;
+    if (!(stored == settings))
+        return false;
+
+    std::vector<mip_level> result(count);
+    for (auto & level : result)
+    {
+        input.read(reinterpret_cast<char *>(&level.width), sizeof(level.width));
+        input.read(reinterpret_cast<char *>(&level.height), sizeof(level.height));
+        if (!input || level.width <= 0 || level.height <= 0 || level.width > 16384 || level.height > 16384)
+            return false;
+
+        level.data.resize(4 * (std::size_t)level.width * level.height);
+        input.read(reinterpret_cast<char *>(level.data.data()), level.data.size());
+        if (!input)
+            return false;
+    }
+
+    levels = std::move(result);
+    return true;
+}
@@ -14,7 +14,9 @@
 #include <vector>
 #include <map>
 #include <cmath>
+#include <cstring>
 #include <random>
+#include <fstream>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -28,6 +30,8 @@
 #include "obj_parser.hpp"
 #include "stb_image.h"
 #include "gltf_loader.hpp"
+#include "ring_buffer.hpp"
+#include "profiler.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -891,19 +895,16 @@ int main() try
 
     std::vector<particle> particles;
 
-    GLuint particle_vao, particle_vbo;
+    // every frame the particles go into a fresh piece of the ring, the attributes are pointed at it before the draw
+    ring_buffer::ring_buffer_t particle_ring("particles", 1024 * sizeof(particle));
+
+    GLuint particle_vao;
     glGenVertexArrays(1, &particle_vao);
     glBindVertexArray(particle_vao);
 
-    glGenBuffers(1, &particle_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, particle_vbo);
-
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, position));
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, size));
     glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, rotation_angle));
 
     const std::string particle_texture_path = project_root + "/textures/particle.png";
     int tex_width, tex_height, col_ch_cnt;
@@ -934,6 +935,8 @@ int main() try
     float interp_param = 0.f;
     bool paused = false;
 
+    profiler::profiler_t frame_profiler;
+
     bool running = true;
     while (running)
     {
@@ -955,6 +958,11 @@ int main() try
             button_down[event.key.keysym.sym] = true;
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_t)
+            {
+                std::ofstream trace("trace.json");
+                frame_profiler.write_chrome_trace(trace);
+            }
             break;
         case SDL_KEYUP:
             button_down[event.key.keysym.sym] = false;
@@ -964,6 +972,8 @@ int main() try
         if (!running)
             break;
 
+        frame_profiler.begin_frame();
+
         auto now = std::chrono::high_resolution_clock::now();
         float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
         last_frame_start = now;
@@ -1012,6 +1022,7 @@ int main() try
 
         // ========================================================================================================
 
+        frame_profiler.push("sphere");
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
@@ -1032,8 +1043,11 @@ int main() try
         glBindVertexArray(sphere_vao);
         glDrawElements(GL_TRIANGLES, sphere_index_count, GL_UNSIGNED_INT, nullptr);
 
+        frame_profiler.pop();
+
         // ========================================================================================================
 
+        frame_profiler.push("mist");
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_CULL_FACE);
         glCullFace(GL_FRONT);
@@ -1051,8 +1065,11 @@ int main() try
         glBindVertexArray(mist_vao);
         //glDrawElements(GL_TRIANGLES, std::size(cube_indices), GL_UNSIGNED_INT, nullptr);
 
+        frame_profiler.pop();
+
         // ========================================================================================================
 
+        frame_profiler.push("static model");
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
@@ -1114,8 +1131,11 @@ int main() try
         draw_statmodel_meshes(true);
         glDepthMask(GL_TRUE);
 
+        frame_profiler.pop();
+
         // ========================================================================================================
 
+        frame_profiler.push("animated model");
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
@@ -1220,8 +1240,11 @@ int main() try
         draw_animodel_meshes(true);
         glDepthMask(GL_TRUE);
 
+        frame_profiler.pop();
+
         // ========================================================================================================
 
+        frame_profiler.push("particles");
         glDisable(GL_DEPTH_TEST);
         glDisable(GL_CULL_FACE);
         glEnable(GL_BLEND);
@@ -1248,8 +1271,12 @@ int main() try
             }
         }
 
-        glBindBuffer(GL_ARRAY_BUFFER, particle_vbo);
-        glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(particle), particles.data(), GL_STATIC_DRAW);
+        particle_ring.next_frame();
+        ring_buffer::allocation_t particle_data = particle_ring.allocate(particles.size() * sizeof(particle), sizeof(particle));
+        if (!particles.empty()) {
+            std::memcpy(particle_data.data, particles.data(), particle_data.size);
+        }
+        particle_ring.commit(particle_data);
 
         glUseProgram(particle_program);
 
@@ -1262,11 +1289,18 @@ int main() try
         glBindTexture(GL_TEXTURE_2D, particle_texture);
 
         glBindVertexArray(particle_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, particle_data.buffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)(particle_data.offset + offsetof(particle, position)));
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)(particle_data.offset + offsetof(particle, size)));
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)(particle_data.offset + offsetof(particle, rotation_angle)));
         glDrawArrays(GL_POINTS, 0, particles.size());
 
+        frame_profiler.pop();
+
         // ========================================================================================================
 
         SDL_GL_SwapWindow(window);
+        frame_profiler.end_frame();
     }
 
     SDL_GL_DeleteContext(gl_context);
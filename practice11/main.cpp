@@ -15,6 +15,8 @@
 #include <random>
 #include <map>
 #include <cmath>
+#include <cstring>
+#include <fstream>
 
 #include <random>
 
@@ -30,6 +32,8 @@
 
 #include "obj_parser.hpp"
 #include "stb_image.h"
+#include "ring_buffer.hpp"
+#include "profiler.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -252,19 +256,16 @@ int main() try
 
     std::vector<particle> particles;
 
-    GLuint vao, vbo;
+    // every frame the particles go into a fresh piece of the ring, the attributes are pointed at it before the draw
+    ring_buffer::ring_buffer_t particle_ring("particles", 256 * sizeof(particle));
+
+    GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, position));
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, size));
     glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, rotation_angle));
 
     const std::string project_root = PROJECT_ROOT;
     const std::string particle_texture_path = project_root + "/particle.png";
@@ -313,6 +314,8 @@ int main() try
 
     bool paused = false;
 
+    profiler::profiler_t frame_profiler;
+
     bool running = true;
     while (running)
     {
@@ -334,6 +337,11 @@ int main() try
             button_down[event.key.keysym.sym] = true;
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_t)
+            {
+                std::ofstream trace("trace.json");
+                frame_profiler.write_chrome_trace(trace);
+            }
             break;
         case SDL_KEYUP:
             button_down[event.key.keysym.sym] = false;
@@ -343,6 +351,8 @@ int main() try
         if (!running)
             break;
 
+        frame_profiler.begin_frame();
+
         auto now = std::chrono::high_resolution_clock::now();
         float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
         last_frame_start = now;
@@ -378,6 +388,7 @@ int main() try
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
+        frame_profiler.push("simulate");
         float A = 0.1, C = 0.1;
         if (!paused) {
             if (particles.size() < 256) {
@@ -397,9 +408,15 @@ int main() try
             }
         }
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(particle), particles.data(), GL_STATIC_DRAW);
+        particle_ring.next_frame();
+        ring_buffer::allocation_t particle_data = particle_ring.allocate(particles.size() * sizeof(particle), sizeof(particle));
+        if (!particles.empty()) {
+            std::memcpy(particle_data.data, particles.data(), particle_data.size);
+        }
+        particle_ring.commit(particle_data);
+        frame_profiler.pop();
 
+        frame_profiler.push("draw");
         glUseProgram(program);
 
         glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
@@ -409,9 +426,15 @@ int main() try
         glUniform1i(palette_location, 1);
 
         glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, particle_data.buffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)(particle_data.offset + offsetof(particle, position)));
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)(particle_data.offset + offsetof(particle, size)));
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)(particle_data.offset + offsetof(particle, rotation_angle)));
         glDrawArrays(GL_POINTS, 0, particles.size());
+        frame_profiler.pop();
 
         SDL_GL_SwapWindow(window);
+        frame_profiler.end_frame();
     }
 
     SDL_GL_DeleteContext(gl_context);
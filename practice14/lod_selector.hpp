@@ -0,0 +1,152 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+namespace lod_selector {
+
+struct lod_t {
+    // largest deviation from the full-detail mesh, in world units
+    float geometric_error;
+    std::size_t triangles;
+};
+
+// Without simplification metadata the error of a LOD is estimated from its triangle density:
+// a surface of size `size` covered by n triangles has an edge length of about size / sqrt(n),
+// and a LOD deviates from the finest one by roughly the difference of their edge lengths.
+inline std::vector <lod_t> estimate_lods(const std::vector <std::size_t> &triangles, float size) {
+    std::vector <lod_t> result;
+    for (std::size_t triangles_cnt : triangles) {
+        float edge = size / std::sqrt((float)std::max<std::size_t>(triangles_cnt, 1));
+        float finest_edge = size / std::sqrt((float)std::max<std::size_t>(triangles.front(), 1));
+        result.push_back({std::max(0.f, edge - finest_edge), triangles_cnt});
+    }
+    return result;
+}
+
+// Picks the coarsest LOD whose projected error stays under `pixel_error` pixels. A LOD switch
+// happens only after the error leaves the band [1 - hysteresis, 1 + hysteresis] around the
+// threshold, so instances close to a transition distance don't flip every frame.
+struct lod_selector_t {
+    float pixel_error = 1.f;
+    float hysteresis = .2f;
+
+    // 0 means no budget, otherwise the threshold is scaled up until the selected LODs fit; the
+    // scale stops growing at max_budget_scale when even the coarsest LODs don't fit
+    std::size_t triangle_budget = 0;
+    float budget_scale = 1.f;
+    float max_budget_scale = 64.f;
+
+    // what end_frame() was last given
+    std::size_t frame_triangles = 0;
+
+    // Optional billboard past the last LOD (index lods.size()). It takes over at impostor_lod_factor
+    // times the distance from which the coarsest mesh LOD is selected, so that every mesh LOD keeps a
+    // range of its own, and never while the model covers more than impostor_pixels pixels: an
+    // impostor of that resolution would be magnified nearer.
+    float impostor_size = 0.f;
+    int impostor_pixels = 0;
+    float impostor_lod_factor = 2.f;
+
+    std::vector <lod_t> lods;
+    std::vector <std::int8_t> previous;
+
+    lod_selector_t() = default;
+
+    lod_selector_t(std::vector <lod_t> lods, std::size_t instances_cnt) : lods(std::move(lods)), previous(instances_cnt, -1) {
+    }
+
+    void update_size(int width, int height) {
+        (void)width;
+        viewport_height = height;
+    }
+
+    // pixels covered by one world unit of error at distance 1
+    void begin_frame(const glm::mat4 &projection) {
+        pixels_per_unit = projection[1][1] * viewport_height * .5f;
+    }
+
+    bool has_impostor() const {
+        return impostor_size > 0.f && impostor_pixels > 0;
+    }
+
+    // crossover to the impostor at the error threshold `threshold`, see impostor_size
+    float impostor_distance(float threshold) const {
+        float coarsest_lod_distance = lods.back().geometric_error * pixels_per_unit / threshold;
+        return std::max(impostor_lod_factor * coarsest_lod_distance, impostor_size * pixels_per_unit / impostor_pixels);
+    }
+
+    float screen_space_error(std::size_t lod, float distance) const {
+        return lods[lod].geometric_error * pixels_per_unit / std::max(distance, 1e-4f);
+    }
+
+    int coarsest_lod(float distance, float threshold) const {
+        int lod = 0;
+        while (lod + 1 < (int)lods.size() && screen_space_error(lod + 1, distance) <= threshold) {
+            lod++;
+        }
+        return lod;
+    }
+
+    // Safe to call concurrently for different instances.
+    int select(std::size_t index, float distance) {
+        float threshold = pixel_error * budget_scale;
+
+        int lod;
+        if (has_impostor()) {
+            float crossover = impostor_distance(threshold);
+            bool was_impostor = previous[index] == (int)lods.size();
+            if (distance > crossover * (1.f + hysteresis) || (was_impostor && distance > crossover * (1.f - hysteresis))) {
+                previous[index] = lods.size();
+                return lods.size();
+            }
+        }
+
+        if (previous[index] < 0) {
+            lod = coarsest_lod(distance, threshold);
+        } else {
+            int strict = coarsest_lod(distance, threshold * (1.f - hysteresis));
+            int lenient = coarsest_lod(distance, threshold * (1.f + hysteresis));
+            lod = std::clamp((int)previous[index], strict, lenient);
+        }
+
+        previous[index] = lod;
+        return lod;
+    }
+
+    void reset(std::size_t index) {
+        previous[index] = -1;
+    }
+
+    // Feeds back the number of triangles drawn this frame into the error threshold of the next one.
+    void end_frame(std::size_t triangles) {
+        frame_triangles = triangles;
+        if (triangle_budget == 0) {
+            budget_scale = 1.f;
+            return;
+        }
+
+        if (triangles > triangle_budget) {
+            budget_scale = std::min(max_budget_scale, budget_scale * 1.1f);
+        } else if (triangles < triangle_budget * 9 / 10) {
+            budget_scale = std::max(1.f, budget_scale / 1.05f);
+        }
+    }
+
+    std::size_t triangles(std::size_t lod, std::size_t instances_cnt) const {
+        if (lod == lods.size()) {
+            return 2 * instances_cnt;
+        }
+        return lods[lod].triangles * instances_cnt;
+    }
+
+private:
+    int viewport_height = 600;
+    float pixels_per_unit = 1.f;
+};
+
+}
@@ -16,7 +16,6 @@
 #include <random>
 #include <map>
 #include <cmath>
-#include <queue>
 
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
@@ -31,6 +30,9 @@
 #include "aabb.hpp"
 #include "frustum.hpp"
 #include "intersect.hpp"
+#include "thread_pool.hpp"
+#include "lod_selector.hpp"
+#include "profiler.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -192,10 +194,28 @@ int main() try
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, input_model.buffer.size(), input_model.buffer.data(), GL_STATIC_DRAW);
 
-    std::vector <std::vector <glm::vec3>> translations(input_model.meshes.size(), std::vector <glm::vec3> ());
-    for (auto &tr : translations) {
-        tr.reserve(1024);
+    thread_pool::thread_pool_t workers;
+
+    // visible instances of every LOD are packed one LOD after another into translations_vbo
+    const int field_size = 16;
+    const std::size_t instances_cnt = (2 * field_size) * (2 * field_size);
+    const std::size_t cull_chunk_size = 64;
+
+    std::vector <int> instance_lods(instances_cnt, -1);
+    std::vector <std::size_t> chunk_offsets;
+    std::vector <std::pair <std::size_t, std::size_t>> lod_ranges(input_model.meshes.size());
+
+    std::vector <std::size_t> lod_triangles;
+    for (auto const &mesh : input_model.meshes) {
+        lod_triangles.push_back(mesh.indices.count / 3);
     }
+    float model_size = glm::length(input_model.meshes[0].max - input_model.meshes[0].min);
+    lod_selector::lod_selector_t lod_selection(lod_selector::estimate_lods(lod_triangles, model_size), instances_cnt);
+    lod_selection.update_size(width, height);
+
+    // B cycles the triangle budget through these, 0 is none
+    std::vector <std::size_t> triangle_budgets = {0, 4000000, 1000000};
+    std::size_t triangle_budget_index = 0;
 
     GLuint translations_vbo;
     glGenBuffers(1, &translations_vbo);
@@ -257,8 +277,7 @@ int main() try
     glm::vec3 camera_position{0.f, 1.5f, 3.f};
     float camera_rotation = 0.f;
 
-    std::queue <GLuint> idle_q;
-    std::vector <GLuint> occup_q;
+    profiler::profiler_t frame_profiler;
 
     bool paused = false;
 
@@ -276,6 +295,7 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                lod_selection.update_size(width, height);
                 break;
             }
             break;
@@ -283,6 +303,16 @@ int main() try
             button_down[event.key.keysym.sym] = true;
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_b)
+            {
+                triangle_budget_index = (triangle_budget_index + 1) % triangle_budgets.size();
+                lod_selection.triangle_budget = triangle_budgets[triangle_budget_index];
+            }
+            if (event.key.keysym.sym == SDLK_t)
+            {
+                std::ofstream trace("trace.json");
+                frame_profiler.write_chrome_trace(trace);
+            }
             break;
         case SDL_KEYUP:
             button_down[event.key.keysym.sym] = false;
@@ -324,16 +354,7 @@ int main() try
         camera_position += camera_move_forward * glm::vec3(-std::sin(camera_rotation), 0.f, std::cos(camera_rotation));
         camera_position += camera_move_sideways * glm::vec3(std::cos(camera_rotation), 0.f, std::sin(camera_rotation));
 
-        GLuint cur_q;
-        if (idle_q.size()) {
-            cur_q = idle_q.front();
-            idle_q.pop();
-        } else {
-            glGenQueries(1, &cur_q);
-        }
-        occup_q.push_back(cur_q);
-
-        glBeginQuery(GL_TIME_ELAPSED, cur_q);
+        frame_profiler.begin_frame();
 
         glClearColor(0.8f, 0.8f, 1.f, 0.f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -367,64 +388,104 @@ int main() try
 
         frustum fr(projection * view);
 
-        for (int i = -16; i < 16; i++) {
-            for (int j = -16; j < 16; j++) {
-                glm::vec3 offset(i, 0.f, j);
+        auto instance_offset = [&](std::size_t index) {
+            return glm::vec3((int)(index / (2 * field_size)) - field_size, 0.f, (int)(index % (2 * field_size)) - field_size);
+        };
+
+        frame_profiler.push("cull");
+
+        lod_selection.begin_frame(projection);
+
+        std::size_t lods_cnt = input_model.meshes.size();
+        std::size_t chunks_cnt = workers.chunks_cnt(instances_cnt, cull_chunk_size);
+        chunk_offsets.assign(chunks_cnt * lods_cnt, 0);
+
+        workers.parallel_for(instances_cnt, cull_chunk_size, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+            for (std::size_t index = begin; index < end; index++) {
+                glm::vec3 offset = instance_offset(index);
                 float dist = glm::length(camera_position - offset);
-                int lod = floor(std::min(dist / 4, (float)input_model.meshes.size() - 1));
+                int lod = lod_selection.select(index, dist);
 
                 aabb ab(input_model.meshes[lod].min + offset, input_model.meshes[lod].max + offset);
 
+                instance_lods[index] = -1;
                 if (intersect(fr, ab)) {
-                    translations[lod].push_back(offset);
+                    instance_lods[index] = lod;
+                    chunk_offsets[chunk * lods_cnt + lod]++;
                 }
             }
+        });
+
+        std::size_t total = 0;
+        for (std::size_t lod = 0; lod < lods_cnt; lod++) {
+            lod_ranges[lod].first = total;
+            for (std::size_t chunk = 0; chunk < chunks_cnt; chunk++) {
+                std::size_t cnt = chunk_offsets[chunk * lods_cnt + lod];
+                chunk_offsets[chunk * lods_cnt + lod] = total;
+                total += cnt;
+            }
+            lod_ranges[lod].second = total - lod_ranges[lod].first;
         }
 
-        for (int i = 0; i < input_model.meshes.size(); i++) {
-            glBindBuffer(GL_ARRAY_BUFFER, translations_vbo);
-            glBufferData(GL_ARRAY_BUFFER, translations[i].size() * sizeof(glm::vec3), translations[i].data(), GL_STATIC_DRAW);
-
-            auto const &mesh = input_model.meshes[i];
-            glBindVertexArray(vaos[i]);
-            glDrawElementsInstanced(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.view.offset), translations[i].size());
+        std::size_t triangles = 0;
+        for (std::size_t lod = 0; lod < lods_cnt; lod++) {
+            triangles += lod_selection.triangles(lod, lod_ranges[lod].second);
         }
+        lod_selection.end_frame(triangles);
 
-        glEndQuery(GL_TIME_ELAPSED);
+        frame_profiler.pop();
+        frame_profiler.push("upload");
 
-        SDL_GL_SwapWindow(window);
+        glBindBuffer(GL_ARRAY_BUFFER, translations_vbo);
+        if (total > 0) {
+            glBufferData(GL_ARRAY_BUFFER, total * sizeof(glm::vec3), nullptr, GL_STREAM_DRAW);
+            auto *mapped = static_cast<glm::vec3 *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, total * sizeof(glm::vec3), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+
+            workers.parallel_for(instances_cnt, cull_chunk_size, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+                std::size_t *offsets = &chunk_offsets[chunk * lods_cnt];
+                for (std::size_t index = begin; index < end; index++) {
+                    if (instance_lods[index] >= 0) {
+                        mapped[offsets[instance_lods[index]]++] = instance_offset(index);
+                    }
+                }
+            });
 
-        int cnt = 0;
-        for (int i = 0; i + 1 < input_model.meshes.size(); i++) {
-            std::cerr << translations[i].size() << " + ";
-            cnt += translations[i].size();
+            glUnmapBuffer(GL_ARRAY_BUFFER);
         }
-        std::cerr << translations.back().size() << " = ";
-        cnt += translations.back().size();
 
-        std::cerr << cnt << std::endl;
+        frame_profiler.pop();
+        frame_profiler.push("draw");
+
+        for (int i = 0; i < input_model.meshes.size(); i++) {
+            if (lod_ranges[i].second == 0) {
+                continue;
+            }
 
-        for (auto &tr : translations) {
-            tr.clear();
+            auto const &mesh = input_model.meshes[i];
+            glBindVertexArray(vaos[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, translations_vbo);
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), reinterpret_cast<void *>(lod_ranges[i].first * sizeof(glm::vec3)));
+            glDrawElementsInstanced(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.view.offset), lod_ranges[i].second);
         }
 
-        for (int i = 0; i < occup_q.size(); i++) {
-            GLuint id = occup_q[i];
+        frame_profiler.pop();
 
-            GLint result;
-            glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &result);
-            if (result) {
-                int32_t t_elapsed;
-                glGetQueryObjectiv(id, GL_QUERY_RESULT, &t_elapsed);
+        SDL_GL_SwapWindow(window);
 
-                std::cerr << std::fixed << std::setprecision(6) << (float)t_elapsed / 1e9 << std::endl;
+        frame_profiler.end_frame();
 
-                idle_q.push(id);
-                std::swap(occup_q[i], occup_q.back());
-                occup_q.pop_back();
-                i--;
-            }
+        int cnt = 0;
+        for (int i = 0; i + 1 < input_model.meshes.size(); i++) {
+            std::cerr << lod_ranges[i].second << " + ";
+            cnt += lod_ranges[i].second;
         }
+        std::cerr << lod_ranges.back().second << " = ";
+        cnt += lod_ranges.back().second;
+
+        std::cerr << cnt << ", " << lod_selection.frame_triangles << " triangles";
+        if (lod_selection.triangle_budget > 0)
+            std::cerr << " (budget " << lod_selection.triangle_budget << ", error scale " << lod_selection.budget_scale << ")";
+        std::cerr << std::endl;
     }
 
     SDL_GL_DeleteContext(gl_context);
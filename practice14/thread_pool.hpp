@@ -0,0 +1,144 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+namespace thread_pool {
+
+// Fixed set of workers that execute data-parallel loops together with the calling thread.
+//
+// The pool runs one loop at a time: parallel_for must not be called from two threads at once, nor
+// from inside a loop body. Threads that need loops of their own concurrently need a pool of their
+// own.
+struct thread_pool_t {
+    thread_pool_t(std::size_t threads_cnt = std::max(1u, std::thread::hardware_concurrency())) {
+        for (std::size_t i = 1; i < threads_cnt; i++) {
+            workers.emplace_back([this]() { worker_loop(); });
+        }
+    }
+
+    thread_pool_t(const thread_pool_t &) = delete;
+    thread_pool_t &operator=(const thread_pool_t &) = delete;
+
+    ~thread_pool_t() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        job_cv.notify_all();
+
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    // number of threads taking part in a loop, including the caller
+    std::size_t size() const {
+        return workers.size() + 1;
+    }
+
+    std::size_t chunks_cnt(std::size_t count, std::size_t chunk_size) const {
+        return (count + chunk_size - 1) / chunk_size;
+    }
+
+    // Calls f(chunk, begin, end) for every chunk of [0, count) and returns when all of them are done.
+    // Chunks are handed out dynamically, so f must not depend on which thread runs it.
+    template <typename F>
+    void parallel_for(std::size_t count, std::size_t chunk_size, F &&f) {
+        std::size_t total = chunks_cnt(count, chunk_size);
+        if (total == 0) {
+            return;
+        }
+
+        if (total == 1 || workers.empty()) {
+            for (std::size_t chunk = 0; chunk < total; chunk++) {
+                f(chunk, chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size));
+            }
+            return;
+        }
+
+        job_t job;
+        job.run = [&](std::size_t chunk) {
+            f(chunk, chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size));
+        };
+        job.total = total;
+
+        {
+            std::lock_guard lock(mutex);
+            assert(current == nullptr && "parallel_for called while another loop is running");
+            current = &job;
+            generation++;
+        }
+        job_cv.notify_all();
+
+        std::size_t finished = run_chunks(job);
+
+        // workers that picked up the job must leave it before it goes out of scope
+        std::unique_lock lock(mutex);
+        job.done += finished;
+        done_cv.wait(lock, [&]() { return job.done == job.total && active_workers == 0; });
+        current = nullptr;
+    }
+
+private:
+    std::vector <std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable job_cv, done_cv;
+
+    struct job_t {
+        std::function <void(std::size_t)> run;
+        std::size_t total = 0;
+        std::atomic <std::size_t> next{0};
+        std::size_t done = 0;
+    };
+
+    job_t *current = nullptr;
+    std::size_t active_workers = 0;
+    std::uint64_t generation = 0;
+    bool stopping = false;
+
+    static std::size_t run_chunks(job_t &job) {
+        std::size_t finished = 0;
+        for (std::size_t chunk; (chunk = job.next.fetch_add(1)) < job.total;) {
+            job.run(chunk);
+            finished++;
+        }
+        return finished;
+    }
+
+    void worker_loop() {
+        std::uint64_t seen_generation = 0;
+
+        while (true) {
+            job_t *job;
+            {
+                std::unique_lock lock(mutex);
+                job_cv.wait(lock, [&]() { return stopping || (current && generation != seen_generation); });
+                if (stopping) {
+                    return;
+                }
+                seen_generation = generation;
+                job = current;
+                active_workers++;
+            }
+
+            std::size_t finished = run_chunks(*job);
+
+            std::lock_guard lock(mutex);
+            job->done += finished;
+            active_workers--;
+            if (job->done == job->total && active_workers == 0) {
+                done_cv.notify_all();
+            }
+        }
+    }
+};
+
+}
@@ -0,0 +1,619 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <map>
+#include <list>
+#include <deque>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+
+#include <glm/mat4x4.hpp>
+
+#include "common_util.hpp"
+#include "thread_pool.hpp"
+
+namespace asset_cache {
+
+// the same file under another spelling of its path is the same texture, other params make another one
+struct texture_key_t {
+    std::string path;
+    texture_params_t params;
+
+    auto operator<=>(const texture_key_t &) const = default;
+};
+
+inline texture_key_t make_key(const std::string &path, const texture_params_t &params) {
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return {error ? path : canonical.string(), params};
+}
+
+struct stats_t {
+    std::uint64_t hits = 0, misses = 0, evictions = 0;
+    std::size_t evicted_bytes = 0;
+
+    // background loads: time on the loader threads, and on the GL thread in pump() in total and
+    // in its longest frame
+    std::uint64_t uploads = 0;
+    double decode_ms = 0.0, upload_ms = 0.0, max_frame_upload_ms = 0.0;
+
+    // full chains of the textures loaded, as stored and as they would be in RGBA8
+    std::size_t loaded_bytes = 0, loaded_rgba8_bytes = 0;
+
+    // mip streaming, in levels and bytes
+    std::uint64_t streamed_in = 0, dropped = 0;
+    std::size_t streamed_in_bytes = 0, dropped_bytes = 0;
+
+    void reset() {
+        *this = stats_t();
+    }
+};
+
+struct texture_cache_t;
+
+struct entry_t {
+    texture_key_t key;
+    GLuint texture = 0;
+    std::size_t bytes = 0;
+
+    // a placeholder until a loader has decoded the file and pump() has uploaded it
+    bool loading = false;
+
+    // Mip residency, see texture_cache_t::stream(). Textures entities never request() stay fully
+    // resident. The decoded levels are kept to stream them back in: views into the models pack from
+    // the load on, copies in system memory only once the texture is requested, decoded again by a
+    // loader then. The entry is managed as soon as its source is back.
+    decoded_texture_t source;
+    bool managed = false;
+    bool decoding_source = false;
+    std::size_t full_bytes = 0;
+    int base_level = 0;
+
+    // finest level requested this frame, -1 for none; finest kept, and frames it's been kept for
+    // since a request needed it
+    int wanted_level = -1;
+    int held_level = 0;
+    int held_frames = 0;
+
+    // handles alive, the entry is evictable at zero
+    int refs = 0;
+    bool unused = false;
+    std::list <entry_t *>::iterator unused_position;
+};
+
+// Shared ownership of a cached texture, like shared_ptr. Dropping the last handle doesn't free the
+// texture, it only lets the cache evict it.
+struct texture_handle_t {
+    texture_handle_t() = default;
+
+    texture_handle_t(texture_cache_t *cache, entry_t *entry) : cache(cache), entry(entry) {
+        acquire();
+    }
+
+    texture_handle_t(const texture_handle_t &other) : cache(other.cache), entry(other.entry) {
+        acquire();
+    }
+
+    texture_handle_t(texture_handle_t &&other) noexcept : cache(other.cache), entry(other.entry) {
+        other.cache = nullptr;
+        other.entry = nullptr;
+    }
+
+    texture_handle_t &operator=(texture_handle_t other) noexcept {
+        std::swap(cache, other.cache);
+        std::swap(entry, other.entry);
+        return *this;
+    }
+
+    ~texture_handle_t() {
+        release();
+    }
+
+    GLuint get() const {
+        return entry ? entry->texture : 0;
+    }
+
+    explicit operator bool() const {
+        return entry != nullptr;
+    }
+
+private:
+    friend struct texture_cache_t;
+
+    texture_cache_t *cache = nullptr;
+    entry_t *entry = nullptr;
+
+    void acquire();
+    void release();
+};
+
+// Textures by file, shared between all entities: each file is decoded and uploaded once however
+// many entities use it. Textures nobody holds a handle to stay resident for the next user until
+// the cache goes over budget, then the least recently released are deleted first; textures in use
+// are never deleted, even over budget.
+//
+// Files are read and decoded on loader threads of the cache. texture() returns at once with a 1x1
+// placeholder and pump(), called once a frame, uploads what the loaders have finished into the same
+// texture names, so entities pick the real textures up without noticing.
+//
+// GL thread only. Nothing is deleted when a handle is dropped, only on the next load or trim(), so
+// handles may outlive the GL context.
+struct texture_cache_t {
+    std::size_t budget = std::size_t(256) << 20;
+    stats_t stats;
+
+    // off loads every texture inside texture(), as before there were loaders
+    bool async = true;
+    std::size_t loaders_cnt = 2;
+
+    // GL thread time pump() may spend uploading per frame; a texture is never split, so one that's
+    // over the budget on its own still goes up in a frame of its own
+    double upload_budget_ms = 2.0;
+
+    // Mip streaming: every texture entities request() keeps its levels down to the finest one it was
+    // requested at in the last keep_frames frames, all of them together within residency_budget
+    // (with the textures that aren't requested) by dropping the same number of further levels from
+    // each. Finer levels come back through GL_TEXTURE_BASE_LEVEL as soon as they are needed. A
+    // texture is streamed from the frame after its first request on, or a few later if its levels
+    // have to be decoded again, see entry_t::source.
+    bool streaming = true;
+    std::size_t residency_budget = std::size_t(64) << 20;
+    int keep_frames = 120;
+
+    // levels every requested texture lost to the budget last frame, and how many there were
+    int residency_bias = 0;
+    std::size_t managed_cnt = 0, managed_bytes = 0, managed_full_bytes = 0;
+
+    // generates mip chains of uncached textures on these threads when loading synchronously; the
+    // GL thread's loops own the pool (see thread_pool_t), so loaders decode on their own
+    thread_pool::thread_pool_t *pool = nullptr;
+
+    texture_cache_t() = default;
+
+    texture_cache_t(const texture_cache_t &) = delete;
+    texture_cache_t &operator=(const texture_cache_t &) = delete;
+
+    ~texture_cache_t() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        request_cv.notify_all();
+        for (auto &loader : loaders) {
+            loader.join();
+        }
+    }
+
+    texture_handle_t texture(const std::string &path, const texture_params_t &params = {}) {
+        texture_key_t key = make_key(path, params);
+
+        if (auto it = entries.find(key); it != entries.end()) {
+            stats.hits++;
+            return texture_handle_t(this, &it->second);
+        }
+
+        stats.misses++;
+        entry_t &entry = entries[key];
+        entry.key = key;
+        if (async) {
+            entry.texture = placeholder_texture(path, params);
+            entry.loading = true;
+            pending++;
+            start_loaders();
+            {
+                std::lock_guard lock(mutex);
+                requests.push_back({&entry, path, params});
+            }
+            request_cv.notify_one();
+        } else {
+            decoded_texture_t decoded = decode_texture(path, params, pool);
+            entry.texture = create_texture(params);
+            upload_texture(decoded);
+            loaded(entry, std::move(decoded));
+        }
+
+        // the new texture is already held by the handle below
+        texture_handle_t result(this, &entry);
+        trim();
+        return result;
+    }
+
+    // Uploads textures the loaders have finished, oldest request first, then streams mips in and
+    // out, until upload_budget_ms is spent. Call once a frame on the GL thread, after the draws of
+    // the previous frame have made their requests.
+    void pump() {
+        auto start = std::chrono::steady_clock::now();
+        upload_ready(upload_budget_ms);
+        if (streaming) {
+            stream(upload_budget_ms - std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    void update_size(int width, int height) {
+        (void)width;
+        viewport_height = height;
+    }
+
+    // pixels across the screen covered by `size` world units at `distance`
+    float projected_pixels(const glm::mat4 &projection, float size, float distance) const {
+        return size * projection[1][1] * viewport_height * .5f / std::max(distance, 1e-4f);
+    }
+
+    // The texture is drawn this frame stretched over `pixels` pixels at most (across its level 0
+    // width), so it needs no level finer than the one about that wide. GL thread.
+    void request(const texture_handle_t &texture, float pixels) {
+        entry_t *entry = texture.entry;
+        if (!streaming || !entry || entry->loading || entry->decoding_source) {
+            return;
+        }
+        if (entry->source.levels_cnt() == 0) {
+            decode_source(*entry);
+            return;
+        }
+        entry->managed = true;
+
+        int coarsest = (int)entry->source.levels_cnt() - 1;
+        float width = (float)std::max(entry->source.width(0), entry->source.height(0));
+        int level = pixels >= 1.f ? (int)std::floor(std::log2(std::max(1.f, width / pixels))) : coarsest;
+        level = std::clamp(level, 0, coarsest);
+        entry->wanted_level = entry->wanted_level < 0 ? level : std::min(entry->wanted_level, level);
+    }
+
+    // blocks until every requested texture is uploaded
+    void finish() {
+        while (pending > 0) {
+            {
+                std::unique_lock lock(mutex);
+                ready_cv.wait(lock, [&]() { return !ready.empty(); });
+            }
+            upload_ready(-1.0);
+        }
+    }
+
+    // textures still showing their placeholder
+    std::size_t loading() const {
+        return pending;
+    }
+
+    // deletes unused textures, oldest first, until the cache fits its budget
+    void trim() {
+        for (auto it = unused.begin(); resident > budget && it != unused.end();) {
+            entry_t *entry = *it;
+
+            // a loader still holds on to it
+            if (entry->loading || entry->decoding_source) {
+                ++it;
+                continue;
+            }
+            it = unused.erase(it);
+
+            gl_state::cache().delete_texture(entry->texture);
+            resident -= entry->bytes;
+            stats.evictions++;
+            stats.evicted_bytes += entry->bytes;
+            texture_key_t key = entry->key;
+            entries.erase(key);
+        }
+    }
+
+    std::size_t resident_bytes() const {
+        return resident;
+    }
+
+    void report(std::ostream &out) const {
+        out << "textures: " << entries.size() << " resident (" << unused.size() << " unused), " \
+            << resident / (1024 * 1024) << " of " << budget / (1024 * 1024) << " MiB, " \
+            << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evicted" << std::endl;
+        if (stats.loaded_rgba8_bytes > 0) {
+            out << "texture formats: " << stats.loaded_bytes / 1024 << " KiB loaded, " \
+                << (stats.loaded_rgba8_bytes - stats.loaded_bytes) / 1024 << " KiB less than all RGBA8" << std::endl;
+        }
+        if (managed_cnt > 0) {
+            out << "texture residency: " << managed_cnt << " streamed, " << managed_bytes / (1024 * 1024) << " of " \
+                << managed_full_bytes / (1024 * 1024) << " MiB resident, budget " << residency_budget / (1024 * 1024) << " MiB for all, " \
+                << residency_bias << " levels dropped for it, " << stats.streamed_in << " levels (" << stats.streamed_in_bytes / (1024 * 1024) \
+                << " MiB) streamed in, " << stats.dropped << " (" << stats.dropped_bytes / (1024 * 1024) << " MiB) dropped" << std::endl;
+        }
+        std::size_t sources_cnt = 0, source_bytes = 0;
+        for (const auto &[key, entry] : entries) {
+            if (entry.source.levels_cnt() > 0) {
+                sources_cnt++;
+                source_bytes += entry.source.system_bytes();
+            }
+        }
+        if (sources_cnt > 0) {
+            out << "texture sources: " << sources_cnt << " kept to stream from, " << source_bytes / (1024 * 1024) << " MiB in system memory" << std::endl;
+        }
+        if (stats.uploads > 0 || pending > 0) {
+            out << "texture loads: " << stats.uploads << " uploaded, " << pending << " loading, decode " << stats.decode_ms << " ms, upload " \
+                << stats.upload_ms << " ms (at most " << stats.max_frame_upload_ms << " ms in a frame)" << std::endl;
+        }
+    }
+
+private:
+    friend struct texture_handle_t;
+
+    std::map <texture_key_t, entry_t> entries;
+    std::size_t resident = 0;
+
+    // entries without handles, least recently released first
+    std::list <entry_t *> unused;
+
+    // source_only: the entry is uploaded already, the decoded levels only become its source
+    struct request_t {
+        entry_t *entry;
+        std::string path;
+        texture_params_t params;
+        bool source_only = false;
+    };
+
+    struct decoded_t {
+        entry_t *entry;
+        decoded_texture_t texture;
+        double decode_ms;
+        bool source_only = false;
+    };
+
+    // requests go to the loaders and come back decoded, both under the mutex
+    std::vector <std::thread> loaders;
+    std::mutex mutex;
+    std::condition_variable request_cv, ready_cv;
+    std::deque <request_t> requests;
+    std::deque <decoded_t> ready;
+    bool stopping = false;
+
+    // GL thread side
+    std::size_t pending = 0;
+    GLuint pixel_buffer = 0;
+    int viewport_height = 1;
+
+    static GLuint create_texture(const texture_params_t &params) {
+        GLuint result;
+        glGenTextures(1, &result);
+        gl_state::cache().bind_texture(GL_TEXTURE_2D, result);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, params.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return result;
+    }
+
+    // 1x1 stand-in until the file is uploaded: a flat normal for normal maps, mid grey for the rest
+    static GLuint placeholder_texture(const std::string &path, const texture_params_t &params) {
+        bool normal = std::filesystem::path(path).filename().string().find("normal") != std::string::npos;
+        const std::uint8_t texel[4] = {128, 128, normal ? (std::uint8_t)255 : (std::uint8_t)128, 255};
+
+        GLuint result = create_texture(params);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        return result;
+    }
+
+    void start_loaders() {
+        while (loaders.size() < std::max <std::size_t>(1, loaders_cnt)) {
+            loaders.emplace_back([this]() { loader_loop(); });
+        }
+    }
+
+    void loader_loop() {
+        while (true) {
+            request_t request;
+            {
+                std::unique_lock lock(mutex);
+                request_cv.wait(lock, [&]() { return stopping || !requests.empty(); });
+                if (stopping) {
+                    return;
+                }
+                request = std::move(requests.front());
+                requests.pop_front();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            decoded_texture_t texture = decode_texture(request.path, request.params);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                std::lock_guard lock(mutex);
+                ready.push_back({request.entry, std::move(texture), ms, request.source_only});
+            }
+            ready_cv.notify_one();
+        }
+    }
+
+    // negative budget uploads everything that's ready
+    void upload_ready(double budget_ms) {
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed_ms = [&]() {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        int uploaded = 0;
+        for (; budget_ms < 0.0 || uploaded == 0 || elapsed_ms() < budget_ms; uploaded++) {
+            decoded_t decoded;
+            {
+                std::lock_guard lock(mutex);
+                if (ready.empty()) {
+                    break;
+                }
+                decoded = std::move(ready.front());
+                ready.pop_front();
+            }
+
+            if (!pixel_buffer) {
+                glGenBuffers(1, &pixel_buffer);
+            }
+
+            entry_t *entry = decoded.entry;
+            if (decoded.source_only) {
+                // the file changed since the upload, the texture stays as it is
+                if (decoded.texture.bytes() == entry->full_bytes) {
+                    entry->source = std::move(decoded.texture);
+                }
+                entry->decoding_source = false;
+                continue;
+            }
+
+            gl_state::cache().bind_texture(GL_TEXTURE_2D, entry->texture);
+            upload_texture(decoded.texture, pixel_buffer);
+            loaded(*entry, std::move(decoded.texture));
+            pending--;
+
+            stats.uploads++;
+            stats.decode_ms += decoded.decode_ms;
+        }
+
+        if (uploaded == 0) {
+            return;
+        }
+
+        double ms = elapsed_ms();
+        stats.upload_ms += ms;
+        stats.max_frame_upload_ms = std::max(stats.max_frame_upload_ms, ms);
+        trim();
+    }
+
+    // every level of the texture is uploaded
+    void loaded(entry_t &entry, decoded_texture_t texture) {
+        std::size_t rgba8 = texture.rgba8_bytes();
+        if (texture.levels_cnt() > 0 && texture.width(0) > 0) {
+            std::cerr << "texture " << entry.key.path << ": " << texture.format_name() << " " << texture.width(0) << "x" << texture.height(0) \
+                      << ", " << texture.bytes() / 1024 << " KiB, " << (rgba8 - texture.bytes()) / 1024 << " KiB less than RGBA8" << std::endl;
+        }
+        stats.loaded_bytes += texture.bytes();
+        stats.loaded_rgba8_bytes += rgba8;
+
+        entry.bytes = entry.full_bytes = texture.bytes();
+        entry.loading = false;
+        resident += entry.bytes;
+
+        // most textures are never requested, a copy is decoded again for those that are
+        if (streaming && texture.system_bytes() == 0) {
+            entry.source = std::move(texture);
+        }
+    }
+
+    // the levels of an uploaded texture again, for request() to manage it
+    void decode_source(entry_t &entry) {
+        entry.decoding_source = true;
+        start_loaders();
+        {
+            std::lock_guard lock(mutex);
+            requests.push_back({&entry, entry.key.path, entry.key.params, true});
+        }
+        request_cv.notify_one();
+    }
+
+    int target_level(const entry_t &entry, int bias) const {
+        return std::min((int)entry.source.levels_cnt() - 1, entry.held_level + bias);
+    }
+
+    // Drops levels at once and streams them in while `budget_ms` lasts, at least one texture a
+    // frame like uploads.
+    void stream(double budget_ms) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector <entry_t *> managed;
+        std::size_t fixed_bytes = 0;
+        for (auto &[key, entry] : entries) {
+            if (entry.loading || !entry.managed) {
+                fixed_bytes += entry.bytes;
+                continue;
+            }
+            managed.push_back(&entry);
+
+            // a coarser level only after keep_frames without a request for the finer one
+            int coarsest = (int)entry.source.levels_cnt() - 1;
+            int level = entry.wanted_level < 0 ? coarsest : entry.wanted_level;
+            entry.wanted_level = -1;
+            if (level <= entry.held_level || ++entry.held_frames > keep_frames) {
+                entry.held_level = level;
+                entry.held_frames = 0;
+            }
+        }
+
+        auto total_bytes = [&](int bias) {
+            std::size_t result = fixed_bytes;
+            for (const entry_t *entry : managed) {
+                result += entry->source.bytes(target_level(*entry, bias));
+            }
+            return result;
+        };
+        residency_bias = 0;
+        while (residency_bias < 16 && total_bytes(residency_bias) > residency_budget) {
+            residency_bias++;
+        }
+
+        bool streamed = false;
+        managed_cnt = managed.size();
+        managed_bytes = managed_full_bytes = 0;
+        for (entry_t *entry : managed) {
+            int target = target_level(*entry, residency_bias);
+            if (target > entry->base_level) {
+                gl_state::cache().bind_texture(GL_TEXTURE_2D, entry->texture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, target);
+                release_texture_levels(entry->source, target);
+                stats.dropped += target - entry->base_level;
+                stats.dropped_bytes += entry->bytes - entry->source.bytes(target);
+            } else if (target < entry->base_level && (!streamed || \
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() < budget_ms)) {
+                gl_state::cache().bind_texture(GL_TEXTURE_2D, entry->texture);
+                upload_texture(entry->source, pixel_buffer, target, entry->base_level);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, target);
+                stats.streamed_in += entry->base_level - target;
+                stats.streamed_in_bytes += entry->source.bytes(target) - entry->bytes;
+                streamed = true;
+            } else {
+                target = entry->base_level;
+            }
+
+            resident -= entry->bytes;
+            entry->base_level = target;
+            entry->bytes = entry->source.bytes(target);
+            resident += entry->bytes;
+
+            managed_bytes += entry->bytes;
+            managed_full_bytes += entry->source.bytes();
+        }
+    }
+
+    void acquire(entry_t *entry) {
+        if (entry->refs++ == 0 && entry->unused) {
+            unused.erase(entry->unused_position);
+            entry->unused = false;
+        }
+    }
+
+    void release(entry_t *entry) {
+        if (--entry->refs == 0) {
+            entry->unused_position = unused.insert(unused.end(), entry);
+            entry->unused = true;
+        }
+    }
+};
+
+inline void texture_handle_t::acquire() {
+    if (entry) {
+        cache->acquire(entry);
+    }
+}
+
+inline void texture_handle_t::release() {
+    if (entry) {
+        cache->release(entry);
+    }
+}
+
+// one GL context per process, so one cache
+inline texture_cache_t &cache() {
+    static texture_cache_t instance;
+    return instance;
+}
+
+}
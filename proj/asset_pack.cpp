@@ -0,0 +1,321 @@
+#include "asset_pack.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace asset_pack
+{
+
+namespace
+{
+
+char const pack_magic[4] = {'A', 'P', 'A', 'K'};
+
+struct file_header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t entries_count;
+    std::uint32_t reserved;
+    std::uint64_t table_offset;
+    std::uint64_t names_offset;
+};
+
+struct table_record
+{
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint64_t source_size;
+    std::int64_t source_time;
+    std::uint32_t kind;
+    std::uint32_t name_offset;
+    std::uint32_t name_size;
+    std::uint32_t reserved;
+};
+
+static_assert(sizeof(file_header) == 32 && sizeof(table_record) == 48);
+
+std::size_t align_up(std::size_t value)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+pack_file::~pack_file()
+{
+    close();
+}
+
+bool pack_file::open(std::filesystem::path const & path, std::filesystem::path const & root)
+{
+    close();
+
+#ifndef WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0)
+    {
+        void * address = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            begin = static_cast<std::byte const *>(address);
+            bytes = status.st_size;
+            mapped = true;
+        }
+    }
+    ::close(fd);
+#else
+    std::ifstream input(path, std::ios::binary);
+    if (input)
+    {
+        storage.resize(std::filesystem::file_size(path));
+        input.read(reinterpret_cast<char *>(storage.data()), storage.size());
+        if (input)
+        {
+            begin = storage.data();
+            bytes = storage.size();
+        }
+    }
+#endif
+
+    if (!begin)
+        return false;
+
+    file_header header;
+    if (bytes < sizeof(header))
+    {
+        close();
+        return false;
+    }
+    std::memcpy(&header, begin, sizeof(header));
+
+    std::uint64_t table_size = (std::uint64_t)header.entries_count * sizeof(table_record);
+    if (std::memcmp(header.magic, pack_magic, sizeof(pack_magic)) != 0 || header.version != version
+        || header.table_offset > bytes || table_size > bytes - header.table_offset || header.names_offset > bytes)
+    {
+        close();
+        return false;
+    }
+
+    auto const * records = reinterpret_cast<table_record const *>(begin + header.table_offset);
+    char const * names = reinterpret_cast<char const *>(begin + header.names_offset);
+    std::size_t names_size = bytes - header.names_offset;
+
+    entries.reserve(header.entries_count);
+    for (std::uint32_t i = 0; i < header.entries_count; ++i)
+    {
+        table_record const & record = records[i];
+        if (record.offset > bytes || record.size > bytes - record.offset || record.name_offset > names_size
+            || record.name_size > names_size - record.name_offset)
+        {
+            close();
+            return false;
+        }
+        entries.push_back({
+            std::string_view(names + record.name_offset, record.name_size),
+            (entry_kind)record.kind,
+            std::span<std::byte const>(begin + record.offset, record.size),
+            {record.source_size, record.source_time},
+        });
+    }
+
+    this->root = root;
+    return true;
+}
+
+void pack_file::close()
+{
+#ifndef WIN32
+    if (mapped)
+        munmap(const_cast<std::byte *>(begin), bytes);
+#endif
+    begin = nullptr;
+    bytes = 0;
+    mapped = false;
+    storage.clear();
+    entries.clear();
+}
+
+std::optional<entry> pack_file::find(std::string_view name) const
+{
+    auto it = std::lower_bound(entries.begin(), entries.end(), name, [](entry const & e, std::string_view name)
+    {
+        return e.name < name;
+    });
+    if (it == entries.end() || it->name != name)
+        return std::nullopt;
+    return *it;
+}
+
+std::optional<entry> pack_file::find(std::filesystem::path const & path, entry_kind kind) const
+{
+    if (!is_open())
+        return std::nullopt;
+
+    std::string name = path.lexically_normal().lexically_relative(root).generic_string();
+    if (name.empty() || name.starts_with(".."))
+        return std::nullopt;
+
+    auto result = find(name);
+    if (!result || result->kind != kind)
+        return std::nullopt;
+
+    auto current = stamp_of(path);
+    if (current && *current != result->source)
+        return std::nullopt;
+    return result;
+}
+
+std::optional<mesh_view> pack_file::find_mesh(std::filesystem::path const & path) const
+{
+    auto found = find(path, entry_kind::mesh);
+    if (!found || found->data.size() < sizeof(mesh_header))
+        return std::nullopt;
+
+    mesh_header header;
+    std::memcpy(&header, found->data.data(), sizeof(header));
+
+    std::size_t vertices_offset = align_up(sizeof(header));
+    std::size_t vertex_bytes = (std::size_t)header.vertex_size * header.vertex_count;
+    std::size_t index_bytes = (std::size_t)header.index_count * sizeof(std::uint32_t);
+    if (vertices_offset + vertex_bytes > header.indices_offset || header.indices_offset + index_bytes > found->data.size())
+        return std::nullopt;
+
+    mesh_view result;
+    result.vertex_size = header.vertex_size;
+    result.vertices = found->data.subspan(vertices_offset, vertex_bytes);
+    result.indices = {reinterpret_cast<std::uint32_t const *>(found->data.data() + header.indices_offset), header.index_count};
+    return result;
+}
+
+std::optional<source_stamp> stamp_of(std::filesystem::path const & path)
+{
+    std::error_code error;
+    source_stamp result;
+    result.size = std::filesystem::file_size(path, error);
+    if (!error)
+        result.time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    if (error)
+        return std::nullopt;
+    return result;
+}
+
+void pack_writer::add(std::string name, entry_kind kind, std::vector<std::byte> data, source_stamp source)
+{
+    entries.push_back({std::move(name), kind, std::move(data), source});
+}
+
+void pack_writer::add_mesh(std::string name, void const * vertices, std::uint32_t vertex_size, std::uint32_t vertex_count,
+    std::uint32_t const * indices, std::uint32_t index_count, source_stamp source)
+{
+    std::size_t vertices_offset = align_up(sizeof(mesh_header));
+    std::size_t vertex_bytes = (std::size_t)vertex_size * vertex_count;
+    std::size_t indices_offset = align_up(vertices_offset + vertex_bytes);
+    std::size_t index_bytes = (std::size_t)index_count * sizeof(std::uint32_t);
+
+    mesh_header header{vertex_size, vertex_count, index_count, (std::uint32_t)indices_offset};
+
+    std::vector<std::byte> data(indices_offset + index_bytes);
+    std::memcpy(data.data(), &header, sizeof(header));
+    std::memcpy(data.data() + vertices_offset, vertices, vertex_bytes);
+    std::memcpy(data.data() + indices_offset, indices, index_bytes);
+    add(std::move(name), entry_kind::mesh, std::move(data), source);
+}
+
+std::size_t pack_writer::data_size() const
+{
+    std::size_t result = 0;
+    for (auto const & e : entries)
+        result += e.data.size();
+    return result;
+}
+
+void pack_writer::write(std::filesystem::path const & path) const
+{
+    std::vector<pending const *> sorted;
+    for (auto const & e : entries)
+        sorted.push_back(&e);
+    std::sort(sorted.begin(), sorted.end(), [](pending const * a, pending const * b) { return a->name < b->name; });
+
+    // written next to the destination and renamed over it, a running game keeps its mapping of the old one
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    std::ofstream output(temporary, std::ios::binary);
+    if (!output)
+        throw std::runtime_error("can't write " + temporary.string());
+
+    auto pad_to = [&](std::size_t offset)
+    {
+        static char const zeros[alignment] = {};
+        std::size_t position = output.tellp();
+        output.write(zeros, offset - position);
+    };
+
+    file_header header{};
+    std::memcpy(header.magic, pack_magic, sizeof(pack_magic));
+    header.version = version;
+    header.entries_count = (std::uint32_t)sorted.size();
+    output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+
+    std::vector<table_record> records;
+    std::string names;
+    for (auto const * e : sorted)
+    {
+        pad_to(align_up(output.tellp()));
+
+        table_record record{};
+        record.offset = output.tellp();
+        record.size = e->data.size();
+        record.source_size = e->source.size;
+        record.source_time = e->source.time;
+        record.kind = (std::uint32_t)e->kind;
+        record.name_offset = (std::uint32_t)names.size();
+        record.name_size = (std::uint32_t)e->name.size();
+        records.push_back(record);
+        names += e->name;
+
+        output.write(reinterpret_cast<char const *>(e->data.data()), e->data.size());
+    }
+
+    pad_to(align_up(output.tellp()));
+    header.table_offset = output.tellp();
+    output.write(reinterpret_cast<char const *>(records.data()), records.size() * sizeof(table_record));
+    header.names_offset = output.tellp();
+    output.write(names.data(), names.size());
+
+    output.seekp(0);
+    output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    output.close();
+    if (!output)
+        throw std::runtime_error("can't write " + temporary.string());
+
+    std::filesystem::rename(temporary, path);
+}
+
+std::filesystem::path models_path()
+{
+    return std::filesystem::path(PROJECT_ROOT) / "models.pack";
+}
+
+pack_file const * models()
+{
+    // never destroyed, threads still loading at exit may read it while statics are torn down
+    static pack_file & instance = *new pack_file;
+    static bool opened = use_models_pack && instance.open(models_path(), std::filesystem::path(PROJECT_ROOT) / "models");
+    return opened ? &instance : nullptr;
+}
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+// One file holding every asset of the project in the form the runtime uses, written by the
+// asset-pack tool. Entries are named by their source path relative to the models directory
+// ("rose/rose.gltf") and start at aligned offsets, so views into the mapped file can be handed to
+// glBufferData or glCompressedTexImage2D as they are. Each entry also records the size and
+// modification time of its source, an entry whose source changed since is skipped.
+//
+// Layout: header, entry data, entry table sorted by name, names. All integers little endian.
+namespace asset_pack
+{
+
+std::uint32_t const version = 2;
+
+// entry data starts at a multiple of this
+std::size_t const alignment = 64;
+
+enum class entry_kind : std::uint32_t
+{
+    // the source file as is: glTF JSON and buffers, volumes
+    raw = 0,
+    // a texture container, see save_compressed_texture
+    texture = 1,
+    // mesh_header then vertices then 32 bit indices, each part aligned
+    mesh = 2,
+};
+
+struct mesh_header
+{
+    std::uint32_t vertex_size;
+    std::uint32_t vertex_count;
+    std::uint32_t index_count;
+    std::uint32_t indices_offset;
+};
+
+struct mesh_view
+{
+    std::span<std::byte const> vertices;
+    std::span<std::uint32_t const> indices;
+    std::uint32_t vertex_size = 0;
+};
+
+// size and modification time of the file an entry was made from
+struct source_stamp
+{
+    std::uint64_t size = 0;
+    std::int64_t time = 0;
+
+    bool operator == (source_stamp const &) const = default;
+};
+
+// nullopt if the file is missing
+std::optional<source_stamp> stamp_of(std::filesystem::path const & path);
+
+struct entry
+{
+    std::string_view name;
+    entry_kind kind;
+    std::span<std::byte const> data;
+    source_stamp source;
+
+    std::string_view text() const
+    {
+        return {reinterpret_cast<char const *>(data.data()), data.size()};
+    }
+};
+
+// A pack mapped into memory. Views returned by find() stay valid as long as the pack is open.
+struct pack_file
+{
+    pack_file() = default;
+    ~pack_file();
+
+    pack_file(pack_file const &) = delete;
+    pack_file & operator = (pack_file const &) = delete;
+
+    // False if the file is missing, of another version or damaged. `root` is the directory entry
+    // names are relative to.
+    bool open(std::filesystem::path const & path, std::filesystem::path const & root);
+    void close();
+
+    bool is_open() const { return begin != nullptr; }
+    std::size_t size() const { return bytes; }
+    std::size_t entries_count() const { return entries.size(); }
+
+    std::optional<entry> find(std::string_view name) const;
+
+    // By the path of the source file, nullopt for files outside the root, of another kind or that
+    // changed since the pack was made, the caller loads the file instead then. A missing source
+    // doesn't make the entry stale, the pack may be all there is.
+    std::optional<entry> find(std::filesystem::path const & path, entry_kind kind) const;
+
+    std::optional<mesh_view> find_mesh(std::filesystem::path const & path) const;
+
+private:
+    std::byte const * begin = nullptr;
+    std::size_t bytes = 0;
+
+    // without mmap the file is read into memory instead
+    std::vector<std::byte> storage;
+    bool mapped = false;
+
+    std::filesystem::path root;
+    std::vector<entry> entries;
+};
+
+// Collects entries and writes them out as a pack.
+struct pack_writer
+{
+    void add(std::string name, entry_kind kind, std::vector<std::byte> data, source_stamp source);
+    void add_mesh(std::string name, void const * vertices, std::uint32_t vertex_size, std::uint32_t vertex_count,
+        std::uint32_t const * indices, std::uint32_t index_count, source_stamp source);
+
+    // total bytes of entry data added
+    std::size_t data_size() const;
+
+    void write(std::filesystem::path const & path) const;
+
+private:
+    struct pending
+    {
+        std::string name;
+        entry_kind kind;
+        std::vector<std::byte> data;
+        source_stamp source;
+    };
+
+    std::vector<pending> entries;
+};
+
+// PROJECT_ROOT/models.pack, cooked from PROJECT_ROOT/models
+std::filesystem::path models_path();
+
+// Off to load every asset from its own file, e.g. to compare startup times.
+inline bool use_models_pack = true;
+
+// The models pack, opened on first use; nullptr if it's disabled, missing or of another version.
+// Like the .bctex and .mips caches it's checked against the sources, but per entry: a changed
+// source is loaded from its file until asset-pack is run again.
+pack_file const * models();
+
+}
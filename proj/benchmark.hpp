@@ -0,0 +1,347 @@
+#pragma once
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/ostreamwrapper.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdint>
+
+namespace benchmark {
+
+// Headless run: a hidden window, a fixed timestep and a scripted input track instead of the
+// keyboard, so that two runs on the same machine do exactly the same work.
+struct config_t {
+    bool enabled = false;
+
+    int frames = 1200;
+    int warmup_frames = 60;
+    float dt = 1.f / 60.f;
+    int width = 1280, height = 720;
+
+    // with draw = false entities only update, for machines without a usable GL driver
+    bool draw = true;
+
+    // simulate on a separate thread as interactive runs do; off by default, so that runs compare
+    // the work of a frame rather than how well it overlaps
+    bool pipelined = false;
+
+    std::string script_path;    // empty means the built-in track
+    std::string output_path = "benchmark.json";
+    std::string trace_path;     // Chrome trace of the recorded frames, empty disables it
+
+    // load assets from the models pack when there is one; off compares against the separate files
+    bool use_pack = true;
+
+    // load textures in the background, see asset_cache::texture_cache_t; benchmark runs wait for
+    // them before the first frame either way
+    bool async_assets = true;
+
+    // triangles of rose LODs per frame, see lod_selector_t; 0 leaves the pixel error alone
+    std::size_t triangle_budget = 0;
+
+    // decode the whole bitmap clip into one texture array at startup instead of streaming it, see
+    // bitmap_t::preload; prints how long each stage took
+    bool preload_bitmap = false;
+
+    unsigned int seed = 1;
+};
+
+//   --benchmark             enable the headless run
+//   --frames N              frames to record after the warm-up
+//   --warmup N              frames to run before recording
+//   --dt SECONDS            fixed timestep
+//   --size WxH              framebuffer size
+//   --script PATH           input track, see script_t::load
+//   --output PATH           JSON report
+//   --trace PATH            Chrome trace of the profiler scopes
+//   --no-draw               skip entity draws
+//   --pipelined             simulate the next frame while drawing the current one
+//   --no-pack               load every asset from its own file instead of models.pack
+//   --sync-assets           load textures inside the entity constructors
+//   --triangle-budget N     coarsen rose LODs until a frame draws at most N of their triangles
+//   --preload-bitmap        load every bitmap frame at startup instead of streaming them
+//
+// Startup is reported as `first_frame_ms` and `assets_ms`, both from the start of main. For cold
+// numbers drop the page cache before the run (`sync; echo 3 > /proc/sys/vm/drop_caches` as root),
+// warm ones are any run right after another.
+inline config_t parse_args(int argc, char **argv) {
+    config_t config;
+
+    auto value = [&](int &i) -> std::string {
+        if (i + 1 >= argc) {
+            throw std::runtime_error(std::string("missing value for ") + argv[i]);
+        }
+        return argv[++i];
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--benchmark") {
+            config.enabled = true;
+        } else if (arg == "--frames") {
+            config.frames = std::stoi(value(i));
+        } else if (arg == "--warmup") {
+            config.warmup_frames = std::stoi(value(i));
+        } else if (arg == "--dt") {
+            config.dt = std::stof(value(i));
+        } else if (arg == "--size") {
+            std::string size = value(i);
+            if (std::sscanf(size.c_str(), "%dx%d", &config.width, &config.height) != 2) {
+                throw std::runtime_error("bad size: " + size);
+            }
+        } else if (arg == "--script") {
+            config.script_path = value(i);
+        } else if (arg == "--output") {
+            config.output_path = value(i);
+        } else if (arg == "--trace") {
+            config.trace_path = value(i);
+        } else if (arg == "--no-draw") {
+            config.draw = false;
+        } else if (arg == "--pipelined") {
+            config.pipelined = true;
+        } else if (arg == "--no-pack") {
+            config.use_pack = false;
+        } else if (arg == "--sync-assets") {
+            config.async_assets = false;
+        } else if (arg == "--triangle-budget") {
+            config.triangle_budget = std::stoull(value(i));
+        } else if (arg == "--preload-bitmap") {
+            config.preload_bitmap = true;
+        } else {
+            throw std::runtime_error("unknown argument: " + arg);
+        }
+    }
+
+    return config;
+}
+
+struct key_event_t {
+    int frame;
+    SDL_Keycode key;
+    bool down;
+};
+
+// Key presses and releases at given frames. Camera keys go through button_down like everything
+// else, so the track drives both the camera and the characters.
+struct script_t {
+    std::vector <key_event_t> events;
+
+    // One line per event: `frame key down|up`, key names as SDL_GetKeyFromName understands them
+    // ("W", "Left", "Left Shift"), quoted if they contain spaces. '#' starts a comment.
+    static script_t load(const std::string &path) {
+        std::ifstream input(path);
+        if (!input) {
+            throw std::runtime_error("can't open benchmark script " + path);
+        }
+
+        script_t result;
+        std::string line;
+        for (int line_number = 1; std::getline(input, line); line_number++) {
+            line = line.substr(0, line.find('#'));
+
+            std::istringstream stream(line);
+            int frame;
+            std::string key, action;
+            if (!(stream >> frame)) {
+                continue;
+            }
+            if (!(stream >> std::quoted(key) >> action) || (action != "down" && action != "up")) {
+                throw std::runtime_error(path + ":" + std::to_string(line_number) + ": expected `frame key down|up`");
+            }
+
+            SDL_Keycode keycode = SDL_GetKeyFromName(key.c_str());
+            if (keycode == SDLK_UNKNOWN) {
+                throw std::runtime_error(path + ":" + std::to_string(line_number) + ": unknown key " + key);
+            }
+
+            result.events.push_back({frame, keycode, action == "down"});
+        }
+
+        result.sort();
+        return result;
+    }
+
+    // Zooms out over the field, orbits the camera the whole time and walks papich around in
+    // circles, switching to the mouse camera for a while.
+    static script_t builtin(int frames) {
+        script_t result;
+
+        auto hold = [&](SDL_Keycode key, int from, int to) {
+            result.events.push_back({from, key, true});
+            result.events.push_back({to, key, false});
+        };
+
+        hold(SDLK_DOWN, 0, 150);
+        hold(SDLK_LEFT, 0, frames);
+        hold(SDLK_w, 0, frames);
+        for (int frame = 0; frame < frames; frame += 240) {
+            hold(SDLK_a, frame + 60, frame + 120);
+            hold(SDLK_LSHIFT, frame + 120, frame + 180);
+        }
+        hold(SDLK_UP, frames / 2, frames / 2 + 60);
+        hold(SDLK_m, frames * 3 / 4, frames * 3 / 4 + 120);
+
+        result.sort();
+        return result;
+    }
+
+    void apply(int frame, std::map <SDL_Keycode, bool> &button_down) {
+        for (; next < events.size() && events[next].frame <= frame; next++) {
+            button_down[events[next].key] = events[next].down;
+        }
+    }
+
+private:
+    std::size_t next = 0;
+
+    void sort() {
+        std::stable_sort(events.begin(), events.end(), [](const key_event_t &a, const key_event_t &b) {
+            return a.frame < b.frame;
+        });
+    }
+};
+
+// Per-frame CPU timings grouped by section ("frame") or by entity and phase ("roses", "draw").
+struct recorder_t {
+    bool recording = false;
+
+    // from the start of main to the first frame presented and to the last texture uploaded,
+    // negative until then; and where assets came from
+    double first_frame_ms = -1.0, assets_ms = -1.0;
+    bool asset_pack = false;
+
+    template <typename F>
+    void measure(const std::string &section, const std::string &phase, F &&f) {
+        if (!recording) {
+            f();
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        f();
+        add(section, phase, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    void add(const std::string &section, const std::string &phase, double ms) {
+        auto &section_samples = samples[section];
+        if (section_samples.empty()) {
+            order.push_back(section);
+        }
+        section_samples[phase].push_back(ms);
+    }
+
+    // per frame values that aren't times, e.g. triangles drawn
+    void count(const std::string &name, double value) {
+        if (recording) {
+            counters[name].push_back(value);
+        }
+    }
+
+    static double percentile(std::vector <double> values, double p) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        std::size_t index = std::min(values.size() - 1, (std::size_t)(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+    void write_json(std::ostream &out, const config_t &config, const std::string &renderer) const {
+        rapidjson::Document document;
+        document.SetObject();
+        auto &allocator = document.GetAllocator();
+
+        rapidjson::Value run(rapidjson::kObjectType);
+        run.AddMember("frames", config.frames, allocator);
+        run.AddMember("warmup_frames", config.warmup_frames, allocator);
+        run.AddMember("dt", config.dt, allocator);
+        run.AddMember("width", config.width, allocator);
+        run.AddMember("height", config.height, allocator);
+        run.AddMember("draw", config.draw, allocator);
+        run.AddMember("pipelined", config.pipelined, allocator);
+        run.AddMember("script", rapidjson::Value(config.script_path.empty() ? "builtin" : config.script_path.c_str(), allocator), allocator);
+        run.AddMember("renderer", rapidjson::Value(renderer.c_str(), allocator), allocator);
+        run.AddMember("first_frame_ms", first_frame_ms, allocator);
+        run.AddMember("assets_ms", assets_ms, allocator);
+        run.AddMember("asset_pack", asset_pack, allocator);
+        run.AddMember("triangle_budget", (std::uint64_t)config.triangle_budget, allocator);
+        run.AddMember("preload_bitmap", config.preload_bitmap, allocator);
+        document.AddMember("run", run, allocator);
+
+        rapidjson::Value sections(rapidjson::kObjectType);
+        for (const auto &section : order) {
+            rapidjson::Value phases(rapidjson::kObjectType);
+            for (const auto &[phase, values] : samples.at(section)) {
+                double sum = 0.0;
+                for (double value : values) {
+                    sum += value;
+                }
+
+                rapidjson::Value stats(rapidjson::kObjectType);
+                stats.AddMember("mean_ms", values.empty() ? 0.0 : sum / values.size(), allocator);
+                stats.AddMember("p50_ms", percentile(values, .5), allocator);
+                stats.AddMember("p90_ms", percentile(values, .9), allocator);
+                stats.AddMember("p99_ms", percentile(values, .99), allocator);
+                stats.AddMember("max_ms", values.empty() ? 0.0 : *std::max_element(values.begin(), values.end()), allocator);
+                stats.AddMember("samples", (std::uint64_t)values.size(), allocator);
+
+                phases.AddMember(rapidjson::Value(phase.c_str(), allocator), stats, allocator);
+            }
+            sections.AddMember(rapidjson::Value(section.c_str(), allocator), phases, allocator);
+        }
+        document.AddMember("sections", sections, allocator);
+
+        rapidjson::Value counter_stats(rapidjson::kObjectType);
+        for (const auto &[name, values] : counters) {
+            rapidjson::Value stats(rapidjson::kObjectType);
+            stats.AddMember("p50", percentile(values, .5), allocator);
+            stats.AddMember("p99", percentile(values, .99), allocator);
+            stats.AddMember("max", values.empty() ? 0.0 : *std::max_element(values.begin(), values.end()), allocator);
+            counter_stats.AddMember(rapidjson::Value(name.c_str(), allocator), stats, allocator);
+        }
+        document.AddMember("counters", counter_stats, allocator);
+
+        rapidjson::OStreamWrapper stream(out);
+        rapidjson::PrettyWriter <rapidjson::OStreamWrapper> writer(stream);
+        document.Accept(writer);
+        out << std::endl;
+    }
+
+    void report(std::ostream &out) const {
+        out << std::fixed << std::setprecision(3);
+        for (const auto &section : order) {
+            for (const auto &[phase, values] : samples.at(section)) {
+                out << section << " " << phase << ": p50 " << percentile(values, .5) << " ms, p99 " << percentile(values, .99) << " ms" << std::endl;
+            }
+        }
+        for (const auto &[name, values] : counters) {
+            out << name << ": p50 " << percentile(values, .5) << ", max " \
+                << (values.empty() ? 0.0 : *std::max_element(values.begin(), values.end())) << std::endl;
+        }
+    }
+
+private:
+    std::vector <std::string> order;
+    std::map <std::string, std::map <std::string, std::vector <double>>> samples;
+    std::map <std::string, std::vector <double>> counters;
+};
+
+}
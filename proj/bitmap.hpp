@@ -6,8 +6,19 @@
 
 #include <string>
 #include <cstring>
+#include <cmath>
+#include <vector>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <iostream>
+#include <cstdint>
 
 #include "common_util.hpp"
+#include "thread_pool.hpp"
 
 #include "entity.hpp"
 
@@ -15,10 +26,9 @@ namespace bitmap {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 const float A = 24.0;
 
@@ -57,16 +67,12 @@ void main() {
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform sampler2DArray albedo_texture;
 
-uniform vec3 light_direction;
-uniform vec3 light_color;
-uniform vec3 ambient_light_color;
-
-uniform float time;
-uniform int frames_cnt;
-uniform float fps;
+// layer of the current frame, the CPU follows the clip
+uniform float layer;
 
 in vec3 position;
 in vec3 normal;
@@ -77,22 +83,302 @@ layout (location = 0) out vec4 out_color;
 void main() {
     float diffuse = max(0.0, dot(normalize(normal), light_direction));
     
-    vec3 albedo = texture(albedo_texture, vec3(texcoord, mod(time * fps, frames_cnt) - 0.5)).rgb;
+    vec3 albedo = texture(albedo_texture, vec3(texcoord, layer)).rgb;
     vec3 color_correction = vec3(0.4);
     
     out_color = vec4(albedo * (light_color * diffuse + ambient_light_color + color_correction), 1.0);
 }
 )";
 
+inline std::string frame_path(const std::string &frames_path, int index) {
+    std::string cur_frame_num = std::to_string(index + 1);
+    cur_frame_num = std::string(3 - cur_frame_num.size(), '0') + cur_frame_num;
+    return frames_path + cur_frame_num + ".jpg";
+}
+
+inline double ms_since(std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+}
+
+struct stream_stats_t {
+    std::uint64_t uploaded = 0;
+
+    // frames of the clip that were never shown, because drawing is slower than the clip or the
+    // decoder fell behind
+    std::uint64_t dropped = 0;
+
+    // draws that found their frame not decoded yet and kept showing the previous one
+    std::uint64_t late = 0;
+
+    void reset() {
+        *this = stream_stats_t();
+    }
+};
+
+// Plays the clip through a few layers of a texture array. A decoder thread keeps the frames from
+// the playback position on decoded into a ring of `decode_ahead` staging slots, the GL thread
+// uploads the frame that's due into the next layer and samples that one. Layers are used round
+// robin, so an upload never waits for draws still sampling the previous frames.
+//
+// Memory is decode_ahead frames on the CPU and `layers` frames on the GPU, both with mipmaps, however
+// long the clip is. The decoder builds the mipmaps of a frame along with it, so an upload writes the
+// levels of its own layer and leaves the others alone. If the frames are cooked by texture-cook, both
+// hold their blocks instead, a quarter or an eighth of the size, and the decoder only reads them.
+struct frame_stream_t {
+    static const int decode_ahead = 8;
+    static const int layers = 4;
+
+    // print stats every this many advances, 0 disables reporting
+    int report_period = 600;
+
+    stream_stats_t stats;
+    int advances_since_report = 0;
+
+    GLuint texture;
+
+    frame_stream_t(std::string frames_path, int frames_cnt, int width, int height)
+        : frames_path(std::move(frames_path)), frames_cnt(frames_cnt), width(width), height(height)
+    {
+        for (auto &slot_frame : slot_frames) {
+            slot_frame = -1;
+        }
+
+        // the first frame decides for the clip, frames cooked differently come out black
+        std::string first_path = frame_path(this->frames_path, 0);
+        compressed_texture first_storage;
+        compressed_texture_view first;
+        compressed = find_cooked_texture(first_path, first_storage, first) && block_format_supported(first.format) \
+            && first.levels[0].width == width && first.levels[0].height == height;
+
+        glGenTextures(1, &texture);
+        gl_state::cache().bind_texture(GL_TEXTURE_2D_ARRAY, texture);
+        if (compressed) {
+            format = first.format;
+            levels_cnt = first.levels.size();
+            for (int level = 0; level < levels_cnt; level++) {
+                int level_width = std::max(1, width >> level), level_height = std::max(1, height >> level);
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, gl_block_format(format), level_width, level_height, layers, 0, \
+                    compressed_size(format, level_width, level_height) * layers, nullptr);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels_cnt - 1);
+            cooked_slots.resize(decode_ahead);
+            cooked_storage.resize(decode_ahead);
+        } else {
+            // the full chain down to 1x1, as generate_mips builds it
+            levels_cnt = 1;
+            while ((width >> levels_cnt) > 0 || (height >> levels_cnt) > 0) {
+                levels_cnt++;
+            }
+            for (int level = 0; level < levels_cnt; level++) {
+                int level_width = std::max(1, width >> level), level_height = std::max(1, height >> level);
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, level_width, level_height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                level_offsets.push_back(slot_size);
+                slot_size += (std::size_t)level_width * level_height * 4;
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels_cnt - 1);
+            staging.resize(decode_ahead * slot_size);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        decoder = std::thread([this]() { decode_loop(); });
+
+        // the first frame is waited for, so that there's something to show from the start
+        slot_frames[0].wait(-1);
+        upload(0);
+    }
+
+    frame_stream_t(const frame_stream_t &) = delete;
+    frame_stream_t &operator=(const frame_stream_t &) = delete;
+
+    ~frame_stream_t() {
+        stopping = true;
+        playback_frame.fetch_add(1);
+        playback_frame.notify_one();
+        decoder.join();
+    }
+
+    // layer of the frame to show at `time` seconds of playback
+    int advance(float time, int fps) {
+        std::int64_t target = (std::int64_t)std::floor(time * fps);
+        if (target <= shown_frame) {
+            return shown_layer;
+        }
+
+        playback_frame.store(target);
+        playback_frame.notify_one();
+
+        if (slot_frames[target % decode_ahead].load(std::memory_order_acquire) != target) {
+            if (target != late_frame) {
+                stats.late++;
+                late_frame = target;
+            }
+            return shown_layer;
+        }
+
+        stats.dropped += target - shown_frame - 1;
+        upload(target);
+
+        if (report_period > 0 && ++advances_since_report >= report_period) {
+            report(std::cerr);
+            stats.reset();
+            advances_since_report = 0;
+        }
+        return shown_layer;
+    }
+
+    std::size_t resident_bytes() const {
+        if (compressed) {
+            std::size_t cooked_size = 0;
+            for (int level = 0; level < levels_cnt; level++) {
+                cooked_size += compressed_size(format, std::max(1, width >> level), std::max(1, height >> level));
+            }
+            return (decode_ahead + layers) * cooked_size;
+        }
+
+        return staging.size() + layers * slot_size;
+    }
+
+    void report(std::ostream &out) const {
+        out << "bitmap stream" << (compressed ? std::string(" (") + format_name(format) + ")" : "") << ": " << stats.uploaded << " frames uploaded, " << stats.dropped << " dropped, " \
+            << stats.late << " late, " << resident_bytes() / (1024 * 1024) << " MiB resident" << std::endl;
+    }
+
+private:
+    std::string frames_path;
+    int frames_cnt, width, height;
+
+    // slot_frames[i] is the frame decoded into slot i, -1 while it's being written; a slot holds every
+    // level of the frame, level i at level_offsets[i]
+    std::vector <unsigned char> staging;
+    std::vector <std::size_t> level_offsets;
+    std::size_t slot_size = 0;
+    std::array <std::atomic <std::int64_t>, decode_ahead> slot_frames;
+
+    // cooked frames are staged as blocks instead, views into the models pack or into cooked_storage
+    bool compressed = false;
+    block_format format = block_format::bc1;
+    int levels_cnt = 1;
+    std::vector <compressed_texture_view> cooked_slots;
+    std::vector <compressed_texture> cooked_storage;
+
+    std::thread decoder;
+    std::atomic <bool> stopping = false;
+
+    // frames are counted from the start of playback, they wrap around the clip only on decoding
+    std::atomic <std::int64_t> playback_frame = 0;
+    std::int64_t shown_frame = -1, late_frame = -1;
+    int shown_layer = 0;
+
+    void upload(std::int64_t frame) {
+        shown_layer = (shown_layer + 1) % layers;
+        shown_frame = frame;
+
+        gl_state::cache().bind_texture(GL_TEXTURE_2D_ARRAY, texture);
+        if (compressed) {
+            const compressed_texture_view &cooked = cooked_slots[frame % decode_ahead];
+            for (int level = 0; level < levels_cnt; level++) {
+                const auto &data = cooked.levels[level];
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, shown_layer, data.width, data.height, 1, \
+                    gl_block_format(format), data.data.size(), data.data.data());
+            }
+        } else {
+            const unsigned char *slot = staging.data() + frame % decode_ahead * slot_size;
+            for (int level = 0; level < levels_cnt; level++) {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, shown_layer, std::max(1, width >> level), std::max(1, height >> level), 1, \
+                    GL_RGBA, GL_UNSIGNED_BYTE, slot + level_offsets[level]);
+            }
+        }
+        stats.uploaded++;
+    }
+
+    // the cooked frame into its slot, false if it's missing or cooked differently from the first one
+    bool load_cooked(const std::string &path, std::size_t index) {
+        compressed_texture_view &slot = cooked_slots[index];
+        if (!find_cooked_texture(path, cooked_storage[index], slot)) {
+            return false;
+        }
+        return slot.format == format && (int)slot.levels.size() == levels_cnt \
+            && slot.levels[0].width == width && slot.levels[0].height == height;
+    }
+
+    // zeroed blocks decode to black in every format
+    void clear_cooked(std::size_t index) {
+        compressed_texture &slot = cooked_storage[index];
+        slot.format = format;
+        slot.levels.resize(levels_cnt);
+        for (int level = 0; level < levels_cnt; level++) {
+            auto &data = slot.levels[level];
+            data.width = std::max(1, width >> level);
+            data.height = std::max(1, height >> level);
+            data.data.assign(compressed_size(format, data.width, data.height), 0);
+        }
+        cooked_slots[index] = slot.view();
+    }
+
+    // A slot is rewritten only with a frame decode_ahead past the playback position, the GL thread
+    // never reads the frames behind it.
+    void decode_loop() {
+        std::int64_t next = 0;
+        while (!stopping) {
+            std::int64_t playback = playback_frame.load();
+            next = std::max(next, playback);
+            if (next >= playback + decode_ahead) {
+                playback_frame.wait(playback);
+                continue;
+            }
+
+            std::atomic <std::int64_t> &slot_frame = slot_frames[next % decode_ahead];
+            slot_frame.store(-1);
+
+            std::string path = frame_path(frames_path, next % frames_cnt);
+            if (compressed) {
+                if (!load_cooked(path, next % decode_ahead)) {
+                    std::cerr << "failed to load cooked " << path << std::endl;
+                    clear_cooked(next % decode_ahead);
+                }
+
+                slot_frame.store(next, std::memory_order_release);
+                slot_frame.notify_one();
+
+                next++;
+                continue;
+            }
+
+            int frame_width, frame_height, channels;
+            unsigned char *frame = stbi_load(path.c_str(), &frame_width, &frame_height, &channels, 4);
+            unsigned char *slot = staging.data() + next % decode_ahead * slot_size;
+            if (frame && frame_width == width && frame_height == height) {
+                // box filtered as glGenerateMipmap would, a frame is on screen for a few draws at most
+                mip_settings settings;
+                settings.filter = mip_filter::box;
+                std::vector <mip_level> levels = generate_mips(frame, width, height, settings);
+                for (int level = 0; level < levels_cnt; level++) {
+                    std::memcpy(slot + level_offsets[level], levels[level].data.data(), levels[level].data.size());
+                }
+            } else {
+                // shown black rather than never, so that playback doesn't wait for it
+                std::cerr << "failed to load " << path << std::endl;
+                std::memset(slot, 0, slot_size);
+            }
+            stbi_image_free(frame);
+
+            slot_frame.store(next, std::memory_order_release);
+            slot_frame.notify_one();
+
+            next++;
+        }
+    }
+};
+
 struct bitmap_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
     
     GLuint texture_location;
-    GLuint time_location, frames_cnt_location, fps_location;
+    GLuint layer_location;
 
     GLuint texture;
 
@@ -104,95 +390,139 @@ struct bitmap_t : entity::entity {
     const int bitmap_width = 480;
     const int bitmap_height = 440;
 
-    bitmap_t(int object_index) {
+    // frames uploaded with one glTexSubImage3D
+    const int upload_slice = 24;
+
+    // Streams the clip through a few layers by default. Preloading (--preload-bitmap) keeps all of
+    // it in one texture array, about 550 MB plus mipmaps.
+    std::unique_ptr <frame_stream_t> stream;
+
+    bitmap_t(int object_index, thread_pool::thread_pool_t *pool, bool streaming = true) {
         (void)object_index;
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
         model_location = glGetUniformLocation(program, "model");
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
         texture_location = glGetUniformLocation(program, "albedo_texture");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
-        time_location = glGetUniformLocation(program, "time");
-        frames_cnt_location = glGetUniformLocation(program, "frames_cnt");
-        fps_location = glGetUniformLocation(program, "fps");
+        layer_location = glGetUniformLocation(program, "layer");
 
         glGenVertexArrays(1, &vao);
 
         std::string project_root = PROJECT_ROOT;
         std::string frames_path = project_root + "/models/bitmap/frames/";
 
-        unsigned char *pixels = new unsigned char[frames_cnt * bitmap_width * bitmap_height * 4];
-        assert(pixels);
-
-        for (int i = 0; i < frames_cnt; i++) {
-            std::string cur_frame_num = std::to_string(i + 1);
-            cur_frame_num = std::string(3 - cur_frame_num.size(), '0') + cur_frame_num;
-
-            std::string cur_frame_path = frames_path + cur_frame_num + ".jpg";
-
-            int width, height, channels;
-            unsigned char *frame = stbi_load(cur_frame_path.c_str(), &width, &height, &channels, 4);
-            assert(frame);
-            assert(width == bitmap_width && height == bitmap_height);
+        if (streaming) {
+            stream = std::make_unique<frame_stream_t>(frames_path, frames_cnt, bitmap_width, bitmap_height);
+            texture = stream->texture;
+        } else {
+            preload(frames_path, pool);
+        }
+    }
 
-            std::memcpy(pixels + i * width * height * 4, frame, width * height * 4);
+    void preload(const std::string &frames_path, thread_pool::thread_pool_t *pool) {
+        auto start = std::chrono::steady_clock::now();
 
-            stbi_image_free(frame);
-        }
+        std::size_t frame_size = (std::size_t)bitmap_width * bitmap_height * 4;
+        std::unique_ptr <unsigned char[]> pixels(new unsigned char[frames_cnt * frame_size]);
 
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
-        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, bitmap_width, bitmap_height, frames_cnt, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        gl_state::cache().bind_texture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, bitmap_width, bitmap_height, frames_cnt, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
         glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        double allocate_ms = ms_since(start);
+
+        // The pool decodes frames straight into their layers of the staging buffer from a thread of
+        // its own, while this one uploads every slice as soon as all its frames are in. Frames are
+        // handed out in order, so they are mostly done in order too.
+        auto ready = std::make_unique<std::atomic <bool>[]>(frames_cnt);
+        std::vector <double> decode_ms(frames_cnt);
+        std::vector <char> failed(frames_cnt, 0);
+        double decode_wall_ms = 0.0;
+
+        std::thread decoder([&]() {
+            auto decode_start = std::chrono::steady_clock::now();
+            pool->parallel_for(frames_cnt, 1, [&](std::size_t, std::size_t i, std::size_t) {
+                auto frame_start = std::chrono::steady_clock::now();
+
+                int width, height, channels;
+                unsigned char *frame = stbi_load(frame_path(frames_path, i).c_str(), &width, &height, &channels, 4);
+                if (frame && width == bitmap_width && height == bitmap_height) {
+                    std::memcpy(pixels.get() + i * frame_size, frame, frame_size);
+                } else {
+                    failed[i] = 1;
+                }
+                stbi_image_free(frame);
+
+                decode_ms[i] = ms_since(frame_start);
+                ready[i].store(true);
+                ready[i].notify_one();
+            });
+            decode_wall_ms = ms_since(decode_start);
+        });
+
+        double wait_ms = 0.0, upload_ms = 0.0;
+        int slices_cnt = 0;
+        for (int first = 0; first < frames_cnt; first += upload_slice) {
+            int last = std::min(frames_cnt, first + upload_slice);
+
+            auto wait_start = std::chrono::steady_clock::now();
+            for (int i = first; i < last; i++) {
+                ready[i].wait(false);
+            }
+            wait_ms += ms_since(wait_start);
+
+            auto upload_start = std::chrono::steady_clock::now();
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, first, bitmap_width, bitmap_height, last - first, \
+                GL_RGBA, GL_UNSIGNED_BYTE, pixels.get() + first * frame_size);
+            upload_ms += ms_since(upload_start);
+            slices_cnt++;
+        }
+        decoder.join();
+
+        for (int i = 0; i < frames_cnt; i++) {
+            if (failed[i]) {
+                throw std::runtime_error("failed to load " + frame_path(frames_path, i));
+            }
+        }
+
+        auto mipmaps_start = std::chrono::steady_clock::now();
         glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        double mipmaps_ms = ms_since(mipmaps_start);
 
-        delete[] pixels;
+        double decode_total_ms = 0.0;
+        for (double ms : decode_ms) {
+            decode_total_ms += ms;
+        }
+
+        std::cerr << "bitmap: " << frames_cnt << " frames in " << ms_since(start) << " ms: " \
+            << "allocation " << allocate_ms << " ms, " \
+            << "decoding " << decode_wall_ms << " ms on " << pool->size() << " threads (" << decode_total_ms << " ms of work), " \
+            << "upload " << upload_ms << " ms in " << slices_cnt << " slices (" << wait_ms << " ms waiting for frames), " \
+            << "mipmaps " << mipmaps_ms << " ms" << std::endl;
     }
 
     void update_state(float time, float dt, std::map <SDL_Keycode, bool> &button_down) {
         (void)time; (void)dt; (void)button_down;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)camera_position;
-
+    void draw(const frame_uniforms::block_t &frame) {
         glm::mat4 model = glm::mat4(1.f);
         model = glm::rotate(model, correction_angle, {0.f, 1.f, 0.f});
         model = glm::scale(model, glm::vec3(scale));
 
-        glEnable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glDisable(GL_BLEND);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(light_color_location, 1, reinterpret_cast<const float*>(&light_color));
-        glUniform3fv(ambient_light_color_location, 1, reinterpret_cast<const float*>(&ambient_light_color));
-        glUniform1f(time_location, time);
-        glUniform1i(frames_cnt_location, frames_cnt);
-        glUniform1f(fps_location, fps);
-        glUniform1i(texture_location, 0);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
-
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        float layer = stream ? stream->advance(frame.time, fps) : std::floor(std::fmod(frame.time * fps, (float)frames_cnt));
+
+        render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::opaque, program, vao);
+        packet.state = render_queue::depth_test | render_queue::depth_write;
+        packet.textures[0] = {GL_TEXTURE_2D_ARRAY, texture};
+        packet.depth = render_queue_ptr->distance(glm::vec3(model[3]));
+        packet.uniforms = render_queue_ptr->uniforms()
+            .set(model_location, model)
+            .set(layer_location, layer)
+            .set(texture_location, 0);
+        packet.draw_arrays(GL_TRIANGLE_STRIP, 0, 4);
     }
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,832 @@
+#include "block_compression.hpp"
+
+#include "thread_pool.hpp"
+
+#include <stdexcept>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPRESSION_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+char const cooked_magic[4] = {'B', 'C', 'T', 'X'};
+std::uint32_t const cooked_version = 1;
+
+// one 4x4 block, channel by channel, so that four pixels fit one SSE register
+struct block_pixels
+{
+    alignas(16) float channel[4][16];
+};
+
+void load_block(std::uint8_t const * rgba, int width, int height, int block_x, int block_y, block_pixels & block)
+{
+    // pixels past the edge repeat the last row and column, they don't pull the endpoints away
+    for (int y = 0; y < 4; ++y)
+    {
+        int sy = std::min(block_y * 4 + y, height - 1);
+        for (int x = 0; x < 4; ++x)
+        {
+            int sx = std::min(block_x * 4 + x, width - 1);
+            std::uint8_t const * pixel = rgba + 4 * ((std::size_t)sy * width + sx);
+            for (int c = 0; c < 4; ++c)
+                block.channel[c][y * 4 + x] = pixel[c];
+        }
+    }
+}
+
+// For every pixel, the closest of `palette_size` entries over channels [first_channel, first_channel + channels).
+// Returns the total squared error.
+float fit_indices(block_pixels const & block, float const (*palette)[4], int palette_size, int first_channel, int channels,
+    std::uint8_t * indices)
+{
+#ifdef BLOCK_COMPRESSION_SSE2
+    __m128 total = _mm_setzero_ps();
+    for (int i = 0; i < 16; i += 4)
+    {
+        __m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128i best_index = _mm_setzero_si128();
+        for (int p = 0; p < palette_size; ++p)
+        {
+            __m128 distance = _mm_setzero_ps();
+            for (int c = first_channel; c < first_channel + channels; ++c)
+            {
+                __m128 d = _mm_sub_ps(_mm_load_ps(&block.channel[c][i]), _mm_set1_ps(palette[p][c]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, best_index));
+        }
+        total = _mm_add_ps(total, best);
+
+        alignas(16) std::int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), best_index);
+        for (int k = 0; k < 4; ++k)
+            indices[i + k] = (std::uint8_t)lanes[k];
+    }
+
+    alignas(16) float sums[4];
+    _mm_store_ps(sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    float total = 0.f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float best = std::numeric_limits<float>::max();
+        for (int p = 0; p < palette_size; ++p)
+        {
+            float distance = 0.f;
+            for (int c = first_channel; c < first_channel + channels; ++c)
+            {
+                float d = block.channel[c][i] - palette[p][c];
+                distance += d * d;
+            }
+            if (distance < best)
+            {
+                best = distance;
+                indices[i] = (std::uint8_t)p;
+            }
+        }
+        total += best;
+    }
+    return total;
+#endif
+}
+
+// Endpoints of the block's extent along its principal axis over the first `channels` channels.
+void principal_endpoints(block_pixels const & block, int channels, float * e0, float * e1)
+{
+    float mean[4] = {};
+    for (int c = 0; c < channels; ++c)
+    {
+        for (int i = 0; i < 16; ++i)
+            mean[c] += block.channel[c][i];
+        mean[c] /= 16.f;
+    }
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int a = 0; a < channels; ++a)
+            for (int b = 0; b < channels; ++b)
+                covariance[a][b] += (block.channel[a][i] - mean[a]) * (block.channel[b][i] - mean[b]);
+
+    // power iteration from the diagonal converges in a few steps for 4x4 blocks
+    float axis[4] = {1.f, 1.f, 1.f, 1.f};
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[4] = {};
+        float length = 0.f;
+        for (int a = 0; a < channels; ++a)
+        {
+            for (int b = 0; b < channels; ++b)
+                next[a] += covariance[a][b] * axis[b];
+            length = std::max(length, std::abs(next[a]));
+        }
+        if (length < 1e-6f)
+            break;
+        for (int a = 0; a < channels; ++a)
+            axis[a] = next[a] / length;
+    }
+
+    float t_min = std::numeric_limits<float>::max();
+    float t_max = -std::numeric_limits<float>::max();
+    float axis_length = 0.f;
+    for (int c = 0; c < channels; ++c)
+        axis_length += axis[c] * axis[c];
+
+    if (axis_length < 1e-12f)
+    {
+        t_min = t_max = 0.f;
+    }
+    else
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = 0.f;
+            for (int c = 0; c < channels; ++c)
+                t += (block.channel[c][i] - mean[c]) * axis[c];
+            t /= axis_length;
+            t_min = std::min(t_min, t);
+            t_max = std::max(t_max, t);
+        }
+    }
+
+    for (int c = 0; c < channels; ++c)
+    {
+        e0[c] = std::clamp(mean[c] + axis[c] * t_min, 0.f, 255.f);
+        e1[c] = std::clamp(mean[c] + axis[c] * t_max, 0.f, 255.f);
+    }
+}
+
+// Endpoints minimizing the squared error for fixed weights, pixel i being e0 * (1 - w[i]) + e1 * w[i].
+// False if the weights don't determine them, e.g. when all pixels use the same one.
+bool refine_endpoints(block_pixels const & block, int first_channel, int channels, float const * weights, float * e0, float * e1)
+{
+    float aa = 0.f, ab = 0.f, bb = 0.f;
+    float ax[4] = {}, bx[4] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        float b = weights[i];
+        float a = 1.f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = first_channel; c < first_channel + channels; ++c)
+        {
+            ax[c] += a * block.channel[c][i];
+            bx[c] += b * block.channel[c][i];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f)
+        return false;
+
+    for (int c = first_channel; c < first_channel + channels; ++c)
+    {
+        e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.f, 255.f);
+        e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.f, 255.f);
+    }
+    return true;
+}
+
+struct bit_writer
+{
+    std::uint8_t * output;
+    int position = 0;
+
+    void put(std::uint32_t value, int bits)
+    {
+        for (int i = 0; i < bits; ++i, ++position)
+            output[position >> 3] |= ((value >> i) & 1u) << (position & 7);
+    }
+};
+
+struct bit_reader
+{
+    std::uint8_t const * input;
+    int position = 0;
+
+    std::uint32_t get(int bits)
+    {
+        std::uint32_t value = 0;
+        for (int i = 0; i < bits; ++i, ++position)
+            value |= ((input[position >> 3] >> (position & 7)) & 1u) << i;
+        return value;
+    }
+};
+
+// ---------------------------------------------------------------------------------------------- BC1
+
+std::uint16_t pack_565(float const * color)
+{
+    int r = std::clamp((int)std::lround(color[0] * 31.f / 255.f), 0, 31);
+    int g = std::clamp((int)std::lround(color[1] * 63.f / 255.f), 0, 63);
+    int b = std::clamp((int)std::lround(color[2] * 31.f / 255.f), 0, 31);
+    return (std::uint16_t)(r << 11 | g << 5 | b);
+}
+
+void unpack_565(std::uint16_t value, int * color)
+{
+    int r = value >> 11, g = (value >> 5) & 63, b = value & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+}
+
+// the palette a decoder derives from the endpoints, in 4 color mode unless `three_colors`
+void color_palette(std::uint16_t c0, std::uint16_t c1, bool three_colors, int (*palette)[4])
+{
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+    for (int c = 0; c < 3; ++c)
+    {
+        if (three_colors)
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+        else
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = three_colors ? 0 : 255;
+}
+
+// 8 bytes in 4 color mode, the color half of BC1 and BC3
+void encode_color_block(block_pixels const & block, std::uint8_t * output)
+{
+    // weight of c1 in each palette entry
+    static float const weights[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+
+    float e0[4], e1[4];
+    principal_endpoints(block, 3, e0, e1);
+
+    float best_error = std::numeric_limits<float>::max();
+    std::uint16_t best_c0 = 0, best_c1 = 0;
+    std::uint8_t best_indices[16] = {};
+
+    for (int iteration = 0; iteration < 3; ++iteration)
+    {
+        std::uint16_t c0 = pack_565(e0), c1 = pack_565(e1);
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        int palette[4][4];
+        color_palette(c0, c1, false, palette);
+        float palette_f[4][4];
+        for (int p = 0; p < 4; ++p)
+            for (int c = 0; c < 4; ++c)
+                palette_f[p][c] = (float)palette[p][c];
+
+        // equal endpoints decode in 3 color mode, where only the first entry is the color
+        std::uint8_t indices[16];
+        float error = fit_indices(block, palette_f, c0 == c1 ? 1 : 4, 0, 3, indices);
+        if (error < best_error)
+        {
+            best_error = error;
+            best_c0 = c0;
+            best_c1 = c1;
+            std::memcpy(best_indices, indices, sizeof(indices));
+        }
+        if (error == 0.f)
+            break;
+
+        float pixel_weights[16];
+        for (int i = 0; i < 16; ++i)
+            pixel_weights[i] = weights[indices[i]];
+        for (int c = 0; c < 3; ++c)
+        {
+            e0[c] = palette_f[0][c];
+            e1[c] = palette_f[1][c];
+        }
+        if (!refine_endpoints(block, 0, 3, pixel_weights, e0, e1))
+            break;
+    }
+
+    std::memset(output, 0, 8);
+    bit_writer writer{output};
+    writer.put(best_c0, 16);
+    writer.put(best_c1, 16);
+    for (int i = 0; i < 16; ++i)
+        writer.put(best_indices[i], 2);
+}
+
+void decode_color_block(std::uint8_t const * input, bool allow_three_colors, std::uint8_t * pixels)
+{
+    bit_reader reader{input};
+    std::uint16_t c0 = (std::uint16_t)reader.get(16);
+    std::uint16_t c1 = (std::uint16_t)reader.get(16);
+
+    int palette[4][4];
+    color_palette(c0, c1, allow_three_colors && c0 <= c1, palette);
+    for (int i = 0; i < 16; ++i)
+    {
+        int const * color = palette[reader.get(2)];
+        for (int c = 0; c < 4; ++c)
+            pixels[4 * i + c] = (std::uint8_t)color[c];
+    }
+}
+
+// ---------------------------------------------------------------------------------------------- BC3
+
+void alpha_palette(int a0, int a1, float (*palette)[4])
+{
+    palette[0][3] = (float)a0;
+    palette[1][3] = (float)a1;
+    if (a0 > a1)
+    {
+        for (int i = 1; i < 7; ++i)
+            palette[i + 1][3] = (float)(((7 - i) * a0 + i * a1) / 7);
+    }
+    else
+    {
+        for (int i = 1; i < 5; ++i)
+            palette[i + 1][3] = (float)(((5 - i) * a0 + i * a1) / 5);
+        palette[6][3] = 0.f;
+        palette[7][3] = 255.f;
+    }
+}
+
+// 8 bytes: the alpha half of BC3, always in 8 value mode unless the block is uniform
+void encode_alpha_block(block_pixels const & block, std::uint8_t * output)
+{
+    float const * alpha = block.channel[3];
+    int a0 = (int)*std::max_element(alpha, alpha + 16);
+    int a1 = (int)*std::min_element(alpha, alpha + 16);
+
+    float palette[8][4] = {};
+    alpha_palette(a0, a1, palette);
+
+    std::uint8_t indices[16] = {};
+    if (a0 != a1)
+        fit_indices(block, palette, 8, 3, 1, indices);
+
+    std::memset(output, 0, 8);
+    bit_writer writer{output};
+    writer.put(a0, 8);
+    writer.put(a1, 8);
+    for (int i = 0; i < 16; ++i)
+        writer.put(indices[i], 3);
+}
+
+void decode_alpha_block(std::uint8_t const * input, std::uint8_t * pixels)
+{
+    bit_reader reader{input};
+    int a0 = (int)reader.get(8);
+    int a1 = (int)reader.get(8);
+
+    float palette[8][4] = {};
+    alpha_palette(a0, a1, palette);
+    for (int i = 0; i < 16; ++i)
+        pixels[4 * i + 3] = (std::uint8_t)palette[reader.get(3)][3];
+}
+
+// ---------------------------------------------------------------------------------------------- BC7
+
+int const bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+int bc7_interpolate(int e0, int e1, int index)
+{
+    return ((64 - bc7_weights[index]) * e0 + bc7_weights[index] * e1 + 32) >> 6;
+}
+
+// 7 bit endpoint plus a p-bit shared by its channels, the p-bit is chosen for the least error
+void quantize_bc7_endpoint(float const * endpoint, int * quantized, int & p_bit)
+{
+    float best_error = std::numeric_limits<float>::max();
+    for (int p = 0; p < 2; ++p)
+    {
+        int candidate[4];
+        float error = 0.f;
+        for (int c = 0; c < 4; ++c)
+        {
+            candidate[c] = std::clamp((int)std::lround((endpoint[c] - p) / 2.f), 0, 127);
+            float d = (float)(candidate[c] << 1 | p) - endpoint[c];
+            error += d * d;
+        }
+        if (error < best_error)
+        {
+            best_error = error;
+            p_bit = p;
+            std::copy(candidate, candidate + 4, quantized);
+        }
+    }
+}
+
+// 16 bytes in mode 6
+void encode_bc7_block(block_pixels const & block, std::uint8_t * output)
+{
+    float e0[4], e1[4];
+    principal_endpoints(block, 4, e0, e1);
+
+    float best_error = std::numeric_limits<float>::max();
+    int best_q0[4] = {}, best_q1[4] = {};
+    int best_p0 = 0, best_p1 = 0;
+    std::uint8_t best_indices[16] = {};
+
+    for (int iteration = 0; iteration < 3; ++iteration)
+    {
+        int q0[4], q1[4], p0, p1;
+        quantize_bc7_endpoint(e0, q0, p0);
+        quantize_bc7_endpoint(e1, q1, p1);
+
+        float palette[16][4];
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c)
+                palette[i][c] = (float)bc7_interpolate(q0[c] << 1 | p0, q1[c] << 1 | p1, i);
+
+        std::uint8_t indices[16];
+        float error = fit_indices(block, palette, 16, 0, 4, indices);
+        if (error < best_error)
+        {
+            best_error = error;
+            std::copy(q0, q0 + 4, best_q0);
+            std::copy(q1, q1 + 4, best_q1);
+            best_p0 = p0;
+            best_p1 = p1;
+            std::memcpy(best_indices, indices, sizeof(indices));
+        }
+        if (error == 0.f)
+            break;
+
+        float pixel_weights[16];
+        for (int i = 0; i < 16; ++i)
+            pixel_weights[i] = bc7_weights[indices[i]] / 64.f;
+        if (!refine_endpoints(block, 0, 4, pixel_weights, e0, e1))
+            break;
+    }
+
+    // the first index is stored without its top bit, which must be zero
+    if (best_indices[0] & 8)
+    {
+        std::swap(best_q0, best_q1);
+        std::swap(best_p0, best_p1);
+        for (auto & index : best_indices)
+            index = (std::uint8_t)(15 - index);
+    }
+
+    std::memset(output, 0, 16);
+    bit_writer writer{output};
+    writer.put(1u << 6, 7);
+    for (int c = 0; c < 4; ++c)
+    {
+        writer.put(best_q0[c], 7);
+        writer.put(best_q1[c], 7);
+    }
+    writer.put(best_p0, 1);
+    writer.put(best_p1, 1);
+    for (int i = 0; i < 16; ++i)
+        writer.put(best_indices[i], i == 0 ? 3 : 4);
+}
+
+// only mode 6 is decoded, other modes come out black
+void decode_bc7_block(std::uint8_t const * input, std::uint8_t * pixels)
+{
+    std::memset(pixels, 0, 64);
+    bit_reader reader{input};
+    if (reader.get(7) != 1u << 6)
+        return;
+
+    int e0[4], e1[4];
+    for (int c = 0; c < 4; ++c)
+    {
+        e0[c] = (int)reader.get(7) << 1;
+        e1[c] = (int)reader.get(7) << 1;
+    }
+    int p0 = (int)reader.get(1), p1 = (int)reader.get(1);
+    for (int c = 0; c < 4; ++c)
+    {
+        e0[c] |= p0;
+        e1[c] |= p1;
+    }
+
+    for (int i = 0; i < 16; ++i)
+    {
+        int index = (int)reader.get(i == 0 ? 3 : 4);
+        for (int c = 0; c < 4; ++c)
+            pixels[4 * i + c] = (std::uint8_t)bc7_interpolate(e0[c], e1[c], index);
+    }
+}
+
+void encode_block(block_pixels const & block, block_format format, std::uint8_t * output)
+{
+    switch (format)
+    {
+    case block_format::bc1:
+        encode_color_block(block, output);
+        break;
+    case block_format::bc3:
+        encode_alpha_block(block, output);
+        encode_color_block(block, output + 8);
+        break;
+    case block_format::bc7:
+        encode_bc7_block(block, output);
+        break;
+    }
+}
+
+void decode_block(std::uint8_t const * input, block_format format, std::uint8_t * pixels)
+{
+    switch (format)
+    {
+    case block_format::bc1:
+        decode_color_block(input, true, pixels);
+        break;
+    case block_format::bc3:
+        decode_color_block(input + 8, false, pixels);
+        decode_alpha_block(input, pixels);
+        break;
+    case block_format::bc7:
+        decode_bc7_block(input, pixels);
+        break;
+    }
+}
+
+}
+
+std::size_t block_size(block_format format)
+{
+    return format == block_format::bc1 ? 8 : 16;
+}
+
+char const * format_name(block_format format)
+{
+    switch (format)
+    {
+    case block_format::bc1:
+        return "BC1";
+    case block_format::bc3:
+        return "BC3";
+    case block_format::bc7:
+        return "BC7";
+    }
+    return "unknown";
+}
+
+std::size_t compressed_size(block_format format, int width, int height)
+{
+    return (std::size_t)((width + 3) / 4) * ((height + 3) / 4) * block_size(format);
+}
+
+std::size_t compressed_texture::size() const
+{
+    std::size_t result = 0;
+    for (auto const & level : levels)
+        result += level.data.size();
+    return result;
+}
+
+compressed_texture_view compressed_texture::view() const
+{
+    compressed_texture_view result;
+    result.format = format;
+    for (auto const & level : levels)
+        result.levels.push_back({level.width, level.height, level.data});
+    return result;
+}
+
+std::size_t compressed_texture_view::size() const
+{
+    std::size_t result = 0;
+    for (auto const & level : levels)
+        result += level.data.size();
+    return result;
+}
+
+std::vector<std::uint8_t> encode_blocks(std::uint8_t const * rgba, int width, int height, block_format format,
+    thread_pool::thread_pool_t * pool)
+{
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    std::size_t size = block_size(format);
+    std::vector<std::uint8_t> result(compressed_size(format, width, height));
+
+    auto encode_rows = [&](std::size_t, std::size_t begin, std::size_t end)
+    {
+        block_pixels block;
+        for (std::size_t y = begin; y < end; ++y)
+        {
+            for (int x = 0; x < blocks_x; ++x)
+            {
+                load_block(rgba, width, height, x, (int)y, block);
+                encode_block(block, format, result.data() + (y * blocks_x + x) * size);
+            }
+        }
+    };
+
+    if (pool)
+        pool->parallel_for(blocks_y, 1, encode_rows);
+    else
+        encode_rows(0, 0, blocks_y);
+
+    return result;
+}
+
+std::vector<std::uint8_t> decode_blocks(std::uint8_t const * blocks, int width, int height, block_format format)
+{
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    std::size_t size = block_size(format);
+    std::vector<std::uint8_t> result(4 * (std::size_t)width * height);
+
+    std::uint8_t pixels[64];
+    for (int by = 0; by < blocks_y; ++by)
+    {
+        for (int bx = 0; bx < blocks_x; ++bx)
+        {
+            decode_block(blocks + ((std::size_t)by * blocks_x + bx) * size, format, pixels);
+            for (int y = 0; y < 4 && by * 4 + y < height; ++y)
+                for (int x = 0; x < 4 && bx * 4 + x < width; ++x)
+                    std::copy(pixels + 4 * (y * 4 + x), pixels + 4 * (y * 4 + x) + 4,
+                        result.data() + 4 * ((std::size_t)(by * 4 + y) * width + bx * 4 + x));
+        }
+    }
+
+    return result;
+}
+
+compressed_texture compress_texture(std::uint8_t const * rgba, int width, int height, block_format format,
+    mip_settings const & mips, thread_pool::thread_pool_t * pool)
+{
+    compressed_texture result;
+    result.format = format;
+
+    for (auto const & mip : generate_mips(rgba, width, height, mips, pool))
+    {
+        auto & level = result.levels.emplace_back();
+        level.width = mip.width;
+        level.height = mip.height;
+        level.data = encode_blocks(mip.data.data(), mip.width, mip.height, format, pool);
+    }
+
+    return result;
+}
+
+double compression_psnr(compressed_texture const & texture, std::uint8_t const * rgba)
+{
+    auto const & level = texture.levels.front();
+    std::vector<std::uint8_t> decoded = decode_blocks(level.data.data(), level.width, level.height, texture.format);
+
+    int channels = texture.format == block_format::bc1 ? 3 : 4;
+    double squared_error = 0.0;
+    std::size_t pixels = (std::size_t)level.width * level.height;
+    for (std::size_t i = 0; i < pixels; ++i)
+    {
+        for (int c = 0; c < channels; ++c)
+        {
+            double d = (double)decoded[4 * i + c] - rgba[4 * i + c];
+            squared_error += d * d;
+        }
+    }
+
+    double mse = squared_error / (pixels * channels);
+    if (mse == 0.0)
+        return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+block_format choose_block_format(std::filesystem::path const & path, std::uint8_t const * rgba, int width, int height)
+{
+    std::string name = path.filename().string();
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (name.find("normal") != std::string::npos)
+        return block_format::bc7;
+
+    std::size_t pixels = (std::size_t)width * height;
+    for (std::size_t i = 0; i < pixels; ++i)
+        if (rgba[4 * i + 3] != 255)
+            return block_format::bc3;
+
+    return block_format::bc1;
+}
+
+std::filesystem::path cooked_texture_path(std::filesystem::path const & source)
+{
+    std::filesystem::path result = source;
+    result += ".bctex";
+    return result;
+}
+
+void save_compressed_texture(compressed_texture const & texture, std::filesystem::path const & path)
+{
+    std::ofstream output(path, std::ios::binary);
+    if (!output)
+        throw std::runtime_error("can't write " + path.string());
+
+    write_compressed_texture(texture, output);
+}
+
+void write_compressed_texture(compressed_texture const & texture, std::ostream & output)
+{
+    std::uint32_t format = (std::uint32_t)texture.format;
+    std::uint32_t levels = (std::uint32_t)texture.levels.size();
+    output.write(cooked_magic, sizeof(cooked_magic));
+    output.write(reinterpret_cast<char const *>(&cooked_version), sizeof(cooked_version));
+    output.write(reinterpret_cast<char const *>(&format), sizeof(format));
+    output.write(reinterpret_cast<char const *>(&levels), sizeof(levels));
+    for (auto const & level : texture.levels)
+    {
+        output.write(reinterpret_cast<char const *>(&level.width), sizeof(level.width));
+        output.write(reinterpret_cast<char const *>(&level.height), sizeof(level.height));
+        output.write(reinterpret_cast<char const *>(level.data.data()), level.data.size());
+    }
+}
+
+bool view_compressed_texture(compressed_texture_view & view, std::span<std::byte const> bytes)
+{
+    auto read = [&](void * value, std::size_t size)
+    {
+        if (bytes.size() < size)
+            return false;
+        std::memcpy(value, bytes.data(), size);
+        bytes = bytes.subspan(size);
+        return true;
+    };
+
+    char magic[4];
+    std::uint32_t version, format, levels;
+    if (!read(magic, sizeof(magic)) || !read(&version, sizeof(version)) || !read(&format, sizeof(format)) || !read(&levels, sizeof(levels)))
+        return false;
+    if (std::memcmp(magic, cooked_magic, sizeof(magic)) != 0 || version != cooked_version || levels == 0 || levels > 32)
+        return false;
+    if (format != (std::uint32_t)block_format::bc1 && format != (std::uint32_t)block_format::bc3 && format != (std::uint32_t)block_format::bc7)
+        return false;
+
+    compressed_texture_view result;
+    result.format = (block_format)format;
+    for (std::uint32_t i = 0; i < levels; ++i)
+    {
+        auto & level = result.levels.emplace_back();
+        if (!read(&level.width, sizeof(level.width)) || !read(&level.height, sizeof(level.height)))
+            return false;
+        if (level.width <= 0 || level.height <= 0 || level.width > 16384 || level.height > 16384)
+            return false;
+
+        std::size_t size = compressed_size(result.format, level.width, level.height);
+        if (bytes.size() < size)
+            return false;
+        level.data = {reinterpret_cast<std::uint8_t const *>(bytes.data()), size};
+        bytes = bytes.subspan(size);
+    }
+
+    view = std::move(result);
+    return true;
+}
+
+bool load_compressed_texture(compressed_texture & texture, std::filesystem::path const & path,
+    std::filesystem::path const & source)
+{
+    std::error_code error;
+    auto cooked_time = std::filesystem::last_write_time(path, error);
+    if (error)
+        return false;
+    auto source_time = std::filesystem::last_write_time(source, error);
+    if (!error && cooked_time < source_time)
+        return false;
+
+    std::ifstream input(path, std::ios::binary);
+
+    char magic[4];
+    std::uint32_t version, format, levels;
+    input.read(magic, sizeof(magic));
+    input.read(reinterpret_cast<char *>(&version), sizeof(version));
+    input.read(reinterpret_cast<char *>(&format), sizeof(format));
+    input.read(reinterpret_cast<char *>(&levels), sizeof(levels));
+    if (!input || std::memcmp(magic, cooked_magic, sizeof(magic)) != 0 || version != cooked_version || levels == 0 || levels > 32)
+        return false;
+    if (format != (std::uint32_t)block_format::bc1 && format != (std::uint32_t)block_format::bc3 && format != (std::uint32_t)block_format::bc7)
+        return false;
+
+    compressed_texture result;
+    result.format = (block_format)format;
+    for (std::uint32_t i = 0; i < levels; ++i)
+    {
+        auto & level = result.levels.emplace_back();
+        input.read(reinterpret_cast<char *>(&level.width), sizeof(level.width));
+        input.read(reinterpret_cast<char *>(&level.height), sizeof(level.height));
+        if (!input || level.width <= 0 || level.height <= 0 || level.width > 16384 || level.height > 16384)
+            return false;
+
+        level.data.resize(compressed_size(result.format, level.width, level.height));
+        input.read(reinterpret_cast<char *>(level.data.data()), level.data.size());
+        if (!input)
+            return false;
+    }
+
+    texture = std::move(result);
+    return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <filesystem>
+#include <iosfwd>
+#include <vector>
+#include <span>
+#include <cstdint>
+
+#include "mip_chain.hpp"
+
+namespace thread_pool
+{
+struct thread_pool_t;
+}
+
+// GPU block-compressed formats, every 4x4 block of pixels takes a fixed number of bytes:
+// BC1 is RGB in 8 bytes, BC3 is RGBA in 16 (BC1 color plus an 8 byte alpha block), BC7 is RGBA in
+// 16 and is always written in mode 6 (one pair of RGBA endpoints, 4 bit indices).
+enum class block_format : std::uint32_t
+{
+    bc1 = 1,
+    bc3 = 3,
+    bc7 = 7,
+};
+
+std::size_t block_size(block_format format);
+char const * format_name(block_format format);
+
+// bytes of a width x height image, partial blocks at the edges are padded to full ones
+std::size_t compressed_size(block_format format, int width, int height);
+
+// Levels of a cooked texture without owning the blocks, e.g. inside the models pack.
+struct compressed_texture_view
+{
+    struct level
+    {
+        int width = 0;
+        int height = 0;
+        std::span<std::uint8_t const> data;
+    };
+
+    block_format format = block_format::bc1;
+    std::vector<level> levels;
+
+    std::size_t size() const;
+};
+
+struct compressed_texture
+{
+    struct level
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<std::uint8_t> data;
+    };
+
+    block_format format = block_format::bc1;
+
+    // full mip chain, level 0 first
+    std::vector<level> levels;
+
+    std::size_t size() const;
+
+    compressed_texture_view view() const;
+};
+
+// Encodes RGBA8 pixels into blocks. Endpoints are fit along the principal axis of every block and
+// refined by least squares, indices are searched four pixels at a time with SSE2 where available.
+// Rows of blocks are spread over the pool if there is one.
+std::vector<std::uint8_t> encode_blocks(std::uint8_t const * rgba, int width, int height, block_format format,
+    thread_pool::thread_pool_t * pool = nullptr);
+
+// back to RGBA8, for measuring the quality; BC1 decodes with opaque alpha
+std::vector<std::uint8_t> decode_blocks(std::uint8_t const * blocks, int width, int height, block_format format);
+
+// the mip chain is generated with `mips` and every level encoded
+compressed_texture compress_texture(std::uint8_t const * rgba, int width, int height, block_format format,
+    mip_settings const & mips, thread_pool::thread_pool_t * pool = nullptr);
+
+// PSNR of level 0 against the source in dB, over RGB for BC1 and over RGBA otherwise
+double compression_psnr(compressed_texture const & texture, std::uint8_t const * rgba);
+
+// BC7 for normal maps (by file name), BC3 for images with any transparency and BC1 for the rest.
+block_format choose_block_format(std::filesystem::path const & path, std::uint8_t const * rgba, int width, int height);
+
+// Cooked textures live next to their source, `box_albedo.jpg` is cooked into `box_albedo.jpg.bctex`.
+// Loading fails if the file is missing, older than `source` or damaged.
+std::filesystem::path cooked_texture_path(std::filesystem::path const & source);
+void save_compressed_texture(compressed_texture const & texture, std::filesystem::path const & path);
+bool load_compressed_texture(compressed_texture & texture, std::filesystem::path const & path,
+    std::filesystem::path const & source);
+
+// The format of the cooked files in a stream, and read back in place from memory holding one.
+void write_compressed_texture(compressed_texture const & texture, std::ostream & output);
+bool view_compressed_texture(compressed_texture_view & view, std::span<std::byte const> bytes);
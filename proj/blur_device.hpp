@@ -66,13 +66,13 @@ void main() {
 
 struct blur_device_t {
     GLuint texture, render_buffer, frame_buffer;
-    GLuint vertex_shader, fragment_shader, program;
+    GLuint program;
     GLuint render_result_location, mode_location, time_location;
     GLuint vao;
 
     blur_device_t(int width, int height) {
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        gl_state::cache().bind_texture(GL_TEXTURE_2D, texture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -88,9 +88,7 @@ struct blur_device_t {
 
         assert(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
         render_result_location = glGetUniformLocation(program, "render_result");
         mode_location = glGetUniformLocation(program, "mode");
@@ -100,7 +98,7 @@ struct blur_device_t {
     }
 
     void update_size(int width, int height) {
-        glBindTexture(GL_TEXTURE_2D, texture);
+        gl_state::cache().bind_texture(GL_TEXTURE_2D, texture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 
         glBindRenderbuffer(GL_RENDERBUFFER, render_buffer);
@@ -116,15 +114,15 @@ struct blur_device_t {
 
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
-        glUseProgram(program);
+        gl_state::cache().use_program(program);
         glUniform1i(render_result_location, 0);
         glUniform1i(mode_location, 0);
         glUniform1f(time_location, time);
         
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        gl_state::cache().active_texture(GL_TEXTURE0);
+        gl_state::cache().bind_texture(GL_TEXTURE_2D, texture);
 
-        glBindVertexArray(vao);
+        gl_state::cache().bind_vertex_array(vao);
         glDrawArrays(GL_TRIANGLES, 0, 6);
     }
 };
@@ -14,10 +14,9 @@ namespace board {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 const float A = 24.0;
 
@@ -59,13 +58,10 @@ void main() {
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform sampler2D albedo_texture;
 
-uniform vec3 light_direction;
-uniform vec3 light_color;
-uniform vec3 ambient_light_color;
-
 in vec3 position;
 in vec3 normal;
 in vec2 texcoord;
@@ -88,10 +84,9 @@ void main() {
 )";
 
 struct board_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
     
     GLuint texture_location;
@@ -104,31 +99,26 @@ struct board_t : entity::entity {
     board_t(int object_index) {
         (void)object_index;
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
         model_location = glGetUniformLocation(program, "model");
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
         texture_location = glGetUniformLocation(program, "albedo_texture");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
 
         glGenVertexArrays(1, &vao);
 
-        std::vector<std::uint32_t> pixels(size * size);
+        // black and white, one channel read back as gray
+        std::vector<std::uint8_t> pixels(size * size);
         for (int i = 0; i < size; i++) {
             for (int j = 0; j < size; j++) {
-                std::uint32_t colors[] = {0x00000000u, 0xFFFFFFFFu};
-                pixels[i * size + j] = colors[(i + j) % 2];
+                pixels[i * size + j] = (i + j) % 2 ? 255 : 0;
             }
         }
 
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        gl_state::cache().bind_texture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, size, size, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+        const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glGenerateMipmap(GL_TEXTURE_2D);
@@ -138,34 +128,17 @@ struct board_t : entity::entity {
         (void)time; (void)dt; (void)button_down;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)camera_position; (void)time;
-
+    void draw(const frame_uniforms::block_t &) {
         glm::mat4 model = glm::mat4(1.f);
         model = glm::scale(model, glm::vec3(scale));
 
-        glEnable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glDisable(GL_BLEND);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(light_color_location, 1, reinterpret_cast<const float*>(&light_color));
-        glUniform3fv(ambient_light_color_location, 1, reinterpret_cast<const float*>(&ambient_light_color));
-        glUniform1i(texture_location, 0);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::opaque, program, vao);
+        packet.state = render_queue::depth_test | render_queue::depth_write;
+        packet.textures[0] = {GL_TEXTURE_2D, texture};
+        packet.uniforms = render_queue_ptr->uniforms()
+            .set(model_location, model)
+            .set(texture_location, 0);
+        packet.draw_arrays(GL_TRIANGLE_STRIP, 0, 4);
     }
 };
 
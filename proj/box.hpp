@@ -7,6 +7,7 @@
 #include <string>
 
 #include "common_util.hpp"
+#include "asset_cache.hpp"
 
 #include "entity.hpp"
 
@@ -14,10 +15,9 @@ namespace box {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 const float A = 24.0;
 
@@ -65,16 +65,12 @@ void main() {
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform sampler2D albedo_texture;
 uniform sampler2D normal_texture;
 uniform sampler2D environment_texture;
 
-uniform vec3 light_direction;
-uniform vec3 light_color;
-uniform vec3 ambient_light_color;
-uniform vec3 camera_position;
-
 in vec3 position;
 in vec3 tangent;
 in vec3 normal;
@@ -106,90 +102,74 @@ void main() {
 )";
 
 struct box_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
     
     GLuint albedo_texture_location, normal_texture_location, environment_texture_location;
-    GLuint camera_position_location;
 
-    GLuint albedo_texture, normal_texture, environment_texture;
+    asset_cache::texture_handle_t albedo_texture, normal_texture, environment_texture;
 
     const float scale = 1.f;
     const float board_size = 24.f;
 
+    // A in the vertex shader, the textures span the wall once
+    const float wall_half_size = 24.f;
+
     box_t(int object_index) {
         (void)object_index;
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
         model_location = glGetUniformLocation(program, "model");
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
         albedo_texture_location = glGetUniformLocation(program, "albedo_texture");
         normal_texture_location = glGetUniformLocation(program, "normal_texture");
         environment_texture_location = glGetUniformLocation(program, "environment_texture");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
-        camera_position_location = glGetUniformLocation(program, "camera_position");
 
         glGenVertexArrays(1, &vao);
 
         std::string project_root = PROJECT_ROOT;
-        albedo_texture = load_texture(project_root + "/models/box/box_albedo.jpg");
-        normal_texture = load_texture(project_root + "/models/box/box_normal.jpg");
-        environment_texture = load_texture(project_root + "/models/box/environment.jpg");
+        albedo_texture = asset_cache::cache().texture(project_root + "/models/box/box_albedo.jpg");
+        normal_texture = asset_cache::cache().texture(project_root + "/models/box/box_normal.jpg", {.usage = texture_usage::normal});
+        environment_texture = asset_cache::cache().texture(project_root + "/models/box/environment.jpg");
     }
 
     void update_state(float time, float dt, std::map <SDL_Keycode, bool> &button_down) {
         (void)time; (void)dt; (void)button_down;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)time;
-
-        glEnable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glDisable(GL_BLEND);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<const float*>(&camera_position));
-        glUniform1i(albedo_texture_location, 0);
-        glUniform1i(normal_texture_location, 1);
-        glUniform1i(environment_texture_location, 2);
+    void draw(const frame_uniforms::block_t &frame) {
+        render_queue::uniform_range_t shared = render_queue_ptr->uniforms()
+            .set(albedo_texture_location, 0)
+            .set(normal_texture_location, 1)
+            .set(environment_texture_location, 2);
 
+        float pixels = 0.f;
         for (int i = 0; i < 4; i++) {
             glm::mat4 model = glm::mat4(1.f);
             model = glm::rotate(model, glm::pi<float>() / 2.f * i, {0.f, 1.f, 0.f});
             model = glm::translate(model, glm::vec3(0.f, 0.f, board_size));
             model = glm::scale(model, glm::vec3(scale));
 
-            glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
-
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, albedo_texture);
-
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, normal_texture);
-
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, environment_texture);
-
-            glBindVertexArray(vao);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            // textures are sharpest where the wall comes closest to the camera
+            glm::vec3 local = glm::inverse(model) * glm::vec4(frame.camera_position, 1.f);
+            glm::vec2 nearest = glm::clamp(glm::vec2(local), glm::vec2(-wall_half_size), glm::vec2(wall_half_size, 0.f));
+            float distance = glm::length(local - glm::vec3(nearest, 0.f)) * scale;
+            pixels = std::max(pixels, asset_cache::cache().projected_pixels(frame.projection, 2.f * wall_half_size * scale, distance));
+
+            render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::opaque, program, vao);
+            packet.state = render_queue::depth_test | render_queue::depth_write;
+            packet.textures = {{{GL_TEXTURE_2D, albedo_texture.get()}, {GL_TEXTURE_2D, normal_texture.get()}, {GL_TEXTURE_2D, environment_texture.get()}}};
+            packet.depth = render_queue_ptr->distance(glm::vec3(model[3]));
+            packet.shared_uniforms = shared;
+            packet.uniforms = render_queue_ptr->uniforms().set(model_location, model);
+            packet.draw_arrays(GL_TRIANGLE_STRIP, 0, 4);
         }
+
+        asset_cache::cache().request(albedo_texture, pixels);
+        asset_cache::cache().request(normal_texture, pixels);
+        asset_cache::cache().request(environment_texture, pixels);
     }
 };
 
@@ -15,9 +15,7 @@ namespace cloud {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
-
-uniform mat4 view;
-uniform mat4 projection;
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform vec3 bbox_min;
 uniform vec3 bbox_max;
@@ -35,10 +33,8 @@ void main()
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
-uniform vec3 camera_position;
-uniform vec3 light_direction;
-uniform vec3 light_color;
 uniform vec3 bbox_min;
 uniform vec3 bbox_max;
 uniform sampler3D tex;
@@ -160,10 +156,9 @@ static std::uint32_t cube_indices[] {
 };
 
 struct cloud_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
 
     const float scale = 1.f;
@@ -171,25 +166,18 @@ struct cloud_t : entity::entity {
     const glm::vec3 cloud_bbox_max{-1.f, 10.f, -2.f};
 
     GLuint bbox_min_location, bbox_max_location;
-    GLuint camera_position_location;
+    GLuint tex;
 
     cloud_t(int object_index) {
         (void)object_index;
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
         bbox_min_location = glGetUniformLocation(program, "bbox_min");
         bbox_max_location = glGetUniformLocation(program, "bbox_max");
-        camera_position_location = glGetUniformLocation(program, "camera_position");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
 
         glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
+        gl_state::cache().bind_vertex_array(vao);
 
         glGenBuffers(1, &vbo);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
@@ -205,15 +193,22 @@ struct cloud_t : entity::entity {
         const std::string project_root = PROJECT_ROOT;
         const std::string cloud_data_path = project_root + "/models/cloud/cloud.data";
 
+        // uploaded straight from the mapped pack if the volume is there
         std::vector <char> pixels(128 * 64 * 64);
-        std::ifstream input(cloud_data_path, std::ios::binary);
-        input.read(pixels.data(), pixels.size());
+        const char *volume = pixels.data();
+        const asset_pack::pack_file *pack = asset_pack::models();
+        auto packed = pack ? pack->find(cloud_data_path, asset_pack::entry_kind::raw) : std::nullopt;
+        if (packed && packed->data.size() == pixels.size()) {
+            volume = reinterpret_cast<const char *>(packed->data.data());
+        } else {
+            std::ifstream input(cloud_data_path, std::ios::binary);
+            input.read(pixels.data(), pixels.size());
+        }
 
-        GLuint tex;
         glGenTextures(1, &tex);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_3D, tex);
-        glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, 128, 64, 64, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+        gl_state::cache().active_texture(GL_TEXTURE0);
+        gl_state::cache().bind_texture(GL_TEXTURE_3D, tex);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, 128, 64, 64, 0, GL_RED, GL_UNSIGNED_BYTE, volume);
         glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -225,33 +220,19 @@ struct cloud_t : entity::entity {
         (void)time; (void)dt; (void)button_down;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)ambient_light_color;
-
-        glm::vec3 translation = glm::vec3(sin(time * .3f + glm::pi<float>()) * 2.f, 0.f, cos(time * .1f + glm::pi<float>()) * 3.f) * 5.f;
+    void draw(const frame_uniforms::block_t &frame) {
+        glm::vec3 translation = glm::vec3(sin(frame.time * .3f + glm::pi<float>()) * 2.f, 0.f, cos(frame.time * .1f + glm::pi<float>()) * 3.f) * 5.f;
         glm::vec3 cur_cloud_bbox_min = cloud_bbox_min + translation;
         glm::vec3 cur_cloud_bbox_max = cloud_bbox_max + translation;
 
-        glEnable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(bbox_min_location, 1, reinterpret_cast<const float*>(&cur_cloud_bbox_min));
-        glUniform3fv(bbox_max_location, 1, reinterpret_cast<const float*>(&cur_cloud_bbox_max));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<const float*>(&camera_position));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(light_color_location, 1, reinterpret_cast<const float*>(&light_color));
-
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, std::size(cube_indices), GL_UNSIGNED_INT, nullptr);
+        render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::transparent, program, vao);
+        packet.state = render_queue::depth_test | render_queue::depth_write | render_queue::blend;
+        packet.textures[0] = {GL_TEXTURE_3D, tex};
+        packet.depth = render_queue_ptr->distance((cur_cloud_bbox_min + cur_cloud_bbox_max) * .5f);
+        packet.uniforms = render_queue_ptr->uniforms()
+            .set(bbox_min_location, cur_cloud_bbox_min)
+            .set(bbox_max_location, cur_cloud_bbox_max);
+        packet.draw_elements(GL_TRIANGLES, std::size(cube_indices), GL_UNSIGNED_INT, 0);
     }
 };
 
@@ -3,62 +3,333 @@
 #include <GL/glew.h>
 
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <span>
+#include <cstring>
 #include <stdexcept>
+#include <compare>
 
 #include "stb_image.h"
+#include "block_compression.hpp"
+#include "mip_chain.hpp"
+#include "asset_pack.hpp"
+#include "gl_state.hpp"
+#include "frame_uniforms.hpp"
+#include "shader_cache.hpp"
 
 // ========================================================================================================
 
-GLuint create_shader(GLenum type, const char * source) {
-    GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
-    glCompileShader(result);
-    GLint status;
-    glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE) {
-        GLint info_log_length;
-        glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Shader compilation failed: " + info_log);
+inline GLenum gl_block_format(block_format format) {
+    switch (format) {
+        case block_format::bc1:
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case block_format::bc3:
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case block_format::bc7:
+            return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+    return GL_NONE;
+}
+
+// BC1 and BC3 come with EXT_texture_compression_s3tc on every desktop driver, BC7 needs GL 4.2 or ARB_bptc
+inline bool block_format_supported(block_format format) {
+    if (format == block_format::bc7) {
+        return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+    }
+    return GLEW_EXT_texture_compression_s3tc;
+}
+
+// The cooked texture of a file from the models pack, a view into the mapping that goes to the
+// driver without a copy, or else from its up to date .bctex, read into `storage`.
+inline bool find_cooked_texture(std::string const & path, compressed_texture & storage, compressed_texture_view & view) {
+    const asset_pack::pack_file *pack = asset_pack::models();
+    if (auto packed = pack ? pack->find(path, asset_pack::entry_kind::texture) : std::nullopt) {
+        return view_compressed_texture(view, packed->data);
+    }
+    if (!load_compressed_texture(storage, cooked_texture_path(path), path)) {
+        return false;
+    }
+    view = storage.view();
+    return true;
+}
+
+// What a texture holds, which decides the format it's stored in on the GPU. Cooked textures keep
+// their block format whatever the usage.
+enum class texture_usage {
+    // RGB8, or RGBA8 if any texel isn't opaque
+    color,
+    // the same as SRGB8 / SRGB8_ALPHA8, sampled back to linear
+    color_srgb,
+    // RGB8
+    normal,
+    // R8 from the red channel, swizzled to read (r, r, r, 1) like the gray image it comes from
+    mask,
+    // RG8, reads (r, g, 0, 1)
+    two_channel,
+};
+
+// Everything besides the path that changes the texture made from a file.
+struct texture_params_t {
+    bool mipmaps = true;
+    texture_usage usage = texture_usage::color;
+
+    auto operator<=>(const texture_params_t &) const = default;
+};
+
+inline GLenum channels_format(int channels) {
+    const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    return formats[channels - 1];
+}
+
+inline GLenum channels_internal_format(int channels, bool srgb) {
+    const GLenum formats[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+    if (srgb && channels >= 3) {
+        return channels == 3 ? GL_SRGB8 : GL_SRGB8_ALPHA8;
+    }
+    return formats[channels - 1];
+}
+
+inline const char *channels_format_name(int channels, bool srgb) {
+    const char *names[] = {"R8", "RG8", srgb ? "SRGB8" : "RGB8", srgb ? "SRGB8_ALPHA8" : "RGBA8"};
+    return names[channels - 1];
+}
+
+// keeps the first `channels` channels of every RGBA8 texel
+inline void pack_channels(std::vector <mip_level> &levels, int channels) {
+    if (channels == 4) {
+        return;
+    }
+    for (auto &level : levels) {
+        std::size_t texels = level.data.size() / 4;
+        for (std::size_t i = 0; i < texels; i++) {
+            for (int c = 0; c < channels; c++) {
+                level.data[i * channels + c] = level.data[i * 4 + c];
+            }
+        }
+        level.data.resize(texels * channels);
     }
-    return result;
 }
 
-template <typename ... Shaders>
-GLuint create_program(Shaders ... shaders) {
-    GLuint result = glCreateProgram();
-    (glAttachShader(result, shaders), ...);
-    glLinkProgram(result);
+// A texture decoded on the CPU, ready for upload_texture: a cooked chain, or levels of `channels`
+// bytes per texel. The view points into the models pack or into `storage`, moving keeps it valid.
+struct decoded_texture_t {
+    bool compressed = false;
+    compressed_texture_view view;
+    compressed_texture storage;
+
+    std::vector <mip_level> levels;
+    int channels = 4;
+    bool srgb = false;
 
-    GLint status;
-    glGetProgramiv(result, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE) {
-        GLint info_log_length;
-        glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Program linkage failed: " + info_log);
+    std::size_t levels_cnt() const {
+        return compressed ? view.levels.size() : levels.size();
     }
 
+    int width(std::size_t level) const {
+        return compressed ? view.levels[level].width : levels[level].width;
+    }
+
+    int height(std::size_t level) const {
+        return compressed ? view.levels[level].height : levels[level].height;
+    }
+
+    // what the level takes in video memory
+    std::size_t level_bytes(std::size_t level) const {
+        return compressed ? view.levels[level].data.size() : channels * (std::size_t)levels[level].width * levels[level].height;
+    }
+
+    // what the whole chain would take as RGBA8, for comparison
+    std::size_t rgba8_bytes() const {
+        std::size_t result = 0;
+        for (std::size_t level = 0; level < levels_cnt(); level++) {
+            result += 4 * (std::size_t)width(level) * height(level);
+        }
+        return result;
+    }
+
+    const char *format_name() const {
+        return compressed ? ::format_name(view.format) : channels_format_name(channels, srgb);
+    }
+
+    // what the decoded levels take in system memory, views into the models pack take nothing
+    std::size_t system_bytes() const {
+        std::size_t result = 0;
+        for (const auto &level : storage.levels) {
+            result += level.data.size();
+        }
+        for (const auto &level : levels) {
+            result += level.data.size();
+        }
+        return result;
+    }
+
+    // levels from `first` on
+    std::size_t bytes(std::size_t first = 0) const {
+        std::size_t result = 0;
+        for (std::size_t level = first; level < levels_cnt(); level++) {
+            result += level_bytes(level);
+        }
+        return result;
+    }
+};
+
+// Prefers the texture cooked into the models pack, then the one cooked by texture-cook if it is up
+// to date, each if the driver takes its format, then a mip chain generated earlier (see
+// cached_mips_path), and generates and caches one otherwise. No GL calls, safe on any thread. A
+// missing file makes an empty level, which samples as black.
+inline decoded_texture_t decode_texture(std::string const & path, texture_params_t const & params = {},
+    thread_pool::thread_pool_t * pool = nullptr) {
+    decoded_texture_t result;
+    if (find_cooked_texture(path, result.storage, result.view) && block_format_supported(result.view.format)) {
+        if (!params.mipmaps) {
+            result.view.levels.resize(1);
+        }
+        result.compressed = true;
+        return result;
+    }
+
+    mip_settings settings = mip_settings_for(path);
+    if (!params.mipmaps || !load_mips(result.levels, settings, cached_mips_path(path), path)) {
+        int width = 0, height = 0, channels;
+        auto pixels = stbi_load(path.data(), &width, &height, &channels, 4);
+        if (!pixels) {
+            result.levels = {mip_level{width, height, {}}};
+        } else if (params.mipmaps) {
+            result.levels = generate_mips(pixels, width, height, settings, pool);
+            save_mips(result.levels, settings, cached_mips_path(path));
+        } else {
+            result.levels = {mip_level{width, height, std::vector <std::uint8_t>(pixels, pixels + 4 * (std::size_t)width * height)}};
+        }
+        stbi_image_free(pixels);
+    }
+
+    switch (params.usage) {
+        case texture_usage::color:
+        case texture_usage::color_srgb: {
+            const auto &data = result.levels[0].data;
+            bool opaque = true;
+            for (std::size_t i = 3; i < data.size() && opaque; i += 4) {
+                opaque = data[i] == 255;
+            }
+            result.channels = opaque ? 3 : 4;
+            result.srgb = params.usage == texture_usage::color_srgb;
+            break;
+        }
+        case texture_usage::normal:
+            result.channels = 3;
+            break;
+        case texture_usage::mask:
+            result.channels = 1;
+            break;
+        case texture_usage::two_channel:
+            result.channels = 2;
+            break;
+    }
+    pack_channels(result.levels, result.channels);
     return result;
 }
 
-// ========================================================================================================
+// Uploads levels [first, end) (all of them by default) into the bound GL_TEXTURE_2D, replacing what
+// they held. With a pixel buffer the levels are copied into it first and the driver takes them
+// from there, so that the copy into video memory may overlap with the rest of the frame instead of
+// happening inside glTexImage2D.
+inline void upload_texture(decoded_texture_t const & texture, GLuint pixel_buffer = 0, std::size_t first = 0, std::size_t end = -1) {
+    std::size_t levels_cnt = texture.levels_cnt();
+    end = std::min(end, levels_cnt);
+
+    auto level_data = [&](std::size_t level) -> std::span <const std::uint8_t> {
+        if (texture.compressed) {
+            return texture.view.levels[level].data;
+        }
+        return texture.levels[level].data;
+    };
 
-GLuint load_texture(std::string const & path) {
-    int width, height, channels;
-    auto pixels = stbi_load(path.data(), &width, &height, &channels, 4);
+    // offsets into the pixel buffer, or the levels themselves without one
+    std::vector <const std::uint8_t *> sources(levels_cnt);
+    for (std::size_t level = first; level < end; level++) {
+        sources[level] = level_data(level).empty() ? nullptr : level_data(level).data();
+    }
 
+    if (pixel_buffer) {
+        std::size_t total = 0;
+        for (std::size_t level = first; level < end; level++) {
+            total += level_data(level).size();
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, total, nullptr, GL_STREAM_DRAW);
+        auto mapped = total ? static_cast<std::uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total, \
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)) : nullptr;
+        if (mapped) {
+            std::size_t offset = 0;
+            for (std::size_t level = first; level < end; level++) {
+                auto data = level_data(level);
+                std::memcpy(mapped + offset, data.data(), data.size());
+                sources[level] = data.empty() ? nullptr : reinterpret_cast<const std::uint8_t *>(offset);
+                offset += data.size();
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        } else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            pixel_buffer = 0;
+        }
+    }
+
+    // rows of fewer than 4 channels aren't padded to 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (std::size_t level = first; level < end; level++) {
+        if (texture.compressed) {
+            const auto &data = texture.view.levels[level];
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, gl_block_format(texture.view.format), data.width, data.height, 0, \
+                data.data.size(), sources[level]);
+        } else {
+            const auto &data = texture.levels[level];
+            glTexImage2D(GL_TEXTURE_2D, level, channels_internal_format(texture.channels, texture.srgb), data.width, data.height, 0, \
+                channels_format(texture.channels), GL_UNSIGNED_BYTE, sources[level]);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_cnt - 1);
+    if (!texture.compressed && texture.channels == 1) {
+        const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    if (pixel_buffer) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+}
+
+// Frees levels [0, end) of the bound GL_TEXTURE_2D by making them empty; GL_TEXTURE_BASE_LEVEL has
+// to be at `end` or above first, levels under it don't count for completeness.
+inline void release_texture_levels(decoded_texture_t const & texture, std::size_t end) {
+    for (std::size_t level = 0; level < end; level++) {
+        if (texture.compressed) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, gl_block_format(texture.view.format), 0, 0, 0, 0, nullptr);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, level, channels_internal_format(texture.channels, texture.srgb), 0, 0, 0, \
+                channels_format(texture.channels), GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+}
+
+// Decodes and uploads the texture right away, see decode_texture. `bytes` receives the size of the
+// texture in video memory. Entities go through asset_cache, which doesn't load a file twice and
+// loads in the background.
+GLuint load_texture(std::string const & path, texture_params_t const & params = {}, std::size_t * bytes = nullptr,
+    thread_pool::thread_pool_t * pool = nullptr) {
     GLuint result;
     glGenTextures(1, &result);
-    glBindTexture(GL_TEXTURE_2D, result);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    gl_state::cache().bind_texture(GL_TEXTURE_2D, result);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, params.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
 
-    stbi_image_free(pixels);
+    decoded_texture_t texture = decode_texture(path, params, pool);
+    upload_texture(texture);
 
+    if (bytes) {
+        *bytes = texture.bytes();
+    }
     return result;
-}
\ No newline at end of file
+}
@@ -3,9 +3,16 @@
 #include <GL/glew.h>
 
 #include "gltf_loader.hpp"
+#include "render_queue.hpp"
+#include "task_graph.hpp"
+#include "frame_pipeline.hpp"
+#include "frame_uniforms.hpp"
 
 namespace entity {
 
+// stands for the button_down map: its operator[] inserts missing keys, so even reading it is a write
+inline const char button_down_resource = 0;
+
 struct entity {
     struct gltf_mesh {
         GLuint vao;
@@ -22,21 +29,37 @@ struct entity {
         }
     };
 
-    GLuint vertex_shader, fragment_shader, program;
-    GLuint model_location, view_location, projection_location;
+    GLuint program;
+    GLuint model_location;
     GLuint vao, vbo, ebo;
 
     std::uint32_t indices_count;
 
-    GLuint light_direction_location, light_color_location, ambient_light_color_location;
+    // state update_state() uses besides the entity's own, updates run in parallel unless they conflict on it
+    std::vector <task_graph::resource_t> update_reads, update_writes;
+
+    // draw() submits packets here instead of issuing GL calls, main replays them sorted
+    render_queue::render_queue_t *render_queue_ptr = nullptr;
+
+    // snapshot draw() reads from, set on the GL thread before the entities draw
+    std::size_t drawn_slot = 0;
 
     virtual void update_state(float time, float dt, std::map <SDL_Keycode, bool> &button_down) = 0;
 
-    virtual void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) = 0;
+    // Runs on the simulation thread after every update: copies the state draw() reads into snapshot
+    // `slot`, while the GL thread may be drawing another one. Entities drawn from constants and the
+    // frame time have nothing to capture.
+    virtual void capture(std::size_t slot) {
+        (void)slot;
+    }
+
+    void select(std::size_t slot) {
+        drawn_slot = slot;
+    }
+
+    // `frame` is what frame_uniforms uploaded for this frame: shaders read camera and lighting from the
+    // uniform block, draw() only needs it for culling, texture requests and animation
+    virtual void draw(const frame_uniforms::block_t &frame) = 0;
 };
 
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <string>
 
 #include "common_util.hpp"
+#include "asset_cache.hpp"
 
 #include "entity.hpp"
 
@@ -14,6 +15,7 @@ namespace environment {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 const vec2 VERTICES[4] = vec2[4](
     vec2(1.0, 1.0),
@@ -22,9 +24,6 @@ const vec2 VERTICES[4] = vec2[4](
     vec2(-1.0, -1.0)
 );
 
-uniform mat4 view;
-uniform mat4 projection;
-
 out vec3 position;
 
 void main() {
@@ -42,9 +41,8 @@ void main() {
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
-uniform vec3 camera_position;
-uniform vec3 ambient_light_color;
 uniform sampler2D environment_texture;
 
 in vec3 position;
@@ -65,62 +63,43 @@ void main() {
 )";
 
 struct environment_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
     
-    GLuint camera_position_location, ambient_light_color_location, environment_texture_location;
+    GLuint environment_texture_location;
 
-    GLuint environment_texture;
+    asset_cache::texture_handle_t environment_texture;
 
     environment_t(int object_index) {
         (void)object_index;
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
-        camera_position_location = glGetUniformLocation(program, "camera_position");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
         environment_texture_location = glGetUniformLocation(program, "environment_texture");
 
         glGenVertexArrays(1, &vao);
 
         std::string project_root = PROJECT_ROOT;
-        environment_texture = load_texture(project_root + "/models/environment/HDR_040_Field_Bg.jpg");
+        environment_texture = asset_cache::cache().texture(project_root + "/models/environment/HDR_040_Field_Bg.jpg");
     }
 
     void update_state(float time, float dt, std::map <SDL_Keycode, bool> &button_down) {
         (void)time; (void)dt; (void)button_down;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)light_direction; (void)light_color; (void)time;
-
-        glDisable(GL_DEPTH_TEST);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<const float*>(&camera_position));
-        glUniform3fv(ambient_light_color_location, 1, reinterpret_cast<const float*>(&ambient_light_color));
-        glUniform1i(environment_texture_location, 0);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, environment_texture);
-
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-        glClear(GL_DEPTH_BUFFER_BIT);
+    void draw(const frame_uniforms::block_t &frame) {
+        // the panorama wraps around the camera, 2 pi radians across
+        asset_cache::cache().request(environment_texture, asset_cache::cache().projected_pixels(frame.projection, 2.f * glm::pi<float>(), 1.f));
+
+        // drawn first with the depth test (and so depth writes) off, everything else covers it
+        render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::background, program, vao);
+        packet.state = 0;
+        packet.textures[0] = {GL_TEXTURE_2D, environment_texture.get()};
+        packet.uniforms = render_queue_ptr->uniforms()
+            .set(environment_texture_location, 0);
+        packet.draw_arrays(GL_TRIANGLE_STRIP, 0, 4);
     }
 };
 
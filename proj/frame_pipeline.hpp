@@ -0,0 +1,275 @@
+#pragma once
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+namespace frame_pipeline {
+
+// a frame is simulated into one slot while the previous one is drawn from another, the third is
+// the one being handed over
+const std::size_t slots_cnt = 3;
+
+// Slot indices passed between one producer and one consumer without locks. The producer fills
+// back(), publish() swaps it with the middle slot; acquire() swaps the middle slot with front() if
+// something was published since. Each side only ever touches the slot it holds.
+struct triple_buffer_t {
+    std::size_t back() const {
+        return back_slot;
+    }
+
+    std::size_t front() const {
+        return front_slot;
+    }
+
+    void publish() {
+        back_slot = middle.exchange(back_slot | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    bool acquire() {
+        if (!(middle.load(std::memory_order_acquire) & fresh_bit)) {
+            return false;
+        }
+        front_slot = middle.exchange(front_slot, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+private:
+    static const std::uint8_t index_mask = 3, fresh_bit = 4;
+
+    std::size_t back_slot = 0, front_slot = 1;
+    std::atomic <std::uint8_t> middle{2};
+};
+
+// everything the simulation needs from the GL thread, sampled once per frame
+struct input_t {
+    std::map <SDL_Keycode, bool> button_down;
+    bool paused = false;
+    int width = 1, height = 1;
+    float dt = 0.f;
+    std::chrono::steady_clock::time_point sampled_at;
+};
+
+// The frame-wide part of a snapshot, entities keep their own part in the same slot.
+struct frame_t {
+    std::uint64_t index = 0;
+    float time = 0.f;
+
+    glm::mat4 view{1.f}, projection{1.f};
+    glm::vec3 camera_position{0.f};
+    glm::vec3 light_direction{0.f, 1.f, 0.f}, light_color{1.f}, ambient_light_color{0.f};
+
+    // when the input this frame was simulated from was sampled
+    std::chrono::steady_clock::time_point sampled_at;
+
+    double simulate_ms = 0.0;
+    std::vector <double> update_ms;     // of the update tasks, in the order of the graph
+};
+
+struct stats_t {
+    std::uint64_t frames = 0;
+    double simulate_ms = 0.0;
+
+    // the GL thread waiting for the simulation; with a serial pipeline that's the simulation itself
+    double wait_ms = 0.0;
+
+    // from sampling the input to presenting the frame simulated from it
+    double latency_ms = 0.0, max_latency_ms = 0.0;
+
+    void reset() {
+        *this = stats_t();
+    }
+
+    stats_t &operator+=(const stats_t &other) {
+        frames += other.frames;
+        simulate_ms += other.simulate_ms;
+        wait_ms += other.wait_ms;
+        latency_ms += other.latency_ms;
+        max_latency_ms = std::max(max_latency_ms, other.max_latency_ms);
+        return *this;
+    }
+};
+
+// Simulates frame N + 1 on its own thread while the GL thread draws frame N.
+//
+// simulate(input, frame, slot) advances the world, fills `frame` and has every entity capture what
+// its draw() reads into snapshot `slot`. The GL thread submits the input of a frame, acquires the
+// newest simulated frame and draws it from that slot. The simulation stops once it's a frame ahead,
+// so no frame is skipped and a frame is presented one frame later than in a serial loop: the input
+// of frame N is simulated while frame N - 1 is drawn and shown at the end of frame N + 1.
+//
+// A serial pipeline runs simulate() on the GL thread inside submit(), through the same slots.
+struct pipeline_t {
+    using simulate_t = std::function <void(const input_t &, frame_t &, std::size_t)>;
+
+    // print stats every this many frames, 0 disables reporting
+    int report_period = 600;
+
+    stats_t stats;
+    int frames_since_report = 0;
+
+    pipeline_t(bool threaded, simulate_t simulate) : threaded(threaded), simulate(std::move(simulate)) {
+    }
+
+    pipeline_t(const pipeline_t &) = delete;
+    pipeline_t &operator=(const pipeline_t &) = delete;
+
+    ~pipeline_t() {
+        if (thread.joinable()) {
+            stopping = true;
+            consumed.fetch_add(1);
+            consumed.notify_one();
+            thread.join();
+        }
+    }
+
+    bool is_threaded() const {
+        return threaded;
+    }
+
+    // GL thread, once per frame before acquire()
+    void submit(const input_t &input) {
+        inputs[input_slots.back()] = input;
+        input_slots.publish();
+
+        if (!threaded) {
+            step();
+        } else if (!thread.joinable()) {
+            thread = std::thread([this]() { simulation_loop(); });
+        }
+    }
+
+    // GL thread: waits for the next simulated frame and makes it current. An exception thrown by
+    // the simulation is rethrown here.
+    const frame_t &acquire() {
+        auto start = std::chrono::steady_clock::now();
+
+        if (threaded) {
+            for (std::uint64_t cnt; (cnt = produced.load()) <= consumed_cnt;) {
+                produced.wait(cnt);
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+        frame_slots.acquire();
+
+        if (threaded) {
+            consumed.store(++consumed_cnt);
+            consumed.notify_one();
+        }
+
+        const frame_t &current = frame();
+        stats.frames++;
+        stats.simulate_ms += current.simulate_ms;
+        stats.wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return current;
+    }
+
+    const frame_t &frame() const {
+        return frames[frame_slots.front()];
+    }
+
+    // the snapshot slot of the current frame
+    std::size_t slot() const {
+        return frame_slots.front();
+    }
+
+    // GL thread, right after the current frame was swapped to the screen
+    void presented() {
+        double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame().sampled_at).count();
+        stats.latency_ms += latency_ms;
+        stats.max_latency_ms = std::max(stats.max_latency_ms, latency_ms);
+
+        if (report_period > 0 && ++frames_since_report >= report_period) {
+            report(std::cerr);
+            stats.reset();
+            frames_since_report = 0;
+        }
+    }
+
+    void report(std::ostream &out) const {
+        double frames_cnt = std::max<std::uint64_t>(1, stats.frames);
+        out << "frame pipeline (" << (threaded ? "threaded" : "serial") << "): " \
+            << stats.simulate_ms / frames_cnt << " ms simulation/frame, " << stats.wait_ms / frames_cnt << " ms waited for it, " \
+            << "input to present " << stats.latency_ms / frames_cnt << " ms (max " << stats.max_latency_ms << " ms)" << std::endl;
+    }
+
+private:
+    bool threaded;
+    simulate_t simulate;
+
+    std::array <input_t, slots_cnt> inputs;
+    std::array <frame_t, slots_cnt> frames;
+    triple_buffer_t input_slots, frame_slots;
+
+    std::thread thread;
+    std::atomic <bool> stopping = false;
+    std::exception_ptr error;
+
+    // frames published by the simulation and taken by the GL thread
+    std::atomic <std::uint64_t> produced = 0, consumed = 0;
+    std::uint64_t produced_cnt = 0, consumed_cnt = 0;
+
+    void step() {
+        auto start = std::chrono::steady_clock::now();
+
+        // an input is simulated once, a step without a new one (only the first frame of a threaded
+        // pipeline) doesn't advance time
+        input_t &input = inputs[input_slots.front()];
+        if (!input_slots.acquire()) {
+            input.dt = 0.f;
+        }
+        const input_t &current = inputs[input_slots.front()];
+
+        frame_t &result = frames[frame_slots.back()];
+        result.index = produced_cnt;
+        result.sampled_at = current.sampled_at;
+        simulate(current, result, frame_slots.back());
+        result.simulate_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        frame_slots.publish();
+        produced_cnt++;
+    }
+
+    void simulation_loop() {
+        try {
+            while (true) {
+                // a frame ahead: wait until the GL thread takes the last one
+                for (std::uint64_t cnt; (cnt = consumed.load()) < produced_cnt && !stopping;) {
+                    consumed.wait(cnt);
+                }
+                if (stopping) {
+                    return;
+                }
+
+                step();
+                produced.store(produced_cnt);
+                produced.notify_one();
+            }
+        } catch (...) {
+            error = std::current_exception();
+            produced.store(++produced_cnt);
+            produced.notify_one();
+        }
+    }
+};
+
+}
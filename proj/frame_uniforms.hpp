@@ -0,0 +1,84 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <cstddef>
+
+namespace frame_uniforms {
+
+// Camera and lighting shared by every program, uploaded once per frame. Shaders splice the block
+// in right after the version line:
+//     R"(#version 330 core
+//     )" FRAME_UNIFORMS_GLSL R"(
+//     ...
+// and shader_cache binds it to `binding`.
+#define FRAME_UNIFORMS_GLSL \
+    "\n" \
+    "layout (std140) uniform frame_uniforms {\n" \
+    "    mat4 view;\n" \
+    "    mat4 projection;\n" \
+    "    vec3 camera_position;\n" \
+    "    float time;\n" \
+    "    vec3 light_direction;\n" \
+    "    vec3 light_color;\n" \
+    "    vec3 ambient_light_color;\n" \
+    "};\n"
+
+const GLuint binding = 0;
+
+// std140 layout of the block: a vec3 takes 16 bytes unless a float fills its last 4
+struct block_t {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 camera_position;
+    float time;
+    glm::vec3 light_direction;
+    float padding0;
+    glm::vec3 light_color;
+    float padding1;
+    glm::vec3 ambient_light_color;
+    float padding2;
+};
+
+static_assert(offsetof(block_t, camera_position) == 128);
+static_assert(offsetof(block_t, time) == 140);
+static_assert(offsetof(block_t, light_direction) == 144);
+static_assert(offsetof(block_t, light_color) == 160);
+static_assert(offsetof(block_t, ambient_light_color) == 176);
+static_assert(sizeof(block_t) == 192);
+
+struct frame_uniforms_t {
+    GLuint ubo;
+    block_t data;
+
+    frame_uniforms_t() {
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(block_t), nullptr, GL_STREAM_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    }
+
+    // Orphans the previous frame's storage, so the upload never waits for draws still reading it.
+    void update(
+        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
+        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
+        float time
+    ) {
+        data.view = view;
+        data.projection = projection;
+        data.camera_position = camera_position;
+        data.time = time;
+        data.light_direction = light_direction;
+        data.light_color = light_color;
+        data.ambient_light_color = ambient_light_color;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(block_t), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block_t), &data);
+    }
+};
+
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+namespace gl_state {
+
+enum call_t {
+    capability,
+    depth_mask,
+    cull_face,
+    blend_func,
+    active_texture,
+    bind_texture,
+    bind_vertex_array,
+    use_program,
+    calls_cnt,
+};
+
+inline const char *call_name(int call) {
+    static const char *names[calls_cnt] = {
+        "glEnable/glDisable", "glDepthMask", "glCullFace", "glBlendFunc",
+        "glActiveTexture", "glBindTexture", "glBindVertexArray", "glUseProgram",
+    };
+    return names[call];
+}
+
+struct stats_t {
+    std::array <std::uint64_t, calls_cnt> issued{}, elided{};
+
+    std::uint64_t total_issued() const {
+        std::uint64_t result = 0;
+        for (auto cnt : issued) {
+            result += cnt;
+        }
+        return result;
+    }
+
+    std::uint64_t total_elided() const {
+        std::uint64_t result = 0;
+        for (auto cnt : elided) {
+            result += cnt;
+        }
+        return result;
+    }
+
+    void reset() {
+        *this = stats_t();
+    }
+
+    stats_t &operator+=(const stats_t &other) {
+        for (int i = 0; i < calls_cnt; i++) {
+            issued[i] += other.issued[i];
+            elided[i] += other.elided[i];
+        }
+        return *this;
+    }
+};
+
+// Shadow copy of the binding and capability state, a call that wouldn't change anything isn't
+// passed to the driver. Every state starts unknown, so the first call always goes through.
+//
+// All of proj changes this state only through cache(), code that calls GL directly must call
+// invalidate() afterwards. The driver unbinds a texture, VAO or program it deletes behind the
+// cache's back: textures are deleted through delete_texture(), proj never deletes the others.
+struct state_cache_t {
+    // print stats every this many frames, 0 disables reporting
+    int report_period = 600;
+
+    stats_t stats, frame_stats;
+    int frames_since_report = 0;
+
+    state_cache_t() {
+        invalidate();
+    }
+
+    state_cache_t(const state_cache_t &) = delete;
+    state_cache_t &operator=(const state_cache_t &) = delete;
+
+    void set(GLenum cap, bool enabled) {
+        auto it = std::find_if(capabilities.begin(), capabilities.end(), [&](const auto &entry) {
+            return entry.first == cap;
+        });
+        if (it == capabilities.end()) {
+            capabilities.push_back({cap, unknown});
+            it = capabilities.end() - 1;
+        }
+
+        if (change(capability, it->second, (int)enabled)) {
+            if (enabled) {
+                glEnable(cap);
+            } else {
+                glDisable(cap);
+            }
+        }
+    }
+
+    void enable(GLenum cap) {
+        set(cap, true);
+    }
+
+    void disable(GLenum cap) {
+        set(cap, false);
+    }
+
+    void depth_mask(GLboolean flag) {
+        if (change(gl_state::depth_mask, current_depth_mask, (int)flag)) {
+            glDepthMask(flag);
+        }
+    }
+
+    void cull_face(GLenum mode) {
+        if (change(gl_state::cull_face, current_cull_face, mode)) {
+            glCullFace(mode);
+        }
+    }
+
+    void blend_func(GLenum src, GLenum dst) {
+        if (change(gl_state::blend_func, current_blend_func, std::make_pair(src, dst))) {
+            glBlendFunc(src, dst);
+        }
+    }
+
+    // takes GL_TEXTUREi like glActiveTexture
+    void active_texture(GLenum texture) {
+        if (change(gl_state::active_texture, current_unit, texture - GL_TEXTURE0)) {
+            glActiveTexture(texture);
+        }
+    }
+
+    // binds to the active unit; units and targets the cache doesn't track always go through
+    void bind_texture(GLenum target, GLuint texture) {
+        int target_index = texture_target_index(target);
+        if (current_unit >= max_units || target_index < 0) {
+            frame_stats.issued[gl_state::bind_texture]++;
+            glBindTexture(target, texture);
+            return;
+        }
+
+        if (change(gl_state::bind_texture, current_textures[current_unit][target_index], texture)) {
+            glBindTexture(target, texture);
+        }
+    }
+
+    // binds to the given unit, switching the active unit only if the binding changes
+    void bind_texture_unit(GLuint unit, GLenum target, GLuint texture) {
+        int target_index = texture_target_index(target);
+        if (unit < max_units && target_index >= 0 && current_textures[unit][target_index] == texture) {
+            frame_stats.elided[gl_state::bind_texture]++;
+            return;
+        }
+
+        active_texture(GL_TEXTURE0 + unit);
+        bind_texture(target, texture);
+    }
+
+    // GL unbinds the texture from every unit and may hand its name out again, a later bind of the
+    // new texture mustn't be elided
+    void delete_texture(GLuint texture) {
+        for (auto &unit : current_textures) {
+            for (GLuint &bound : unit) {
+                if (bound == texture) {
+                    bound = unknown;
+                }
+            }
+        }
+        glDeleteTextures(1, &texture);
+    }
+
+    void bind_vertex_array(GLuint array) {
+        if (change(gl_state::bind_vertex_array, current_vao, array)) {
+            glBindVertexArray(array);
+        }
+    }
+
+    void use_program(GLuint program) {
+        if (change(gl_state::use_program, current_program, program)) {
+            glUseProgram(program);
+        }
+    }
+
+    // forget everything, the next call of every kind is issued
+    void invalidate() {
+        for (auto &entry : capabilities) {
+            entry.second = unknown;
+        }
+        current_depth_mask = unknown;
+        current_cull_face = unknown;
+        current_blend_func = {unknown, unknown};
+        current_unit = unknown;
+        for (auto &unit : current_textures) {
+            unit.fill(unknown);
+        }
+        current_vao = unknown;
+        current_program = unknown;
+    }
+
+    void end_frame() {
+        stats += frame_stats;
+        frame_stats.reset();
+
+        if (report_period > 0 && ++frames_since_report >= report_period) {
+            report(std::cerr);
+            stats.reset();
+            frames_since_report = 0;
+        }
+    }
+
+    void report(std::ostream &out) const {
+        std::uint64_t frames = std::max(1, frames_since_report);
+        out << "gl state: " << stats.total_issued() / frames << " calls/frame issued, " \
+            << stats.total_elided() / frames << " elided" << std::endl;
+        for (int i = 0; i < calls_cnt; i++) {
+            if (stats.issued[i] + stats.elided[i] > 0) {
+                out << "  " << call_name(i) << ": " << stats.issued[i] / frames << " issued, " \
+                    << stats.elided[i] / frames << " elided" << std::endl;
+            }
+        }
+    }
+
+private:
+    static constexpr GLuint unknown = ~0u;
+    static constexpr GLuint max_units = 16;
+
+    std::vector <std::pair <GLenum, GLuint>> capabilities;
+    GLuint current_depth_mask, current_cull_face;
+    std::pair <GLuint, GLuint> current_blend_func;
+    GLuint current_unit;
+    std::array <std::array <GLuint, 4>, max_units> current_textures;
+    GLuint current_vao, current_program;
+
+    static int texture_target_index(GLenum target) {
+        switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        case GL_TEXTURE_3D: return 2;
+        case GL_TEXTURE_CUBE_MAP: return 3;
+        default: return -1;
+        }
+    }
+
+    template <typename T, typename U>
+    bool change(call_t call, T &current, const U &value) {
+        if (current == (T)value) {
+            frame_stats.elided[call]++;
+            return false;
+        }
+        current = (T)value;
+        frame_stats.issued[call]++;
+        return true;
+    }
+};
+
+// The GL context is global to the process and so is its shadow state.
+inline state_cache_t &cache() {
+    static state_cache_t instance;
+    return instance;
+}
+
+}
@@ -1,4 +1,5 @@
 #include "gltf_loader.hpp"
+#include "asset_pack.hpp"
 
 #include <rapidjson/document.h>
 #include <rapidjson/istreamwrapper.h>
@@ -20,6 +21,14 @@ gltf_model load_gltf(std::filesystem::path const & path)
 {
     rapidjson::Document document;
 
+    auto const * pack = asset_pack::models();
+
+    if (auto packed = pack ? pack->find(path, asset_pack::entry_kind::raw) : std::nullopt)
+    {
+        auto const text = packed->text();
+        document.Parse(text.data(), text.size());
+    }
+    else
     {
         std::ifstream input(path, std::ios::binary);
         rapidjson::IStreamWrapper stream(input);
@@ -36,9 +45,17 @@ gltf_model load_gltf(std::filesystem::path const & path)
 
         auto const buffer_path = path.parent_path() / buffer_uri;
 
-        result.buffer.resize(std::filesystem::file_size(buffer_path));
-        std::ifstream buffer(buffer_path, std::ios::binary);
-        buffer.read(result.buffer.data(), result.buffer.size());
+        if (auto packed = pack ? pack->find(buffer_path, asset_pack::entry_kind::raw) : std::nullopt)
+        {
+            result.buffer = {reinterpret_cast<char const *>(packed->data.data()), packed->data.size()};
+        }
+        else
+        {
+            result.storage.resize(std::filesystem::file_size(buffer_path));
+            std::ifstream buffer(buffer_path, std::ios::binary);
+            buffer.read(result.storage.data(), result.storage.size());
+            result.buffer = result.storage;
+        }
     }
 
     auto parse_buffer_view = [&](int index) -> gltf_model::buffer_view
@@ -2,6 +2,7 @@
 
 #include <filesystem>
 #include <vector>
+#include <span>
 #include <string>
 #include <optional>
 #include <unordered_map>
@@ -16,6 +17,14 @@
 
 struct gltf_model
 {
+    gltf_model() = default;
+
+    // `buffer` may point into `storage`
+    gltf_model(gltf_model const &) = delete;
+    gltf_model(gltf_model &&) = default;
+    gltf_model & operator = (gltf_model const &) = delete;
+    gltf_model & operator = (gltf_model &&) = default;
+
     struct buffer_view
     {
         unsigned int offset;
@@ -86,12 +95,16 @@ struct gltf_model
         glm::vec3 max;
     };
 
-    std::vector<char> buffer;
+    // the binary buffer, read into `storage` or a view into the models pack (see asset_pack.hpp)
+    std::span<char const> buffer;
+    std::vector<char> storage;
+
     std::vector<mesh> meshes;
     std::vector<bone> bones;
     std::unordered_map<std::string, animation> animations;
 };
 
+// Takes the JSON and the buffer from the models pack when they are packed, from the files otherwise.
 gltf_model load_gltf(std::filesystem::path const & path);
 
 template <>
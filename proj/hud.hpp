@@ -46,10 +46,9 @@ void main() {
 )";
 
 struct hud_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
 
     roses::roses_t *roses_ptr;
@@ -60,10 +59,9 @@ struct hud_t : entity::entity {
         (void)object_index;
 
         roses_ptr = roses;
+        update_reads.push_back(static_cast<entity *>(roses));
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
         position_location = glGetUniformLocation(program, "position");
         width_height_location = glGetUniformLocation(program, "width_height");
@@ -76,42 +74,22 @@ struct hud_t : entity::entity {
         (void)time; (void)dt; (void)button_down;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)view; (void)projection; (void)camera_position;
-        (void)light_direction; (void)light_color; (void)ambient_light_color;
-        (void)time;
-
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-        glUseProgram(program);
-        
-        glUniform2f(position_location, -.005f, 1.f - .15f);
-        glUniform2f(width_height_location, .01f, .1f);
-        glUniform3f(color_location, 0.f, 1.f, 0.f);
-
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-        glUniform2f(position_location, -1.f, 1.f - .15f);
-        glUniform2f(width_height_location, 2.f * roses_ptr->roses_by_player / (float)roses_ptr->roses_cnt, .1f);
-        glUniform3f(color_location, 0.f, 0.f, 1.f);
-
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-        glUniform2f(position_location, 1.f, 1.f - .15f);
-        glUniform2f(width_height_location, -2.f * roses_ptr->roses_by_mouse / (float)roses_ptr->roses_cnt, .1f);
-        glUniform3f(color_location, 1.f, 0.f, 0.f);
-
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    void draw(const frame_uniforms::block_t &) {
+        auto bar = [&](const glm::vec2 &position, const glm::vec2 &width_height, const glm::vec3 &color) {
+            render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::overlay, program, vao);
+            packet.state = render_queue::blend;
+            packet.uniforms = render_queue_ptr->uniforms()
+                .set(position_location, position)
+                .set(width_height_location, width_height)
+                .set(color_location, color);
+            packet.draw_arrays(GL_TRIANGLE_STRIP, 0, 4);
+        };
+
+        bar({-.005f, 1.f - .15f}, {.01f, .1f}, {0.f, 1.f, 0.f});
+        // roses captured the same slot
+        const roses::roses_t::snapshot_t &roses = roses_ptr->snapshots[drawn_slot];
+        bar({-1.f, 1.f - .15f}, {2.f * roses.roses_by_player / (float)roses_ptr->roses_cnt, .1f}, {0.f, 0.f, 1.f});
+        bar({1.f, 1.f - .15f}, {-2.f * roses.roses_by_mouse / (float)roses_ptr->roses_cnt, .1f}, {1.f, 0.f, 0.f});
     }
 };
 
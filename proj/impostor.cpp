@@ -0,0 +1,442 @@
+#include "impostor.hpp"
+
+#include "stb_image.h"
+
+#include <GL/glew.h>
+
+#include <glm/geometric.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+
+namespace
+{
+
+struct texture
+{
+    int width = 0;
+    int height = 0;
+    std::vector<std::uint8_t> pixels;
+
+    // bilinear with repeat wrapping, glTF texcoords start at the top row just like the image data
+    glm::vec4 sample(glm::vec2 texcoord) const
+    {
+        float x = (texcoord.x - std::floor(texcoord.x)) * width - 0.5f;
+        float y = (texcoord.y - std::floor(texcoord.y)) * height - 0.5f;
+
+        int x0 = (int)std::floor(x);
+        int y0 = (int)std::floor(y);
+        float tx = x - x0;
+        float ty = y - y0;
+
+        auto texel = [&](int tx, int ty)
+        {
+            tx = (tx % width + width) % width;
+            ty = (ty % height + height) % height;
+            std::uint8_t const * p = pixels.data() + 4 * (ty * width + tx);
+            return glm::vec4(p[0], p[1], p[2], p[3]) / 255.f;
+        };
+
+        glm::vec4 top = glm::mix(texel(x0, y0), texel(x0 + 1, y0), tx);
+        glm::vec4 bottom = glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), tx);
+        return glm::mix(top, bottom, ty);
+    }
+};
+
+struct vertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texcoord;
+};
+
+struct triangle_list
+{
+    std::vector<vertex> vertices;
+    std::vector<std::uint32_t> indices;
+    texture const * albedo = nullptr;
+    glm::vec4 color{1.f};
+};
+
+template <typename T>
+T const * accessor_data(gltf_model const & model, gltf_model::accessor const & accessor)
+{
+    return reinterpret_cast<T const *>(model.buffer.data() + accessor.view.offset);
+}
+
+triangle_list read_mesh(gltf_model const & model, gltf_model::mesh const & mesh)
+{
+    if (mesh.position.type != GL_FLOAT || mesh.normal.type != GL_FLOAT)
+        throw std::runtime_error("Impostor baking supports only float positions and normals");
+
+    triangle_list result;
+    result.vertices.resize(mesh.position.count);
+
+    auto positions = accessor_data<glm::vec3>(model, mesh.position);
+    auto normals = accessor_data<glm::vec3>(model, mesh.normal);
+    for (std::size_t i = 0; i < result.vertices.size(); ++i)
+    {
+        result.vertices[i].position = positions[i];
+        result.vertices[i].normal = normals[i];
+        result.vertices[i].texcoord = glm::vec2(0.f);
+    }
+
+    if (mesh.texcoord && mesh.texcoord->type == GL_FLOAT)
+    {
+        auto texcoords = accessor_data<glm::vec2>(model, *mesh.texcoord);
+        for (std::size_t i = 0; i < result.vertices.size(); ++i)
+            result.vertices[i].texcoord = texcoords[i];
+    }
+
+    result.indices.resize(mesh.indices.count);
+    for (std::size_t i = 0; i < result.indices.size(); ++i)
+    {
+        switch (mesh.indices.type)
+        {
+        case GL_UNSIGNED_BYTE:
+            result.indices[i] = accessor_data<std::uint8_t>(model, mesh.indices)[i];
+            break;
+        case GL_UNSIGNED_SHORT:
+            result.indices[i] = accessor_data<std::uint16_t>(model, mesh.indices)[i];
+            break;
+        case GL_UNSIGNED_INT:
+            result.indices[i] = accessor_data<std::uint32_t>(model, mesh.indices)[i];
+            break;
+        default:
+            throw std::runtime_error("Unknown index type: " + std::to_string(mesh.indices.type));
+        }
+    }
+
+    if (mesh.material.color)
+        result.color = *mesh.material.color;
+
+    return result;
+}
+
+// direction from the model towards the viewer of the atlas cell
+glm::vec3 view_direction(impostor_atlas::settings const & settings, int azimuth, int elevation)
+{
+    float a = 2.f * glm::pi<float>() * azimuth / settings.azimuths;
+    float e = settings.elevations > 1 ? settings.max_elevation * elevation / (settings.elevations - 1) : 0.f;
+    return {std::cos(e) * std::cos(a), std::sin(e), std::cos(e) * std::sin(a)};
+}
+
+struct sample
+{
+    bool covered = false;
+    float depth = 0.f;
+    glm::vec3 color;
+    glm::vec3 normal;
+};
+
+void rasterize(triangle_list const & mesh, glm::vec3 const & center, float radius,
+    glm::vec3 const & right, glm::vec3 const & up, glm::vec3 const & direction,
+    int size, std::vector<sample> & samples)
+{
+    auto project = [&](glm::vec3 const & p)
+    {
+        glm::vec3 d = p - center;
+        return glm::vec3(
+            (glm::dot(d, right) / radius * 0.5f + 0.5f) * size,
+            (glm::dot(d, up) / radius * 0.5f + 0.5f) * size,
+            glm::dot(d, direction));
+    };
+
+    for (std::size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+    {
+        vertex const & v0 = mesh.vertices[mesh.indices[t]];
+        vertex const & v1 = mesh.vertices[mesh.indices[t + 1]];
+        vertex const & v2 = mesh.vertices[mesh.indices[t + 2]];
+
+        glm::vec3 p0 = project(v0.position);
+        glm::vec3 p1 = project(v1.position);
+        glm::vec3 p2 = project(v2.position);
+
+        float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+        if (std::abs(area) < 1e-12f)
+            continue;
+
+        int x_min = std::max(0, (int)std::floor(std::min({p0.x, p1.x, p2.x})));
+        int x_max = std::min(size - 1, (int)std::ceil(std::max({p0.x, p1.x, p2.x})));
+        int y_min = std::max(0, (int)std::floor(std::min({p0.y, p1.y, p2.y})));
+        int y_max = std::min(size - 1, (int)std::ceil(std::max({p0.y, p1.y, p2.y})));
+
+        // no backface culling, every material of the rose is two-sided
+        for (int y = y_min; y <= y_max; ++y)
+        {
+            for (int x = x_min; x <= x_max; ++x)
+            {
+                float px = x + 0.5f;
+                float py = y + 0.5f;
+
+                float w0 = ((p1.x - px) * (p2.y - py) - (p2.x - px) * (p1.y - py)) / area;
+                float w1 = ((p2.x - px) * (p0.y - py) - (p0.x - px) * (p2.y - py)) / area;
+                float w2 = 1.f - w0 - w1;
+                if (w0 < 0.f || w1 < 0.f || w2 < 0.f)
+                    continue;
+
+                float depth = w0 * p0.z + w1 * p1.z + w2 * p2.z;
+                sample & s = samples[y * size + x];
+                if (s.covered && s.depth >= depth)
+                    continue;
+
+                glm::vec4 color = mesh.color;
+                if (mesh.albedo)
+                    color *= mesh.albedo->sample(w0 * v0.texcoord + w1 * v1.texcoord + w2 * v2.texcoord);
+                if (color.a < 0.5f)
+                    continue;
+
+                glm::vec3 normal = w0 * v0.normal + w1 * v1.normal + w2 * v2.normal;
+                if (glm::dot(normal, direction) < 0.f)
+                    normal = -normal;
+
+                s.covered = true;
+                s.depth = depth;
+                s.color = glm::vec3(color);
+                s.normal = glm::normalize(normal);
+            }
+        }
+    }
+}
+
+std::uint8_t to_byte(float value)
+{
+    return (std::uint8_t)std::lround(std::clamp(value, 0.f, 1.f) * 255.f);
+}
+
+// Empty texels get the average of their covered neighbours, so that filtering and mipmaps don't
+// bleed black into the silhouette.
+void dilate(std::vector<std::uint8_t> & pixels, int width, int height, int iterations)
+{
+    std::vector<std::uint8_t> filled(width * height);
+    for (int i = 0; i < width * height; ++i)
+        filled[i] = pixels[4 * i + 3] > 0;
+
+    std::vector<std::uint8_t> next = pixels;
+    std::vector<std::uint8_t> next_filled = filled;
+
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                if (filled[y * width + x])
+                    continue;
+
+                int sum[3] = {0, 0, 0};
+                int count = 0;
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= width || ny >= height || !filled[ny * width + nx])
+                            continue;
+                        for (int c = 0; c < 3; ++c)
+                            sum[c] += pixels[4 * (ny * width + nx) + c];
+                        ++count;
+                    }
+                }
+
+                if (count == 0)
+                    continue;
+
+                for (int c = 0; c < 3; ++c)
+                    next[4 * (y * width + x) + c] = sum[c] / count;
+                next_filled[y * width + x] = 1;
+            }
+        }
+
+        pixels = next;
+        filled = next_filled;
+    }
+}
+
+}
+
+impostor_atlas bake_impostor(gltf_model const & model, std::vector<std::size_t> const & meshes,
+    std::filesystem::path const & texture_root, impostor_atlas::settings const & settings)
+{
+    impostor_atlas result;
+    result.params = settings;
+
+    std::unordered_map<std::string, texture> textures;
+    std::vector<triangle_list> lists;
+
+    glm::vec3 min(std::numeric_limits<float>::infinity());
+    glm::vec3 max(-std::numeric_limits<float>::infinity());
+
+    for (std::size_t index : meshes)
+    {
+        gltf_model::mesh const & mesh = model.meshes[index];
+        lists.push_back(read_mesh(model, mesh));
+
+        min = glm::min(min, mesh.min);
+        max = glm::max(max, mesh.max);
+
+        if (!mesh.material.texture_path)
+            continue;
+
+        auto it = textures.find(*mesh.material.texture_path);
+        if (it == textures.end())
+        {
+            texture loaded;
+            int channels;
+            auto path = (texture_root / *mesh.material.texture_path).string();
+            if (auto pixels = stbi_load(path.data(), &loaded.width, &loaded.height, &channels, 4))
+            {
+                loaded.pixels.assign(pixels, pixels + 4 * loaded.width * loaded.height);
+                stbi_image_free(pixels);
+            }
+            it = textures.emplace(*mesh.material.texture_path, std::move(loaded)).first;
+        }
+
+        // a missing texture leaves the material color alone instead of failing the bake
+        if (!it->second.pixels.empty())
+            lists.back().albedo = &it->second;
+    }
+
+    result.center = (min + max) * 0.5f;
+    result.radius = glm::length(max - min) * 0.5f;
+
+    int size = settings.view_size;
+    int ss = std::max(1, settings.supersampling);
+    int fine_size = size * ss;
+
+    result.width = size * settings.azimuths;
+    result.height = size * settings.elevations;
+    result.albedo.assign(4 * result.width * result.height, 0);
+    result.normal_depth.assign(4 * result.width * result.height, 0);
+
+    std::vector<sample> samples(fine_size * fine_size);
+
+    for (int elevation = 0; elevation < settings.elevations; ++elevation)
+    {
+        for (int azimuth = 0; azimuth < settings.azimuths; ++azimuth)
+        {
+            glm::vec3 direction = view_direction(settings, azimuth, elevation);
+            glm::vec3 right = glm::normalize(glm::cross(-direction, glm::vec3(0.f, 1.f, 0.f)));
+            glm::vec3 up = glm::cross(right, -direction);
+
+            std::fill(samples.begin(), samples.end(), sample{});
+            for (auto const & list : lists)
+                rasterize(list, result.center, result.radius, right, up, direction, fine_size, samples);
+
+            for (int y = 0; y < size; ++y)
+            {
+                for (int x = 0; x < size; ++x)
+                {
+                    glm::vec3 color(0.f), normal(0.f);
+                    float depth = 0.f;
+                    int covered = 0;
+
+                    for (int sy = 0; sy < ss; ++sy)
+                    {
+                        for (int sx = 0; sx < ss; ++sx)
+                        {
+                            sample const & s = samples[(y * ss + sy) * fine_size + x * ss + sx];
+                            if (!s.covered)
+                                continue;
+                            color += s.color;
+                            normal += s.normal;
+                            depth += s.depth;
+                            ++covered;
+                        }
+                    }
+
+                    if (covered == 0)
+                        continue;
+
+                    color /= (float)covered;
+                    normal = glm::normalize(normal);
+                    depth /= (float)covered;
+
+                    std::size_t texel = 4 * ((std::size_t)(elevation * size + y) * result.width + azimuth * size + x);
+                    result.albedo[texel + 0] = to_byte(color.r);
+                    result.albedo[texel + 1] = to_byte(color.g);
+                    result.albedo[texel + 2] = to_byte(color.b);
+                    result.albedo[texel + 3] = to_byte((float)covered / (ss * ss));
+
+                    result.normal_depth[texel + 0] = to_byte(normal.x * 0.5f + 0.5f);
+                    result.normal_depth[texel + 1] = to_byte(normal.y * 0.5f + 0.5f);
+                    result.normal_depth[texel + 2] = to_byte(normal.z * 0.5f + 0.5f);
+                    result.normal_depth[texel + 3] = to_byte((1.f - depth / result.radius) * 0.5f);
+                }
+            }
+        }
+    }
+
+    // normal_depth shares the coverage of albedo, so it's dilated with albedo's alpha
+    std::vector<std::uint8_t> normals = result.normal_depth;
+    for (std::size_t i = 3; i < normals.size(); i += 4)
+        normals[i] = result.albedo[i];
+
+    dilate(result.albedo, result.width, result.height, 4);
+    dilate(normals, result.width, result.height, 4);
+
+    for (std::size_t i = 0; i < normals.size(); i += 4)
+        std::memcpy(&result.normal_depth[i], &normals[i], 3);
+
+    return result;
+}
+
+static char const impostor_magic[4] = {'I', 'M', 'P', '1'};
+
+void save_impostor(impostor_atlas const & atlas, std::filesystem::path const & path)
+{
+    // the cache is only an optimization, a read-only model directory just means baking every launch
+    std::ofstream output(path, std::ios::binary);
+    if (!output)
+        return;
+
+    output.write(impostor_magic, sizeof(impostor_magic));
+    output.write(reinterpret_cast<char const *>(&atlas.params), sizeof(atlas.params));
+    output.write(reinterpret_cast<char const *>(&atlas.width), sizeof(atlas.width));
+    output.write(reinterpret_cast<char const *>(&atlas.height), sizeof(atlas.height));
+    output.write(reinterpret_cast<char const *>(&atlas.center), sizeof(atlas.center));
+    output.write(reinterpret_cast<char const *>(&atlas.radius), sizeof(atlas.radius));
+    output.write(reinterpret_cast<char const *>(atlas.albedo.data()), atlas.albedo.size());
+    output.write(reinterpret_cast<char const *>(atlas.normal_depth.data()), atlas.normal_depth.size());
+}
+
+bool load_impostor(impostor_atlas & atlas, std::filesystem::path const & path,
+    std::filesystem::path const & source, impostor_atlas::settings const & settings)
+{
+    std::error_code error;
+    auto cache_time = std::filesystem::last_write_time(path, error);
+    if (error || cache_time < std::filesystem::last_write_time(source))
+        return false;
+
+    std::ifstream input(path, std::ios::binary);
+
+    char magic[4];
+    impostor_atlas::settings params;
+    input.read(magic, sizeof(magic));
+    input.read(reinterpret_cast<char *>(&params), sizeof(params));
+    if (!input || std::memcmp(magic, impostor_magic, sizeof(magic)) != 0 || std::memcmp(&params, &settings, sizeof(params)) != 0)
+        return false;
+
+    impostor_atlas result;
+    result.params = params;
+    input.read(reinterpret_cast<char *>(&result.width), sizeof(result.width));
+    input.read(reinterpret_cast<char *>(&result.height), sizeof(result.height));
+    input.read(reinterpret_cast<char *>(&result.center), sizeof(result.center));
+    input.read(reinterpret_cast<char *>(&result.radius), sizeof(result.radius));
+    if (!input || result.width != params.view_size * params.azimuths || result.height != params.view_size * params.elevations)
+        return false;
+
+    result.albedo.resize(4 * result.width * result.height);
+    result.normal_depth.resize(4 * result.width * result.height);
+    input.read(reinterpret_cast<char *>(result.albedo.data()), result.albedo.size());
+    input.read(reinterpret_cast<char *>(result.normal_depth.data()), result.normal_depth.size());
+    if (!input)
+        return false;
+
+    atlas = std::move(result);
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+
+#include "gltf_loader.hpp"
+
+// Multi-view billboard atlas of a model. The atlas is a grid of `azimuths` columns by `elevations`
+// rows, every cell is an orthographic image of the model's bounding sphere seen from that direction.
+// Rows are stored bottom first, like OpenGL textures.
+struct impostor_atlas
+{
+    struct settings
+    {
+        int azimuths = 12;
+        int elevations = 4;
+        float max_elevation = 1.2f;
+        int view_size = 128;
+        int supersampling = 2;
+    };
+
+    settings params;
+
+    int width = 0;
+    int height = 0;
+
+    glm::vec3 center{0.f};
+    float radius = 0.f;
+
+    // RGBA8, alpha is coverage
+    std::vector<std::uint8_t> albedo;
+    // RGBA8, model space normal in rgb, depth towards the viewer in a: surface point is at
+    // center + view_direction * radius * (1 - 2 * a)
+    std::vector<std::uint8_t> normal_depth;
+};
+
+// Rasterizes the given meshes of the model on the CPU, so baking works without a GL context.
+// Base color textures are looked up relative to texture_root.
+impostor_atlas bake_impostor(gltf_model const & model, std::vector<std::size_t> const & meshes,
+    std::filesystem::path const & texture_root, impostor_atlas::settings const & settings = {});
+
+// Binary cache of a baked atlas. Loading fails if the file is missing, older than `source` or was
+// baked with other settings.
+void save_impostor(impostor_atlas const & atlas, std::filesystem::path const & path);
+bool load_impostor(impostor_atlas & atlas, std::filesystem::path const & path,
+    std::filesystem::path const & source, impostor_atlas::settings const & settings);
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "gltf_loader.hpp"
+#include "ring_buffer.hpp"
+
+namespace indirect_batch {
+
+// layout of a glMultiDrawElementsIndirect command
+struct command_t {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+};
+
+static_assert(sizeof(command_t) == 20);
+
+// Multi-draw with a per-command base instance needs GL 4.3, or the extension together with
+// ARB_base_instance: without it the base instance of every command is ignored.
+inline bool supported() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+// first index and index count of a mesh inside the arena
+struct range_t {
+    GLuint first_index = 0, count = 0;
+};
+
+// Vertices and indices of many meshes in one buffer each, so they can all be drawn from one VAO.
+// Indices are stored already offset by the mesh's first vertex, commands don't need a base vertex.
+struct arena_t {
+    struct vertex_t {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec2 texcoord;
+    };
+
+    std::vector <vertex_t> vertices;
+    std::vector <std::uint32_t> indices;
+
+    GLuint vbo = 0, ebo = 0;
+
+    range_t add(const gltf_model &model, const gltf_model::mesh &mesh) {
+        if (mesh.position.type != GL_FLOAT || mesh.normal.type != GL_FLOAT || (mesh.texcoord && mesh.texcoord->type != GL_FLOAT)) {
+            throw std::runtime_error("indirect batch: only float vertex attributes are supported in " + mesh.name);
+        }
+
+        std::uint32_t base = vertices.size();
+        vertices.resize(base + mesh.position.count);
+        for (std::uint32_t i = 0; i < mesh.position.count; i++) {
+            vertex_t &vertex = vertices[base + i];
+            vertex.position = read<glm::vec3>(model, mesh.position, i);
+            vertex.normal = read<glm::vec3>(model, mesh.normal, i);
+            vertex.texcoord = mesh.texcoord ? read<glm::vec2>(model, *mesh.texcoord, i) : glm::vec2(0.f);
+        }
+
+        range_t range{(GLuint)indices.size(), mesh.indices.count};
+        const char *data = model.buffer.data() + mesh.indices.view.offset;
+        for (std::uint32_t i = 0; i < mesh.indices.count; i++) {
+            std::uint32_t index;
+            switch (mesh.indices.type) {
+            case GL_UNSIGNED_BYTE: index = reinterpret_cast<const std::uint8_t*>(data)[i]; break;
+            case GL_UNSIGNED_SHORT: index = reinterpret_cast<const std::uint16_t*>(data)[i]; break;
+            case GL_UNSIGNED_INT: index = reinterpret_cast<const std::uint32_t*>(data)[i]; break;
+            default: throw std::runtime_error("indirect batch: unsupported index type in " + mesh.name);
+            }
+            indices.push_back(base + index);
+        }
+
+        return range;
+    }
+
+    void upload() {
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex_t), vertices.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(std::uint32_t), indices.data(), GL_STATIC_DRAW);
+    }
+
+    // attributes 0, 1, 2 and the index buffer of the bound VAO
+    void setup_vertex_attributes() const {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), reinterpret_cast<void*>(offsetof(vertex_t, position)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), reinterpret_cast<void*>(offsetof(vertex_t, normal)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), reinterpret_cast<void*>(offsetof(vertex_t, texcoord)));
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    }
+
+    // byte offset of a range in the index buffer, for non-indirect draws
+    static std::uintptr_t byte_offset(const range_t &range) {
+        return range.first_index * sizeof(std::uint32_t);
+    }
+
+private:
+    template <typename T>
+    static T read(const gltf_model &model, const gltf_model::accessor &accessor, std::uint32_t i) {
+        T value;
+        std::memcpy(&value, model.buffer.data() + accessor.view.offset + i * sizeof(T), sizeof(T));
+        return value;
+    }
+};
+
+// Commands of one frame grouped by material class: everything drawn with the same program, state
+// and textures becomes one glMultiDrawElementsIndirect.
+struct batch_t {
+    struct draw_t {
+        int material_class;
+        std::uintptr_t offset;  // into the indirect buffer
+        GLsizei cnt;
+    };
+
+    std::vector <std::vector <command_t>> classes;
+
+    void begin_frame(std::size_t classes_cnt) {
+        classes.resize(classes_cnt);
+        for (auto &commands : classes) {
+            commands.clear();
+        }
+    }
+
+    void add(int material_class, const range_t &range, GLuint instances, GLuint base_instance) {
+        classes[material_class].push_back({range.count, instances, range.first_index, 0, base_instance});
+    }
+
+    std::size_t commands_cnt() const {
+        std::size_t result = 0;
+        for (const auto &commands : classes) {
+            result += commands.size();
+        }
+        return result;
+    }
+
+    // Copies the commands class after class into an allocation of commands_cnt() commands, returns
+    // the multi-draw of every class that has any.
+    std::vector <draw_t> write(const ring_buffer::allocation_t &allocation) const {
+        std::vector <draw_t> result;
+        std::size_t written = 0;
+        for (std::size_t i = 0; i < classes.size(); i++) {
+            if (classes[i].empty()) {
+                continue;
+            }
+
+            std::memcpy(allocation.as<command_t>() + written, classes[i].data(), classes[i].size() * sizeof(command_t));
+            result.push_back({(int)i, allocation.offset + written * sizeof(command_t), (GLsizei)classes[i].size()});
+            written += classes[i].size();
+        }
+        return result;
+    }
+};
+
+}
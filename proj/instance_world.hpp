@@ -0,0 +1,323 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <random>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+namespace instance_world {
+
+// Compact per-instance data, the world position is restored from the chunk it belongs to.
+struct instance_t {
+    std::uint16_t x, z;     // position inside the chunk in 1/65536 of the chunk size
+    std::uint8_t rotation;  // rotation around Y in 1/256 of a full turn
+    std::uint8_t scale;     // between min_scale (0) and max_scale (255)
+    std::uint8_t state;
+    std::uint8_t reserved;
+};
+
+static_assert(sizeof(instance_t) == 8);
+
+enum state_bits : std::uint8_t {
+    collected = 1,
+    // outside config_t::area, the slot stays empty
+    absent = 2,
+};
+
+// The defaults give a regular grid of upright, unscaled instances at the min corners of their cells.
+struct config_t {
+    float chunk_size = 6.f;
+    int instances_per_side = 4;
+
+    // where an instance sits in its cell before jitter, in cells: 0 is the min corner, .5 the center
+    float cell_anchor = 0.f;
+    float jitter = 0.f;
+    bool random_rotation = false;
+    float min_scale = 1.f, max_scale = 1.f;
+
+    // instances whose x and z fall outside [area_min, area_max] are absent
+    glm::vec2 area_min{-std::numeric_limits <float>::infinity()};
+    glm::vec2 area_max{std::numeric_limits <float>::infinity()};
+
+    // chunks closer than load_radius are generated, chunks farther than unload_radius are evicted
+    float load_radius = 40.f;
+    float unload_radius = 48.f;
+
+    // bounds memory and per-frame cost regardless of the world size
+    std::size_t max_resident_chunks = 256;
+    std::size_t max_generated_per_frame = 16;
+
+    // inclusive range of chunk coordinates the world consists of
+    glm::ivec2 min_chunk{-4, -4}, max_chunk{3, 3};
+
+    std::uint32_t seed = 1;
+};
+
+// A fixed-size tile of the world. Resident chunks live in a fixed pool of slots, the slot index
+// also selects the chunk's range in per-slot arrays of the users (GPU ranges, caches).
+struct chunk_t {
+    glm::ivec2 coord;
+    glm::vec3 min, max;
+    std::vector <instance_t> instances;
+
+    std::uint64_t last_used_frame = 0;
+    bool resident = false;
+
+    // set when the slot gets a new chunk, users reset their per-slot state and clear it
+    bool fresh = false;
+};
+
+struct stats_t {
+    std::size_t generated = 0, evicted = 0, restored = 0;
+};
+
+struct instance_world_t {
+    config_t config;
+
+    std::vector <chunk_t> slots;
+    stats_t stats;
+
+    instance_world_t(const config_t &config = config_t()) : config(config) {
+        slots.resize(config.max_resident_chunks);
+        for (std::size_t slot = slots.size(); slot-- > 0;) {
+            free_slots.push_back(slot);
+        }
+    }
+
+    std::size_t chunk_capacity() const {
+        return config.instances_per_side * config.instances_per_side;
+    }
+
+    // instances that aren't absent, counted by the anchors of their cells, so exact without jitter
+    std::size_t total_instances() const {
+        auto axis_cnt = [&](int min_chunk, int max_chunk, float area_min, float area_max) {
+            float cell = config.chunk_size / config.instances_per_side;
+            std::size_t result = 0;
+            for (int i = min_chunk * config.instances_per_side; i < (max_chunk + 1) * config.instances_per_side; i++) {
+                float position = (i + config.cell_anchor) * cell;
+                result += area_min <= position && position <= area_max;
+            }
+            return result;
+        };
+        return axis_cnt(config.min_chunk.x, config.max_chunk.x, config.area_min.x, config.area_max.x) * \
+               axis_cnt(config.min_chunk.y, config.max_chunk.y, config.area_min.y, config.area_max.y);
+    }
+
+    std::size_t resident_cnt() const {
+        return resident.size();
+    }
+
+    glm::vec3 position(const chunk_t &chunk, const instance_t &instance) const {
+        return chunk.min + glm::vec3(instance.x, 0.f, instance.z) * (config.chunk_size / 65536.f);
+    }
+
+    float rotation(const instance_t &instance) const {
+        return instance.rotation * (2.f * glm::pi<float>() / 256.f);
+    }
+
+    float scale(const instance_t &instance) const {
+        return config.min_scale + (config.max_scale - config.min_scale) * instance.scale / 255.f;
+    }
+
+    glm::ivec2 chunk_coord(const glm::vec3 &position) const {
+        return glm::ivec2(std::floor(position.x / config.chunk_size), std::floor(position.z / config.chunk_size));
+    }
+
+    bool in_world(const glm::ivec2 &coord) const {
+        return config.min_chunk.x <= coord.x && coord.x <= config.max_chunk.x && \
+               config.min_chunk.y <= coord.y && coord.y <= config.max_chunk.y;
+    }
+
+    // Returns the resident chunk at `coord`, generating it if needed, or nullptr if it's outside
+    // the world or every slot is taken by a chunk used during the current frame.
+    chunk_t *acquire(const glm::ivec2 &coord) {
+        if (!in_world(coord)) {
+            return nullptr;
+        }
+
+        if (auto it = resident.find(key(coord)); it != resident.end()) {
+            chunk_t &chunk = slots[it->second];
+            chunk.last_used_frame = frame;
+            return &chunk;
+        }
+
+        if (free_slots.empty() && !evict_least_recently_used()) {
+            return nullptr;
+        }
+
+        std::size_t slot = free_slots.back();
+        free_slots.pop_back();
+
+        generate(slots[slot], coord);
+        resident[key(coord)] = slot;
+        return &slots[slot];
+    }
+
+    // Streams chunks around the camera: evicts distant ones and generates at most
+    // max_generated_per_frame missing ones, closest first.
+    void update(const glm::vec3 &camera_position) {
+        frame++;
+
+        for (std::size_t slot = 0; slot < slots.size(); slot++) {
+            if (slots[slot].resident && distance(slots[slot], camera_position) > config.unload_radius) {
+                evict(slot);
+            }
+        }
+
+        glm::ivec2 from = glm::max(chunk_coord(camera_position - glm::vec3(config.load_radius)), config.min_chunk);
+        glm::ivec2 to = glm::min(chunk_coord(camera_position + glm::vec3(config.load_radius)), config.max_chunk);
+
+        missing.clear();
+        for (int x = from.x; x <= to.x; x++) {
+            for (int z = from.y; z <= to.y; z++) {
+                glm::ivec2 coord(x, z);
+                float dist = distance(coord, camera_position);
+                if (dist > config.load_radius) {
+                    continue;
+                }
+
+                if (auto it = resident.find(key(coord)); it != resident.end()) {
+                    slots[it->second].last_used_frame = frame;
+                } else {
+                    missing.push_back({dist, coord});
+                }
+            }
+        }
+
+        std::size_t generate_cnt = std::min(missing.size(), config.max_generated_per_frame);
+        std::partial_sort(missing.begin(), missing.begin() + generate_cnt, missing.end(), [](const auto &a, const auto &b) {
+            return a.first < b.first;
+        });
+
+        for (std::size_t i = 0; i < generate_cnt; i++) {
+            if (!acquire(missing[i].second)) {
+                break;
+            }
+        }
+    }
+
+private:
+    std::unordered_map <std::uint64_t, std::size_t> resident;
+    std::vector <std::size_t> free_slots;
+    std::vector <std::pair <float, glm::ivec2>> missing;
+
+    // states of evicted chunks that were changed, so that regenerating them doesn't reset the changes
+    std::unordered_map <std::uint64_t, std::vector <std::uint8_t>> saved_states;
+
+    std::uint64_t frame = 0;
+
+    static std::uint64_t key(const glm::ivec2 &coord) {
+        return ((std::uint64_t)(std::uint32_t)coord.x << 32) | (std::uint32_t)coord.y;
+    }
+
+    float distance(const glm::ivec2 &coord, const glm::vec3 &position) const {
+        glm::vec2 min = glm::vec2(coord) * config.chunk_size;
+        glm::vec2 closest = glm::clamp(glm::vec2(position.x, position.z), min, min + config.chunk_size);
+        return glm::length(closest - glm::vec2(position.x, position.z));
+    }
+
+    float distance(const chunk_t &chunk, const glm::vec3 &position) const {
+        return distance(chunk.coord, position);
+    }
+
+    void generate(chunk_t &chunk, const glm::ivec2 &coord) {
+        chunk.coord = coord;
+        chunk.min = glm::vec3(coord.x, 0.f, coord.y) * config.chunk_size;
+        chunk.max = chunk.min + glm::vec3(config.chunk_size, 0.f, config.chunk_size);
+        chunk.last_used_frame = frame;
+        chunk.resident = true;
+        chunk.fresh = true;
+
+        // splitmix64 of the coordinates, so a chunk looks the same every time it's generated
+        std::uint64_t seed = key(coord) ^ ((std::uint64_t)config.seed << 32 | config.seed);
+        seed += 0x9e3779b97f4a7c15ull;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+        seed ^= seed >> 31;
+
+        std::mt19937 random_engine(seed);
+        std::uniform_real_distribution <float> jitter_distr(-config.jitter, config.jitter);
+        std::uniform_int_distribution <int> byte_distr(0, 255);
+
+        int n = config.instances_per_side;
+        chunk.instances.resize(n * n);
+        for (int a = 0; a < n; a++) {
+            for (int b = 0; b < n; b++) {
+                float x = (a + config.cell_anchor + jitter_distr(random_engine)) / n;
+                float z = (b + config.cell_anchor + jitter_distr(random_engine)) / n;
+                std::uint8_t rotation = byte_distr(random_engine);
+
+                instance_t &instance = chunk.instances[a * n + b];
+                instance.x = std::clamp((int)(x * 65536.f), 0, 65535);
+                instance.z = std::clamp((int)(z * 65536.f), 0, 65535);
+                instance.rotation = config.random_rotation ? rotation : 0;
+                instance.scale = byte_distr(random_engine);
+                instance.reserved = 0;
+
+                glm::vec3 world_position = position(chunk, instance);
+                bool inside = config.area_min.x <= world_position.x && world_position.x <= config.area_max.x && \
+                              config.area_min.y <= world_position.z && world_position.z <= config.area_max.y;
+                instance.state = inside ? 0 : absent;
+            }
+        }
+
+        if (auto it = saved_states.find(key(coord)); it != saved_states.end()) {
+            for (std::size_t i = 0; i < chunk.instances.size(); i++) {
+                chunk.instances[i].state = it->second[i];
+            }
+            saved_states.erase(it);
+            stats.restored++;
+        }
+
+        stats.generated++;
+    }
+
+    void evict(std::size_t slot) {
+        chunk_t &chunk = slots[slot];
+
+        bool changed = std::any_of(chunk.instances.begin(), chunk.instances.end(), [](const instance_t &instance) {
+            return (instance.state & ~absent) != 0;
+        });
+        if (changed) {
+            auto &states = saved_states[key(chunk.coord)];
+            states.resize(chunk.instances.size());
+            for (std::size_t i = 0; i < chunk.instances.size(); i++) {
+                states[i] = chunk.instances[i].state;
+            }
+        }
+
+        resident.erase(key(chunk.coord));
+        chunk.resident = false;
+        free_slots.push_back(slot);
+        stats.evicted++;
+    }
+
+    bool evict_least_recently_used() {
+        std::size_t victim = slots.size();
+        for (std::size_t slot = 0; slot < slots.size(); slot++) {
+            if (!slots[slot].resident || slots[slot].last_used_frame == frame) {
+                continue;
+            }
+            if (victim == slots.size() || slots[slot].last_used_frame < slots[victim].last_used_frame) {
+                victim = slot;
+            }
+        }
+
+        if (victim == slots.size()) {
+            return false;
+        }
+
+        evict(victim);
+        return true;
+    }
+};
+
+}
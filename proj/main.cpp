@@ -10,8 +10,10 @@
 #include <stdexcept>
 #include <iostream>
 #include <chrono>
+#include <fstream>
 #include <map>
 #include <cmath>
+#include <atomic>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -22,6 +24,16 @@
 #include "obj_parser.hpp"
 #include "stb_image.h"
 #include "gltf_loader.hpp"
+#include "thread_pool.hpp"
+#include "task_graph.hpp"
+#include "frame_pipeline.hpp"
+#include "benchmark.hpp"
+#include "profiler.hpp"
+#include "render_queue.hpp"
+#include "gl_state.hpp"
+#include "frame_uniforms.hpp"
+#include "asset_cache.hpp"
+#include "asset_pack.hpp"
 
 #include "environment.hpp"
 #include "board.hpp"
@@ -47,7 +59,14 @@ void glew_fail(std::string_view message, GLenum error) {
     throw std::runtime_error(to_string(message) + reinterpret_cast<const char *>(glewGetErrorString(error)));
 }
 
-int main() try {
+int main(int argc, char **argv) try {
+    auto program_start = std::chrono::steady_clock::now();
+    auto ms_since_start = [&]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - program_start).count();
+    };
+
+    benchmark::config_t benchmark_config = benchmark::parse_args(argc, argv);
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -62,11 +81,18 @@ int main() try {
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
 
-    SDL_Window * window = SDL_CreateWindow("Graphics course final project",
-        SDL_WINDOWPOS_CENTERED,
-        SDL_WINDOWPOS_CENTERED,
-        800, 600,
-        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED);
+    // a benchmark renders into a hidden window of fixed size, e.g. under Xvfb or with LIBGL_ALWAYS_SOFTWARE=1
+    SDL_Window * window = benchmark_config.enabled ?
+        SDL_CreateWindow("Graphics course final project (benchmark)",
+            SDL_WINDOWPOS_CENTERED,
+            SDL_WINDOWPOS_CENTERED,
+            benchmark_config.width, benchmark_config.height,
+            SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN) :
+        SDL_CreateWindow("Graphics course final project",
+            SDL_WINDOWPOS_CENTERED,
+            SDL_WINDOWPOS_CENTERED,
+            800, 600,
+            SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED);
 
     if (!window)
         sdl2_fail("SDL_CreateWindow: ");
@@ -85,36 +111,205 @@ int main() try {
     if (!GLEW_VERSION_3_3)
         throw std::runtime_error("OpenGL 3.3 is not supported");
 
+    if (benchmark_config.enabled) {
+        SDL_GL_SetSwapInterval(0);
+        glViewport(0, 0, width, height);
+    }
+
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
 
+    thread_pool::thread_pool_t workers;
+    asset_cache::cache().pool = &workers;
+
+    // from the models pack unless --no-pack, see asset_pack.hpp; textures load in the background
+    // unless --sync-assets, see asset_cache::texture_cache_t
+    asset_pack::use_models_pack = benchmark_config.use_pack;
+    asset_cache::cache().async = benchmark_config.async_assets;
+
     environment::environment_t environment(0);
     board::board_t board(1);
     box::box_t box(2);
-    bitmap::bitmap_t bitmap(3);
+    bitmap::bitmap_t bitmap(3, &workers, !benchmark_config.preload_bitmap);
     papich::papich_t papich(4);
     papich_hat::papich_hat_t papich_hat(5, &papich);
     mouse::mouse_t mouse(6);
-    roses::roses_t roses(7, &papich, &mouse);
+    roses::roses_t roses(7, &papich, &mouse, &workers);
     cloud::cloud_t cloud(8);
     hud::hud_t hud(9, &roses);
 
+    roses.lod_selection.triangle_budget = benchmark_config.triangle_budget;
+
+    // recorded frames shouldn't depend on how fast the loaders were
+    if (benchmark_config.enabled) {
+        asset_cache::cache().finish();
+    }
+
+    std::cerr << "entities set up in " << ms_since_start() << " ms, " << asset_cache::cache().loading() << " textures loading, assets from " \
+              << (asset_pack::models() ? asset_pack::models_path().string() : std::string("separate files")) << std::endl;
+
+    shader_cache::cache().report(std::cerr);
+    asset_cache::cache().report(std::cerr);
+
+    std::vector <std::pair <std::string, entity::entity *>> entities = {
+        {"environment", &environment},
+        {"board", &board},
+        {"box", &box},
+        {"bitmap", &bitmap},
+        {"papich", &papich},
+        {"papich_hat", &papich_hat},
+        {"mouse", &mouse},
+        {"roses", &roses},
+        {"cloud", &cloud},
+        {"hud", &hud},
+    };
+
+    frame_uniforms::frame_uniforms_t frame_uniforms;
+
+    // entities only submit draw packets, the queue sorts and issues them once all are in
+    render_queue::render_queue_t draw_queue;
+    for (auto &[name, entity] : entities) {
+        entity->render_queue_ptr = &draw_queue;
+    }
+
+    roses.update_size(width, height);
+    asset_cache::cache().update_size(width, height);
+
     blur_device::blur_device_t blur(width, height);
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
+    const float near = 0.1f;
+    const float far = 100.f;
+
+    // simulation state, only touched by simulate() below
     float time = 0.f;
 
-    std::map <SDL_Keycode, bool> button_down;
+    // the simulation's copy of the input, the GL thread fills its own from the events
+    std::map <SDL_Keycode, bool> update_button_down;
+
+    // updates run in parallel, ordered only where an entity declared it uses another's state;
+    // G writes the graph with the timings of the last frame to update_graph.dot
+    float update_time = 0.f, update_dt = 0.f;
+    task_graph::scheduler_t update_scheduler;
+    task_graph::task_graph_t update_graph("update_state");
+    for (auto &[name, entity] : entities) {
+        std::vector <task_graph::resource_t> writes = entity->update_writes;
+        writes.push_back(entity);
+        update_graph.add(name, [&, entity = entity]() {
+            entity->update_state(update_time, update_dt, update_button_down);
+        }, entity->update_reads, writes);
+    }
+    std::atomic <bool> write_update_graph = false;
 
     float view_elevation = glm::radians(30.f);
     float view_azimuth = 0.f;
     float camera_distance = 2.f;
 
+    // Advances the world by one frame of input and captures it into snapshot `slot`. Runs on the
+    // simulation thread, so it makes no GL calls and reads nothing the GL thread writes.
+    auto simulate = [&](const frame_pipeline::input_t &input, frame_pipeline::frame_t &frame_data, std::size_t slot) {
+        float dt = input.dt;
+        update_button_down = input.button_down;
+
+        if (!input.paused) {
+            time += dt;
+        }
+
+        if (update_button_down[SDLK_UP])
+            camera_distance -= 8.f * dt;
+        if (update_button_down[SDLK_DOWN])
+            camera_distance += 8.f * dt;
+
+        if (update_button_down[SDLK_LEFT])
+            view_azimuth += 2.f * dt;
+        if (update_button_down[SDLK_RIGHT])
+            view_azimuth -= 2.f * dt;
+
+        if (update_button_down[SDLK_COMMA]) {
+            view_elevation += 1.f * dt;
+        }
+        if (update_button_down[SDLK_PERIOD]) {
+            view_elevation -= 1.f * dt;
+        }
+
+        frame_data.update_ms.clear();
+        if (!input.paused) {
+            update_time = time;
+            update_dt = dt;
+            update_scheduler.run(update_graph);
+
+            for (const auto &task : update_graph.tasks) {
+                frame_data.update_ms.push_back(task.duration_ms);
+            }
+        }
+
+        if (write_update_graph.exchange(false)) {
+            std::ofstream graph("update_graph.dot");
+            update_graph.write_dot(graph);
+        }
+
+        float top = near;
+        float right = (top * input.width) / input.height;
+
+        glm::mat4 view(1.f);
+        if (update_button_down[SDLK_m]) {
+            view = glm::translate(view, {0.f, 0.f, -camera_distance / 3.f});
+            view = glm::rotate(view, view_elevation, {1.f, 0.f, 0.f});
+            view = glm::rotate(view, view_azimuth, {0.f, 1.f, 0.f});
+            view = glm::translate(view, -glm::vec3(mouse.position.x, 0.f, mouse.position.z));
+        } else {
+            view = glm::translate(view, {0.f, 0.f, -camera_distance});
+            view = glm::rotate(view, view_elevation, {1.f, 0.f, 0.f});
+            view = glm::rotate(view, view_azimuth, {0.f, 1.f, 0.f});
+        }
+
+        glm::mat4 projection = glm::mat4(1.f);
+        projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * input.width) / input.height, near, far);
+
+        frame_data.time = time;
+        frame_data.view = view;
+        frame_data.projection = projection;
+        frame_data.camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
+        frame_data.light_direction = glm::normalize(glm::vec3(2.f * sin(-time), 3.f, 2.f * cos(-time * 2.f)));
+        frame_data.light_color = glm::vec3(.7f, .3f + (1.f + sin(time)) / 4.f, .7f);
+        frame_data.ambient_light_color = glm::vec3(.3f);
+
+        roses.stream(frame_data.camera_position);
+
+        for (auto &[name, entity] : entities) {
+            entity->capture(slot);
+        }
+    };
+
+    // the benchmark simulates serially unless asked otherwise, see benchmark::config_t::pipelined
+    frame_pipeline::pipeline_t pipeline(!benchmark_config.enabled || benchmark_config.pipelined, simulate);
+
+    std::map <SDL_Keycode, bool> button_down;
+
     bool paused = false;
 
+    // T writes a Chrome trace of the last frames to trace.json
+    profiler::profiler_t frame_profiler;
+
+    benchmark::script_t benchmark_script;
+    benchmark::recorder_t recorder;
+    recorder.asset_pack = asset_pack::models() != nullptr;
+    int frame = 0;
+
+    if (benchmark_config.enabled) {
+        int total_frames = benchmark_config.warmup_frames + benchmark_config.frames;
+        benchmark_script = benchmark_config.script_path.empty() ?
+            benchmark::script_t::builtin(total_frames) :
+            benchmark::script_t::load(benchmark_config.script_path);
+
+        mouse.random_engine.seed(benchmark_config.seed);
+    }
+
     bool running = true;
     while (running) {
+        auto frame_start = std::chrono::steady_clock::now();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type) {
         case SDL_QUIT:
             running = false;
@@ -126,16 +321,29 @@ int main() try {
                 glViewport(0, 0, width, height);
 
                 blur.update_size(width, height);
+                roses.update_size(width, height);
+                asset_cache::cache().update_size(width, height);
 
                 break;
             }
             break;
         case SDL_KEYDOWN:
+            if (benchmark_config.enabled)
+                break;
             button_down[event.key.keysym.sym] = true;
             if (event.key.keysym.sym == SDLK_p)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_t) {
+                std::ofstream trace("trace.json");
+                frame_profiler.write_chrome_trace(trace);
+            }
+            if (event.key.keysym.sym == SDLK_g) {
+                write_update_graph = true;
+            }
             break;
         case SDL_KEYUP:
+            if (benchmark_config.enabled)
+                break;
             button_down[event.key.keysym.sym] = false;
             break;
         }
@@ -146,65 +354,53 @@ int main() try {
         auto now = std::chrono::high_resolution_clock::now();
         float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
         last_frame_start = now;
-        if (!paused) {
-            time += dt;
-        }
 
-        if (button_down[SDLK_UP])
-            camera_distance -= 8.f * dt;
-        if (button_down[SDLK_DOWN])
-            camera_distance += 8.f * dt;
-
-        if (button_down[SDLK_LEFT])
-            view_azimuth += 2.f * dt;
-        if (button_down[SDLK_RIGHT])
-            view_azimuth -= 2.f * dt;
+        if (benchmark_config.enabled) {
+            if (frame == benchmark_config.warmup_frames + benchmark_config.frames)
+                break;
 
-        if (button_down[SDLK_COMMA]) {
-            view_elevation += 1.f * dt;
-        }
-        if (button_down[SDLK_PERIOD]) {
-            view_elevation -= 1.f * dt;
+            dt = benchmark_config.dt;
+            benchmark_script.apply(frame, button_down);
+            recorder.recording = frame >= benchmark_config.warmup_frames;
         }
 
-        if (!paused) {
-            environment.update_state(time, dt, button_down);
-            board.update_state(time, dt, button_down);
-            box.update_state(time, dt, button_down);
-            bitmap.update_state(time, dt, button_down);
-            papich.update_state(time, dt, button_down);
-            papich_hat.update_state(time, dt, button_down);
-            mouse.update_state(time, dt, button_down);
-            roses.update_state(time, dt, button_down);
-            cloud.update_state(time, dt, button_down);
-            hud.update_state(time, dt, button_down);
-        }
+        frame_profiler.begin_frame();
 
-        float near = 0.1f;
-        float far = 100.f;
-        float top = near;
-        float right = (top * width) / height;
+        // a serial pipeline simulates right here, a threaded one hands the input over and waits for
+        // the frame simulated from the previous one
+        {
+            profiler::profiler_t::scope_t simulate_scope(frame_profiler, "simulate");
 
-        glm::mat4 view(1.f);
-        if (button_down[SDLK_m]) {
-            view = glm::translate(view, {0.f, 0.f, -camera_distance / 3.f});
-            view = glm::rotate(view, view_elevation, {1.f, 0.f, 0.f});
-            view = glm::rotate(view, view_azimuth, {0.f, 1.f, 0.f});
-            view = glm::translate(view, -glm::vec3(mouse.position.x, 0.f, mouse.position.z));
-        } else {
-            view = glm::translate(view, {0.f, 0.f, -camera_distance});
-            view = glm::rotate(view, view_elevation, {1.f, 0.f, 0.f});
-            view = glm::rotate(view, view_azimuth, {0.f, 1.f, 0.f});
+            frame_pipeline::input_t input;
+            input.button_down = button_down;
+            input.paused = paused;
+            input.width = width;
+            input.height = height;
+            input.dt = dt;
+            input.sampled_at = frame_start;
+            pipeline.submit(input);
+
+            pipeline.acquire();
         }
 
-        glm::mat4 projection = glm::mat4(1.f);
-        projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * width) / height, near, far);
+        const frame_pipeline::frame_t &frame_data = pipeline.frame();
+        for (auto &[name, entity] : entities) {
+            entity->select(pipeline.slot());
+        }
 
-        glm::vec3 light_direction = glm::normalize(glm::vec3(2.f * sin(-time), 3.f, 2.f * cos(-time * 2.f)));
-        glm::vec3 light_color(.7f, .3f + (1.f + sin(time)) / 4.f, .7f);
-        glm::vec3 ambient_light_color(.3f);
+        // textures the loaders have finished replace their placeholders before the draws
+        {
+            profiler::profiler_t::scope_t upload_scope(frame_profiler, "asset uploads");
+            recorder.measure("asset_cache", "upload", [&]() { asset_cache::cache().pump(); });
+        }
 
-        glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
+        // tasks run off the GL thread, so only the graph times them
+        if (recorder.recording) {
+            recorder.add("frame", "simulate", frame_data.simulate_ms);
+            for (std::size_t i = 0; i < frame_data.update_ms.size(); i++) {
+                recorder.add(update_graph.tasks[i].name, "update_state", frame_data.update_ms[i]);
+            }
+        }
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -212,22 +408,65 @@ int main() try {
             blur.init();
         }
 
-        environment.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        board.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        box.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        bitmap.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        papich.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        papich_hat.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        mouse.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        roses.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        cloud.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
-        hud.draw(view, projection, camera_position, light_direction, light_color, ambient_light_color, time);
+        if (!benchmark_config.enabled || benchmark_config.draw) {
+            profiler::profiler_t::scope_t draw_scope(frame_profiler, "draw");
+            frame_uniforms.update(frame_data.view, frame_data.projection, frame_data.camera_position, \
+                frame_data.light_direction, frame_data.light_color, frame_data.ambient_light_color, frame_data.time);
+            draw_queue.begin_frame(frame_data.camera_position, far);
+            for (auto &[name, entity] : entities) {
+                profiler::profiler_t::scope_t scope(frame_profiler, name);
+                recorder.measure(name, "draw", [&]() {
+                    entity->draw(frame_uniforms.data);
+                });
+            }
+
+            profiler::profiler_t::scope_t replay_scope(frame_profiler, "replay");
+            recorder.measure("render_queue", "flush", [&]() { draw_queue.flush(); });
+
+            recorder.count("roses triangles", roses.lod_selection.frame_triangles);
+            recorder.count("roses lod error scale", roses.lod_selection.budget_scale);
+        }
 
         if (button_down[SDLK_b]) {
-            blur.show_output(width, height, time);
+            blur.show_output(width, height, frame_data.time);
         }
 
         SDL_GL_SwapWindow(window);
+        pipeline.presented();
+
+        if (recorder.first_frame_ms < 0.0) {
+            recorder.first_frame_ms = ms_since_start();
+            std::cerr << "first frame after " << recorder.first_frame_ms << " ms" << std::endl;
+        }
+        if (recorder.assets_ms < 0.0 && asset_cache::cache().loading() == 0) {
+            recorder.assets_ms = ms_since_start();
+            std::cerr << "all textures loaded after " << recorder.assets_ms << " ms" << std::endl;
+            asset_cache::cache().report(std::cerr);
+        }
+
+        frame_profiler.end_frame();
+        gl_state::cache().end_frame();
+
+        if (benchmark_config.enabled) {
+            // wait for the GPU, so that the frame time covers the whole frame and not just the submission
+            glFinish();
+
+            if (recorder.recording)
+                recorder.add("frame", "total", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count());
+            frame++;
+        }
+    }
+
+    if (benchmark_config.enabled) {
+        std::ofstream output(benchmark_config.output_path);
+        recorder.write_json(output, benchmark_config, reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+        recorder.report(std::cerr);
+        std::cerr << "benchmark results written to " << benchmark_config.output_path << std::endl;
+
+        if (!benchmark_config.trace_path.empty()) {
+            std::ofstream trace(benchmark_config.trace_path);
+            frame_profiler.write_chrome_trace(trace);
+        }
     }
 
     SDL_GL_DeleteContext(gl_context);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+namespace thread_pool
+{
+struct thread_pool_t;
+}
+
+enum class mip_filter : std::uint32_t
+{
+    // 2x2 average
+    box = 0,
+    // 8 tap windowed sinc, keeps detail that the box filter blurs away
+    kaiser = 1,
+};
+
+struct mip_settings
+{
+    mip_filter filter = mip_filter::kaiser;
+
+    // color textures are filtered in linear space, data textures (normals, roughness, masks) as stored
+    bool srgb = true;
+
+    // Keeps the fraction of texels whose mask passes the cutoff the same as on level 0, so that
+    // alpha-tested surfaces don't thin out in the distance. The mask is alpha, or for opacity maps
+    // stored in color the red channel, with the three color channels scaled together. Negative
+    // disables it.
+    float coverage_cutoff = -1.f;
+    bool coverage_in_color = false;
+
+    bool operator == (mip_settings const &) const = default;
+};
+
+struct mip_level
+{
+    int width = 0;
+    int height = 0;
+    std::vector<std::uint8_t> data;
+};
+
+// Full mip chain of an RGBA8 image down to 1x1, level 0 is a copy of the image. Every level is
+// filtered from the previous one kept in float, rows of each level are spread over the pool if
+// there is one.
+std::vector<mip_level> generate_mips(std::uint8_t const * rgba, int width, int height, mip_settings const & settings,
+    thread_pool::thread_pool_t * pool = nullptr);
+
+// Settings for a texture by its file name: names with `normal`, `rough` or `opacity` are data, the
+// rest is color.
+mip_settings mip_settings_for(std::filesystem::path const & path);
+
+// Generated chains live next to their source, `papich.jpg` is cached in `papich.jpg.mips`. Loading
+// fails if the file is missing, older than `source`, made with other settings or damaged.
+std::filesystem::path cached_mips_path(std::filesystem::path const & source);
+void save_mips(std::vector<mip_level> const & levels, mip_settings const & settings, std::filesystem::path const & path);
+bool load_mips(std::vector<mip_level> & levels, mip_settings const & settings, std::filesystem::path const & path,
+    std::filesystem::path const & source);
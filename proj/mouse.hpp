@@ -5,11 +5,13 @@
 #include <glm/gtx/rotate_vector.hpp>
 
 #include <vector>
+#include <array>
 #include <string>
 #include <random>
 #include <ctime>
 
 #include "common_util.hpp"
+#include "asset_cache.hpp"
 #include "stb_image.h"
 #include "gltf_loader.hpp"
 
@@ -19,10 +21,9 @@ namespace mouse {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 uniform mat4x3 bones[64];
 
 layout (location = 0) in vec3 in_position;
@@ -60,17 +61,15 @@ void main() {
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
+#ifdef USE_TEXTURE
 uniform sampler2D albedo;
+#else
+uniform vec4 color;
+#endif
 uniform sampler2D roughness_texture;
 uniform sampler2D normal_texture;
-uniform vec4 color;
-uniform int use_texture;
-
-uniform vec3 light_direction;
-uniform vec3 light_color;
-uniform vec3 ambient_light_color;
-uniform vec3 camera_position;
 
 layout (location = 0) out vec4 out_color;
 
@@ -91,13 +90,11 @@ float specular(vec3 real_normal) {
 }
 
 void main() {
-    vec4 albedo_color;
-
-    if (use_texture == 1) {
-        albedo_color = texture(albedo, texcoord);
-    } else {
-        albedo_color = color;
-    }
+#ifdef USE_TEXTURE
+    vec4 albedo_color = texture(albedo, texcoord);
+#else
+    vec4 albedo_color = color;
+#endif
 
     vec3 bitangent = cross(tangent, normal);
     mat3 tbn = mat3(tangent, bitangent, normal);
@@ -111,21 +108,28 @@ void main() {
 )";
 
 struct mouse_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
 
-    GLuint roughness_texture, normal_texture;
+    asset_cache::texture_handle_t roughness_texture, normal_texture;
+
+    // permutations of the program, indexed by textured: USE_TEXTURE samples albedo instead of a flat color
+    struct variant_t {
+        GLuint program;
+        GLuint model_location, albedo_location, color_location, roughness_texture_location, normal_texture_location;
+        GLuint bones_location;
+    };
 
-    GLuint camera_position_location;
-    GLuint albedo_location, color_location, use_texture_location, roughness_texture_location, normal_texture_location;
-    GLuint bones_location;
+    std::array <variant_t, 2> variants;
 
     gltf_model animodel;
     std::vector <gltf_mesh> meshes;
-    std::map <std::string, GLuint> textures;
+    std::map <std::string, asset_cache::texture_handle_t> textures;
+
+    // of the bind pose, for the textures' on-screen size
+    float size = 0.f;
 
     const float scale = .5f;
     const float move_speed = 7.2f;
@@ -145,27 +149,32 @@ struct mouse_t : entity::entity {
     const float animation_start = 1.33333f;
     const float animation_stop = 2.125f;
     const float animation_speed = 3.f;
+    float animation_time = 0.f;
+
+    // the bone palette is evaluated on the simulation thread along with the transform
+    struct snapshot_t {
+        float angle;
+        glm::vec3 position;
+        std::vector <glm::mat4x3> bones;
+    };
+
+    std::array <snapshot_t, frame_pipeline::slots_cnt> snapshots;
 
     mouse_t(int object_index) {
         (void)object_index;
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
-
-        model_location = glGetUniformLocation(program, "model");
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
-        camera_position_location = glGetUniformLocation(program, "camera_position");
-        albedo_location = glGetUniformLocation(program, "albedo");
-        color_location = glGetUniformLocation(program, "color");
-        use_texture_location = glGetUniformLocation(program, "use_texture");
-        roughness_texture_location = glGetUniformLocation(program, "roughness_texture");
-        normal_texture_location = glGetUniformLocation(program, "normal_texture");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
-        bones_location = glGetUniformLocation(program, "bones");
+        for (int i = 0; i < (int)variants.size(); i++) {
+            variant_t &variant = variants[i];
+            variant.program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source,
+                i ? std::vector <std::string>{"USE_TEXTURE"} : std::vector <std::string>{});
+
+            variant.model_location = glGetUniformLocation(variant.program, "model");
+            variant.albedo_location = glGetUniformLocation(variant.program, "albedo");
+            variant.color_location = glGetUniformLocation(variant.program, "color");
+            variant.roughness_texture_location = glGetUniformLocation(variant.program, "roughness_texture");
+            variant.normal_texture_location = glGetUniformLocation(variant.program, "normal_texture");
+            variant.bones_location = glGetUniformLocation(variant.program, "bones");
+        }
 
         std::string project_root = PROJECT_ROOT;
         const std::string model_path = project_root + "/models/mouse/W_hlmaus.gltf";
@@ -179,7 +188,7 @@ struct mouse_t : entity::entity {
         for (const auto &mesh : animodel.meshes) {
             auto &result = meshes.emplace_back();
             glGenVertexArrays(1, &result.vao);
-            glBindVertexArray(result.vao);
+            gl_state::cache().bind_vertex_array(result.vao);
 
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
             result.indices = mesh.indices;
@@ -203,19 +212,26 @@ struct mouse_t : entity::entity {
             result.material = mesh.material;
         }
 
+        if (!animodel.meshes.empty()) {
+            glm::vec3 min = animodel.meshes[0].min, max = animodel.meshes[0].max;
+            for (const auto &mesh : animodel.meshes) {
+                min = glm::min(min, mesh.min);
+                max = glm::max(max, mesh.max);
+            }
+            size = glm::length(max - min);
+        }
+
         for (auto const & mesh : meshes) {
             if (!mesh.material.texture_path)
                 continue;
 
-            if (textures.contains(*mesh.material.texture_path))
-                continue;
-
             auto path = std::filesystem::path(model_path).parent_path() / *mesh.material.texture_path;
 
-            textures[*mesh.material.texture_path] = load_texture(path.string());
+            textures[*mesh.material.texture_path] = asset_cache::cache().texture(path.string());
         }
-        roughness_texture = load_texture(project_root + "/models/mouse/Feldmaus_Rough.png");
-        normal_texture = load_texture(project_root + "/models/mouse/Feldmaus_Normal.png");
+        // the shader reads only the red channel of the roughness
+        roughness_texture = asset_cache::cache().texture(project_root + "/models/mouse/Feldmaus_Rough.png", {.usage = texture_usage::mask});
+        normal_texture = asset_cache::cache().texture(project_root + "/models/mouse/Feldmaus_Normal.png", {.usage = texture_usage::normal});
 
         random_engine.seed(std::time(0));
     }
@@ -241,7 +257,9 @@ struct mouse_t : entity::entity {
     }
 
     void update_state(float time, float dt, std::map <SDL_Keycode, bool> &button_down) {
-        (void)time; (void)button_down;
+        (void)button_down;
+
+        animation_time = time;
 
         if (std::max(abs(position.x), abs(position.z)) > board_size) {
             update_moving_direction(false);
@@ -255,26 +273,16 @@ struct mouse_t : entity::entity {
         distance_left -= move_speed * dt;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        glm::mat4 model = glm::mat4(1.f);
-        model = glm::translate(model, position);
-        model = glm::rotate(model, angle, {0.f, 1.f, 0.f});
-        model = glm::scale(model, glm::vec3(scale));
+    void capture(std::size_t slot) {
+        snapshot_t &snapshot = snapshots[slot];
+        snapshot.angle = angle;
+        snapshot.position = position;
 
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        std::vector <glm::mat4x3> &bones = snapshot.bones;
+        bones.assign(animodel.bones.size(), glm::mat3x4(scale));
 
-        std::vector <glm::mat4x3> bones(animodel.bones.size(), glm::mat3x4(scale));
-
-        auto run_animation = animodel.animations.at("Gallopp 33-52");
-        float phase = animation_start + std::fmod(time * animation_speed, animation_stop - animation_start);
+        const auto &run_animation = animodel.animations.at("Gallopp 33-52");
+        float phase = animation_start + std::fmod(animation_time * animation_speed, animation_stop - animation_start);
 
         for (int i = 0; i < bones.size(); i++) {
             glm::mat4 translation = glm::translate(glm::mat4(1.f), run_animation.bones[i].translation(phase));
@@ -292,61 +300,62 @@ struct mouse_t : entity::entity {
         for (int i = 0; i < bones.size(); i++) {
             bones[i] = bones[i] * animodel.bones[i].inverse_bind_matrix;
         }
+    }
+
+    void draw(const frame_uniforms::block_t &frame) {
+        const snapshot_t &drawn = snapshots[drawn_slot];
+
+        glm::mat4 model = glm::mat4(1.f);
+        model = glm::translate(model, drawn.position);
+        model = glm::rotate(model, drawn.angle, {0.f, 1.f, 0.f});
+        model = glm::scale(model, glm::vec3(scale));
 
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<const float*>(&camera_position));
-        glUniform1i(albedo_location, 0);
-        glUniform1i(roughness_texture_location, 1);
-        glUniform1i(normal_texture_location, 2);
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(light_color_location, 1, reinterpret_cast<const float*>(&light_color));
-        glUniform3fv(ambient_light_color_location, 1, reinterpret_cast<const float*>(&ambient_light_color));
-        glUniformMatrix4x3fv(bones_location, bones.size(), GL_FALSE, reinterpret_cast<const float*>(bones.data()));
-
-        auto draw_meshes = [&](bool transparent) {
-            for (auto const & mesh : meshes) {
-                if (mesh.material.transparent != transparent)
-                    continue;
-
-                if (mesh.material.two_sided)
-                    glDisable(GL_CULL_FACE);
-                else
-                    glEnable(GL_CULL_FACE);
-
-                if (transparent)
-                    glEnable(GL_BLEND);
-                else
-                    glDisable(GL_BLEND);
-
-                if (mesh.material.texture_path) {
-                    glBindTexture(GL_TEXTURE_2D, textures[*mesh.material.texture_path]);
-                    glUniform1i(use_texture_location, 1);
-                    glUniform1i(albedo_location, 0);
-                } else if (mesh.material.color) {
-                    glUniform1i(use_texture_location, 0);
-                    glUniform4fv(color_location, 1, reinterpret_cast<const float*>(&(*mesh.material.color)));
-                } else
-                    continue;
-
-                glBindVertexArray(mesh.vao);
-                glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void*>(mesh.indices.view.offset));
+        // locations differ between the permutations, so does the shared range
+        std::array <render_queue::uniform_range_t, 2> shared;
+        for (int i = 0; i < (int)variants.size(); i++) {
+            render_queue::uniform_writer_t uniforms = render_queue_ptr->uniforms();
+            uniforms.set(variants[i].model_location, model)
+                .set(variants[i].roughness_texture_location, 1)
+                .set(variants[i].normal_texture_location, 2)
+                .set(variants[i].bones_location, drawn.bones);
+            if (i) {
+                uniforms.set(variants[i].albedo_location, 0);
             }
-        };
+            shared[i] = uniforms;
+        }
+        float depth = render_queue_ptr->distance(drawn.position);
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, roughness_texture);
+        for (auto const & mesh : meshes) {
+            if (!mesh.material.texture_path && !mesh.material.color)
+                continue;
 
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, normal_texture);
+            bool transparent = mesh.material.transparent;
+            int textured = mesh.material.texture_path ? 1 : 0;
+            render_queue::packet_t &packet = render_queue_ptr->submit(
+                transparent ? render_queue::layer_t::transparent : render_queue::layer_t::opaque, variants[textured].program, mesh.vao);
+            packet.state = render_queue::depth_test | \
+                (transparent ? render_queue::blend : render_queue::depth_write) | \
+                (mesh.material.two_sided ? 0 : render_queue::cull_face);
+            packet.textures[1] = {GL_TEXTURE_2D, roughness_texture.get()};
+            packet.textures[2] = {GL_TEXTURE_2D, normal_texture.get()};
+            packet.depth = depth;
+            packet.shared_uniforms = shared[textured];
+
+            if (mesh.material.texture_path) {
+                packet.textures[0] = {GL_TEXTURE_2D, textures[*mesh.material.texture_path].get()};
+            } else {
+                packet.uniforms = render_queue_ptr->uniforms().set(variants[textured].color_location, *mesh.material.color);
+            }
 
-        glActiveTexture(GL_TEXTURE0);
-        draw_meshes(false);
-        glDepthMask(GL_FALSE);
-        draw_meshes(true);
-        glDepthMask(GL_TRUE);
+            packet.draw_elements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, mesh.indices.view.offset);
+        }
+
+        float pixels = asset_cache::cache().projected_pixels(frame.projection, size * scale, glm::distance(frame.camera_position, drawn.position));
+        asset_cache::cache().request(roughness_texture, pixels);
+        asset_cache::cache().request(normal_texture, pixels);
+        for (auto &[path, texture] : textures) {
+            asset_cache::cache().request(texture, pixels);
+        }
     }
 };
 
@@ -0,0 +1,165 @@
+// Offline packing: cooks everything under models/ into models.pack (see asset_pack.hpp), which the
+// game maps at startup instead of opening, decoding and parsing every file on its own.
+//
+//   asset-pack [--threads N] [--output PATH]
+//
+// Textures are compressed as texture-cook does, reusing its .bctex files when they are up to date.
+// OBJ meshes are parsed into the vertex and index arrays the game uploads, glTF files and volumes
+// are stored as they are. Generated caches (.bctex, .mips, .impostor) are left out.
+
+#include "asset_pack.hpp"
+#include "block_compression.hpp"
+#include "obj_parser.hpp"
+#include "thread_pool.hpp"
+#include "stb_image.h"
+
+#include <filesystem>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+struct options_t {
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::filesystem::path output = asset_pack::models_path();
+};
+
+options_t parse_args(int argc, char **argv) {
+    options_t options;
+
+    auto value = [&](int &i) -> std::string {
+        if (i + 1 >= argc) {
+            throw std::runtime_error(std::string("missing value for ") + argv[i]);
+        }
+        return argv[++i];
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--threads") {
+            options.threads = std::max(1, std::stoi(value(i)));
+        } else if (arg == "--output") {
+            options.output = value(i);
+        } else {
+            throw std::runtime_error("unknown argument: " + arg);
+        }
+    }
+
+    return options;
+}
+
+std::string lowercase_extension(const std::filesystem::path &path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return extension;
+}
+
+std::vector <std::byte> read_file(const std::filesystem::path &path) {
+    std::vector <std::byte> result(std::filesystem::file_size(path));
+    std::ifstream input(path, std::ios::binary);
+    input.read(reinterpret_cast<char *>(result.data()), result.size());
+    if (!input) {
+        throw std::runtime_error("can't read " + path.string());
+    }
+    return result;
+}
+
+// the .bctex of the texture if it's up to date, compressed now otherwise; false if it can't be decoded
+bool cook_texture(const std::filesystem::path &path, thread_pool::thread_pool_t &pool, std::vector <std::byte> &data) {
+    compressed_texture texture;
+    if (!load_compressed_texture(texture, cooked_texture_path(path), path)) {
+        int width, height, channels;
+        unsigned char *pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+        if (!pixels) {
+            std::cerr << path.string() << ": " << stbi_failure_reason() << std::endl;
+            return false;
+        }
+        block_format format = choose_block_format(path, pixels, width, height);
+        texture = compress_texture(pixels, width, height, format, mip_settings_for(path), &pool);
+        stbi_image_free(pixels);
+    }
+
+    std::ostringstream output(std::ios::binary);
+    write_compressed_texture(texture, output);
+    std::string bytes = std::move(output).str();
+    data.resize(bytes.size());
+    std::memcpy(data.data(), bytes.data(), bytes.size());
+    return true;
+}
+
+}
+
+int main(int argc, char **argv) try {
+    options_t options = parse_args(argc, argv);
+    thread_pool::thread_pool_t pool(options.threads);
+
+    std::filesystem::path root = std::filesystem::path(PROJECT_ROOT) / "models";
+    std::vector <std::filesystem::path> paths;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(root)) {
+        if (entry.is_regular_file()) {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    asset_pack::pack_writer writer;
+    std::size_t textures = 0, meshes = 0, raw = 0, failed = 0, source_size = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (const auto &path : paths) {
+        std::string extension = lowercase_extension(path);
+        std::string name = path.lexically_relative(root).generic_string();
+
+        // stamped before cooking, a source changed meanwhile shows up as stale
+        std::optional <asset_pack::source_stamp> source = asset_pack::stamp_of(path);
+        if (!source) {
+            std::cerr << "can't stat " << path.string() << std::endl;
+            failed++;
+            continue;
+        }
+
+        if (extension == ".jpg" || extension == ".png") {
+            std::vector <std::byte> data;
+            if (!cook_texture(path, pool, data)) {
+                failed++;
+                continue;
+            }
+            writer.add(name, asset_pack::entry_kind::texture, std::move(data), *source);
+            textures++;
+        } else if (extension == ".obj") {
+            obj_data model = parse_obj(path);
+            writer.add_mesh(name, model.vertices.data(), sizeof(obj_data::vertex), model.vertices.size(), \
+                model.indices.data(), model.indices.size(), *source);
+            meshes++;
+        } else if (extension == ".gltf" || extension == ".bin" || extension == ".data") {
+            writer.add(name, asset_pack::entry_kind::raw, read_file(path), *source);
+            raw++;
+        } else {
+            continue;
+        }
+        source_size += source->size;
+    }
+
+    writer.write(options.output);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::fixed << std::setprecision(1) << "packed " << textures << " textures, " << meshes << " meshes, " << raw \
+              << " raw files (" << source_size / 1024 << " KiB of sources) into " << options.output.string() << ", " \
+              << std::filesystem::file_size(options.output) / 1024 << " KiB, in " << seconds << " s" << std::endl;
+
+    return failed == 0 ? 0 : 1;
+} catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
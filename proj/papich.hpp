@@ -5,8 +5,10 @@
 #include <glm/gtx/rotate_vector.hpp>
 
 #include <string>
+#include <array>
 
 #include "common_util.hpp"
+#include "asset_cache.hpp"
 #include "obj_parser.hpp"
 
 #include "entity.hpp"
@@ -15,10 +17,9 @@ namespace papich {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
@@ -38,13 +39,10 @@ void main() {
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform sampler2D albedo_texture;
 
-uniform vec3 light_direction;
-uniform vec3 light_color;
-uniform vec3 ambient_light_color;
-
 in vec3 position;
 in vec3 normal;
 in vec2 texcoord;
@@ -62,16 +60,18 @@ void main() {
 struct papich_t : entity::entity {
     using vertex = obj_data::vertex;
 
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
 
-    GLuint texture;
+    asset_cache::texture_handle_t texture;
     
     GLuint texture_location;
 
+    // of the model around its origin, for the texture's on-screen size
+    float radius = 0.f;
+
     const float scale = 1.f;
     const float std_turn_speed = 1.f;
     const float fast_turn_speed = 2.f;
@@ -81,26 +81,44 @@ struct papich_t : entity::entity {
     float angle = -glm::pi<float>() / 2.f;
     glm::vec3 position{0.f, 1.01f, 0.f};
 
+    struct snapshot_t {
+        float angle;
+        glm::vec3 position;
+    };
+
+    std::array <snapshot_t, frame_pipeline::slots_cnt> snapshots;
+
     papich_t(int object_index) {
         (void)object_index;
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        update_writes.push_back(&::entity::button_down_resource);
+
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
         model_location = glGetUniformLocation(program, "model");
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
         texture_location = glGetUniformLocation(program, "albedo_texture");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
 
+        // the pack holds the vertices and indices as they go to the buffers, parsed once by asset-pack
         std::string project_root = PROJECT_ROOT;
-        obj_data model = parse_obj(project_root + "/models/papich/papich.obj");
+        std::string model_path = project_root + "/models/papich/papich.obj";
+        const asset_pack::pack_file *pack = asset_pack::models();
+        std::optional <asset_pack::mesh_view> packed = pack ? pack->find_mesh(model_path) : std::nullopt;
+
+        // views into the pack or into model, taken out of the optional once
+        obj_data model;
+        std::span <const vertex> vertices;
+        std::span <const std::uint32_t> indices;
+        if (packed && packed->vertex_size == sizeof(vertex)) {
+            vertices = {reinterpret_cast<const vertex *>(packed->vertices.data()), packed->vertices.size() / sizeof(vertex)};
+            indices = packed->indices;
+        } else {
+            model = parse_obj(model_path);
+            vertices = model.vertices;
+            indices = model.indices;
+        }
 
         glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
+        gl_state::cache().bind_vertex_array(vao);
 
         glGenBuffers(1, &vbo);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
@@ -115,13 +133,17 @@ struct papich_t : entity::entity {
         glEnableVertexAttribArray(2);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)offsetof(vertex, texcoord));
 
-        glBufferData(GL_ARRAY_BUFFER, model.vertices.size() * sizeof(vertex), model.vertices.data(), GL_STATIC_DRAW);
+        for (const vertex &v : vertices) {
+            radius = std::max(radius, glm::length(glm::vec3(v.position[0], v.position[1], v.position[2])));
+        }
 
-        indices_count = model.indices.size();
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_count * sizeof(std::uint32_t), model.indices.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size_bytes(), vertices.data(), GL_STATIC_DRAW);
+
+        indices_count = indices.size();
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size_bytes(), indices.data(), GL_STATIC_DRAW);
 
         std::string texture_path = project_root + "/models/papich/papich.jpg";
-        texture = load_texture(texture_path);
+        texture = asset_cache::cache().texture(texture_path);
     }
 
     void update_state(float time, float dt, std::map <SDL_Keycode, bool> &button_down) {
@@ -154,36 +176,29 @@ struct papich_t : entity::entity {
         }
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)camera_position; (void)time;
+    void capture(std::size_t slot) {
+        snapshots[slot] = {angle, position};
+    }
+
+    void draw(const frame_uniforms::block_t &frame) {
+        const snapshot_t &drawn = snapshots[drawn_slot];
 
         glm::mat4 model = glm::mat4(1.f);
-        model = glm::translate(model, position);
-        model = glm::rotate(model, angle, {0.f, 1.f, 0.f});
+        model = glm::translate(model, drawn.position);
+        model = glm::rotate(model, drawn.angle, {0.f, 1.f, 0.f});
         model = glm::scale(model, glm::vec3(scale));
 
-        glEnable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glDisable(GL_BLEND);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(light_color_location, 1, reinterpret_cast<const float*>(&light_color));
-        glUniform3fv(ambient_light_color_location, 1, reinterpret_cast<const float*>(&ambient_light_color));
-        glUniform1i(texture_location, 0);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, indices_count, GL_UNSIGNED_INT, nullptr);
+        render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::opaque, program, vao);
+        packet.state = render_queue::depth_test | render_queue::depth_write;
+        packet.textures[0] = {GL_TEXTURE_2D, texture.get()};
+        packet.depth = render_queue_ptr->distance(drawn.position);
+        packet.uniforms = render_queue_ptr->uniforms()
+            .set(model_location, model)
+            .set(texture_location, 0);
+        packet.draw_elements(GL_TRIANGLES, indices_count, GL_UNSIGNED_INT, 0);
+
+        float distance = glm::distance(frame.camera_position, drawn.position);
+        asset_cache::cache().request(texture, asset_cache::cache().projected_pixels(frame.projection, 2.f * radius * scale, distance));
     }
 };
 
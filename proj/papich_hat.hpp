@@ -18,10 +18,9 @@ namespace papich_hat {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
@@ -38,13 +37,10 @@ void main() {
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform vec4 albedo;
 
-uniform vec3 light_direction;
-uniform vec3 light_color;
-uniform vec3 ambient_light_color;
-
 in vec3 position;
 in vec3 normal;
 
@@ -58,10 +54,9 @@ void main() {
 )";
 
 struct papich_hat_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
 
     GLuint albedo_location;
@@ -78,18 +73,12 @@ struct papich_hat_t : entity::entity {
         (void)object_index;
 
         papich_ptr = papich;
+        update_reads.push_back(static_cast<entity *>(papich));
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
+        program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source);
 
         model_location = glGetUniformLocation(program, "model");
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
         albedo_location = glGetUniformLocation(program, "albedo");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
 
         std::string project_root = PROJECT_ROOT;
         const std::string model_path = project_root + "/models/papich_hat/hat.gltf";
@@ -103,7 +92,7 @@ struct papich_hat_t : entity::entity {
         for (auto const &mesh : hat.meshes) {
             auto &result = meshes.emplace_back();
             glGenVertexArrays(1, &result.vao);
-            glBindVertexArray(result.vao);
+            gl_state::cache().bind_vertex_array(result.vao);
 
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
             result.indices = mesh.indices;
@@ -120,61 +109,35 @@ struct papich_hat_t : entity::entity {
         (void)time; (void)dt; (void)button_down;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
-        (void)camera_position;
+    void draw(const frame_uniforms::block_t &frame) {
+        // papich captured the same slot
+        const papich::papich_t::snapshot_t &papich = papich_ptr->snapshots[drawn_slot];
 
         glm::mat4 model = glm::mat4(1.f);
-        model = glm::translate(model, papich_ptr->position + glm::vec3(0.f, 1.f + sin(2 * time) / 3.f, 0.f));
-        model = glm::rotate(model, papich_ptr->angle + correction_angle, {0.f, 1.f, 0.f});
+        model = glm::translate(model, papich.position + glm::vec3(0.f, 1.f + sin(2 * frame.time) / 3.f, 0.f));
+        model = glm::rotate(model, papich.angle + correction_angle, {0.f, 1.f, 0.f});
         model = glm::scale(model, glm::vec3(scale));
 
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-        glDisable(GL_BLEND);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(light_color_location, 1, reinterpret_cast<const float*>(&light_color));
-        glUniform3fv(ambient_light_color_location, 1, reinterpret_cast<const float*>(&ambient_light_color));
-
-        auto draw_meshes = [&](bool transparent) {
-            for (auto const & mesh : meshes) {
-                if (mesh.material.transparent != transparent)
-                    continue;
-
-                if (mesh.material.two_sided)
-                    glDisable(GL_CULL_FACE);
-                else
-                    glEnable(GL_CULL_FACE);
-
-                if (transparent)
-                    glEnable(GL_BLEND);
-                else
-                    glDisable(GL_BLEND);
-
-                if (mesh.material.color) {
-                    glUniform4fv(albedo_location, 1, reinterpret_cast<const float*>(&(*mesh.material.color)));
-                } else {
-                    continue;
-                }
-
-                glBindVertexArray(mesh.vao);
-                glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void*>(mesh.indices.view.offset));
-            }
-        };
-
-        draw_meshes(false);
-        glDepthMask(GL_FALSE);
-        draw_meshes(true);
-        glDepthMask(GL_TRUE);
+        render_queue::uniform_range_t shared = render_queue_ptr->uniforms()
+            .set(model_location, model);
+        float depth = render_queue_ptr->distance(glm::vec3(model[3]));
+
+        for (auto const & mesh : meshes) {
+            if (!mesh.material.color)
+                continue;
+
+            // transparent meshes are blended over everything opaque and don't write depth
+            bool transparent = mesh.material.transparent;
+            render_queue::packet_t &packet = render_queue_ptr->submit(
+                transparent ? render_queue::layer_t::transparent : render_queue::layer_t::opaque, program, mesh.vao);
+            packet.state = render_queue::depth_test | \
+                (transparent ? render_queue::blend : render_queue::depth_write) | \
+                (mesh.material.two_sided ? 0 : render_queue::cull_face);
+            packet.depth = depth;
+            packet.shared_uniforms = shared;
+            packet.uniforms = render_queue_ptr->uniforms().set(albedo_location, *mesh.material.color);
+            packet.draw_elements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, mesh.indices.view.offset);
+        }
     }
 };
 
@@ -0,0 +1,458 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/mat4x3.hpp>
+#include <glm/geometric.hpp>
+
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <bit>
+#include <iostream>
+
+#include "gl_state.hpp"
+
+namespace render_queue {
+
+// Packets are replayed layer by layer: the background first, then opaque geometry front to back,
+// then transparent geometry back to front, then the overlay. Background and overlay packets keep
+// their submission order.
+enum class layer_t : std::uint8_t {
+    background,
+    opaque,
+    transparent,
+    overlay,
+};
+
+enum state_bits : std::uint8_t {
+    depth_test = 1,
+    depth_write = 2,
+    cull_face = 4,
+    blend = 8,
+};
+
+struct uniform_range_t {
+    std::uint32_t first = 0, cnt = 0;
+};
+
+// Everything needed to issue one draw call. Textures are indexed by texture unit, id 0 leaves the
+// unit alone. Uniforms live in the queue, a range of them can be shared between packets.
+struct packet_t {
+    layer_t layer = layer_t::opaque;
+    std::uint8_t state = depth_test | depth_write;
+
+    GLuint program = 0, vao = 0;
+    std::array <std::pair <GLenum, GLuint>, 3> textures{};
+
+    GLenum mode = GL_TRIANGLES;
+    GLenum index_type = 0;          // 0 for glDrawArrays
+    GLsizei count = 0;              // commands for a multi-draw
+    std::uintptr_t offset = 0;      // first vertex for arrays, byte offset into the index buffer for elements,
+                                    // byte offset into indirect_buffer for a multi-draw
+    GLsizei instances = 0;          // 0 for a non-instanced draw
+    GLuint indirect_buffer = 0;     // non-zero for glMultiDrawElementsIndirect
+
+    // distance to the camera, see render_queue_t::distance
+    float depth = 0.f;
+
+    uniform_range_t shared_uniforms, uniforms;
+
+    void draw_arrays(GLenum draw_mode, GLint first, GLsizei vertices_cnt, GLsizei instances_cnt = 0) {
+        mode = draw_mode;
+        index_type = 0;
+        offset = first;
+        count = vertices_cnt;
+        instances = instances_cnt;
+        indirect_buffer = 0;
+    }
+
+    void draw_elements(GLenum draw_mode, GLsizei indices_cnt, GLenum type, std::uintptr_t byte_offset, GLsizei instances_cnt = 0) {
+        mode = draw_mode;
+        index_type = type;
+        offset = byte_offset;
+        count = indices_cnt;
+        instances = instances_cnt;
+        indirect_buffer = 0;
+    }
+
+    // commands_cnt indirect_batch::command_t at byte_offset in buffer, see indirect_batch::supported
+    void multi_draw_elements_indirect(GLenum draw_mode, GLenum type, GLuint buffer, std::uintptr_t byte_offset, GLsizei commands_cnt) {
+        mode = draw_mode;
+        index_type = type;
+        offset = byte_offset;
+        count = commands_cnt;
+        instances = 0;
+        indirect_buffer = buffer;
+    }
+};
+
+struct stats_t {
+    std::uint64_t packets = 0;
+
+    // state changes issued to GL while replaying the sorted packets and the ones gl_state skipped
+    // because the state was already set
+    std::uint64_t issued = 0, elided = 0;
+    std::uint64_t uniforms_issued = 0, uniforms_elided = 0;
+
+    // program, VAO, texture and capability changes the same packets would need in submission order
+    std::uint64_t unsorted_changes = 0;
+
+    // glDraw* calls issued, the multi-draws among them and the commands they carried
+    std::uint64_t draw_calls = 0, multi_draws = 0, batched_draws = 0;
+
+    // draw calls without multi-draw, one per command
+    std::uint64_t unbatched_draw_calls() const {
+        return draw_calls - multi_draws + batched_draws;
+    }
+
+    void reset() {
+        *this = stats_t();
+    }
+
+    stats_t &operator+=(const stats_t &other) {
+        packets += other.packets;
+        issued += other.issued;
+        elided += other.elided;
+        uniforms_issued += other.uniforms_issued;
+        uniforms_elided += other.uniforms_elided;
+        unsorted_changes += other.unsorted_changes;
+        draw_calls += other.draw_calls;
+        multi_draws += other.multi_draws;
+        batched_draws += other.batched_draws;
+        return *this;
+    }
+};
+
+struct render_queue_t;
+
+// Records uniforms into the queue, the recorded values form one range:
+//     uniform_range_t shared = queue.uniforms().set(view_location, view).set(projection_location, projection);
+struct uniform_writer_t {
+    render_queue_t &queue;
+    std::uint32_t first;
+
+    uniform_writer_t &set(GLint location, float value);
+    uniform_writer_t &set(GLint location, int value);
+    uniform_writer_t &set(GLint location, const glm::vec2 &value);
+    uniform_writer_t &set(GLint location, const glm::ivec2 &value);
+    uniform_writer_t &set(GLint location, const glm::vec3 &value);
+    uniform_writer_t &set(GLint location, const glm::vec4 &value);
+    uniform_writer_t &set(GLint location, const glm::mat4 &value);
+    uniform_writer_t &set(GLint location, const std::vector <glm::mat4x3> &value);
+
+    // vectors without an overload of their own would convert to a float one and be replayed with
+    // glUniform*fv, which an integer uniform rejects
+    template <glm::length_t L, typename T, glm::qualifier Q>
+    uniform_writer_t &set(GLint location, const glm::vec <L, T, Q> &value) = delete;
+
+    operator uniform_range_t() const;
+};
+
+struct render_queue_t {
+    // print stats every this many frames, 0 disables reporting
+    int report_period = 600;
+
+    stats_t stats, frame_stats;
+    int frames_since_report = 0;
+
+    // depth of packets is quantized over [0, far_plane]
+    void begin_frame(const glm::vec3 &camera_position, float far_plane) {
+        camera = camera_position;
+        far = far_plane;
+    }
+
+    float distance(const glm::vec3 &position) const {
+        return glm::length(position - camera);
+    }
+
+    uniform_writer_t uniforms() {
+        return {*this, (std::uint32_t)uniform_list.size()};
+    }
+
+    packet_t &submit(layer_t layer, GLuint program, GLuint vao) {
+        packets.emplace_back();
+        packet_t &packet = packets.back();
+        packet.layer = layer;
+        packet.program = program;
+        packet.vao = vao;
+        return packet;
+    }
+
+    // Sorts and issues everything submitted since the last flush.
+    void flush() {
+        frame_stats.reset();
+        frame_stats.packets = packets.size();
+
+        order.resize(packets.size());
+        keys.resize(packets.size());
+        for (std::size_t i = 0; i < packets.size(); i++) {
+            order[i] = i;
+            keys[i] = sort_key(packets[i], i);
+        }
+        frame_stats.unsorted_changes = count_changes();
+
+        std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+            return keys[a] < keys[b];
+        });
+
+        gl_state::state_cache_t &gl = gl_state::cache();
+        std::uint64_t issued = gl.frame_stats.total_issued(), elided = gl.frame_stats.total_elided();
+
+        current_uniforms.clear();
+        gl.cull_face(GL_BACK);
+        gl.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        for (std::uint32_t index : order) {
+            replay(packets[index]);
+        }
+
+        // leave GL as the rest of the frame (clears, post-processing) expects it
+        gl.enable(GL_DEPTH_TEST);
+        gl.depth_mask(GL_TRUE);
+        gl.bind_vertex_array(0);
+        gl.active_texture(GL_TEXTURE0);
+
+        frame_stats.issued = gl.frame_stats.total_issued() - issued;
+        frame_stats.elided = gl.frame_stats.total_elided() - elided;
+
+        packets.clear();
+        uniform_list.clear();
+        uniform_data.clear();
+
+        stats += frame_stats;
+        if (report_period > 0 && ++frames_since_report >= report_period) {
+            report(std::cerr);
+            stats.reset();
+            frames_since_report = 0;
+        }
+    }
+
+    void report(std::ostream &out) const {
+        std::uint64_t frames = std::max(1, frames_since_report);
+        std::uint64_t sorted_changes = stats.issued;
+        out << "render queue: " << stats.packets / frames << " packets/frame, " \
+            << stats.issued / frames << " state changes/frame (" << stats.elided / frames << " elided), " \
+            << stats.uniforms_issued / frames << " uniform uploads/frame (" << stats.uniforms_elided / frames << " elided), " \
+            << "sorting saved " << (stats.unsorted_changes > sorted_changes ? (stats.unsorted_changes - sorted_changes) / frames : 0) << " changes/frame, " \
+            << stats.draw_calls / frames << " draw calls/frame (" << stats.unbatched_draw_calls() / frames << " without multi-draw)" << std::endl;
+    }
+
+private:
+    friend struct uniform_writer_t;
+
+    enum class uniform_type_t : std::uint8_t {
+        float1, float2, float3, float4, int1, int2, mat4, mat4x3,
+    };
+
+    struct uniform_t {
+        GLint location;
+        uniform_type_t type;
+        GLsizei cnt;
+        std::uint32_t data, size;
+    };
+
+    std::vector <packet_t> packets;
+    std::vector <uniform_t> uniform_list;
+    std::vector <std::uint32_t> uniform_data;
+
+    std::vector <std::uint32_t> order;
+    std::vector <std::uint64_t> keys;
+
+    glm::vec3 camera{0.f};
+    float far = 100.f;
+
+    // last values uploaded to every (program, location) during replay, reset every flush
+    std::unordered_map <std::uint64_t, std::vector <std::uint32_t>> current_uniforms;
+
+    void add_uniform(GLint location, uniform_type_t type, GLsizei cnt, const void *data, std::size_t size) {
+        uniform_t uniform{location, type, cnt, (std::uint32_t)uniform_data.size(), (std::uint32_t)(size / sizeof(std::uint32_t))};
+        uniform_data.resize(uniform_data.size() + uniform.size);
+        std::memcpy(uniform_data.data() + uniform.data, data, size);
+        uniform_list.push_back(uniform);
+    }
+
+    // layer (2 bits) | per-layer order (44 bits) | submission index (18 bits)
+    std::uint64_t sort_key(const packet_t &packet, std::size_t index) const {
+        std::uint64_t depth = (std::uint64_t)(std::clamp(packet.depth / far, 0.f, 1.f) * 65535.f);
+        std::uint64_t program = packet.program & 0x3ff;
+        std::uint64_t texture = packet.textures[0].second & 0xfff;
+
+        std::uint64_t order_bits = 0;
+        switch (packet.layer) {
+        case layer_t::opaque:
+            // state (6) | program (10) | texture (12) | depth front to back (16)
+            order_bits = (std::uint64_t)(packet.state & 0x3f) << 38 | program << 28 | texture << 16 | depth;
+            break;
+        case layer_t::transparent:
+            // depth back to front (16) | program (10) | texture (12)
+            order_bits = (65535 - depth) << 22 | program << 12 | texture;
+            break;
+        default:
+            break;
+        }
+
+        return (std::uint64_t)packet.layer << 62 | order_bits << 18 | (index & 0x3ffff);
+    }
+
+    // program, VAO, texture and capability changes needed to draw the packets in `order`, roughly
+    // what gl_state would issue for them
+    std::uint64_t count_changes() const {
+        std::uint64_t changes = 0;
+
+        GLuint program = ~0u, vao = ~0u;
+        std::uint8_t state = 0;
+        std::array <std::pair <GLenum, GLuint>, 3> textures;
+        textures.fill({0, ~0u});
+
+        for (std::size_t i = 0; i < order.size(); i++) {
+            const packet_t &packet = packets[order[i]];
+            if (i == 0) {
+                state = ~packet.state & 0x0f;
+            }
+
+            changes += packet.program != program;
+            changes += packet.vao != vao;
+            changes += std::popcount((unsigned)(packet.state ^ state));
+            program = packet.program;
+            vao = packet.vao;
+            state = packet.state;
+
+            for (std::size_t unit = 0; unit < packet.textures.size(); unit++) {
+                if (packet.textures[unit].second != 0 && packet.textures[unit] != textures[unit]) {
+                    textures[unit] = packet.textures[unit];
+                    changes++;
+                }
+            }
+        }
+        return changes;
+    }
+
+    void apply_state(std::uint8_t state) {
+        gl_state::state_cache_t &gl = gl_state::cache();
+        gl.set(GL_DEPTH_TEST, state & depth_test);
+        gl.depth_mask((state & depth_write) ? GL_TRUE : GL_FALSE);
+        gl.set(GL_CULL_FACE, state & cull_face);
+        gl.set(GL_BLEND, state & blend);
+    }
+
+    void apply_uniforms(GLuint program, const uniform_range_t &range) {
+        for (std::uint32_t i = range.first; i < range.first + range.cnt; i++) {
+            const uniform_t &uniform = uniform_list[i];
+            const std::uint32_t *data = uniform_data.data() + uniform.data;
+
+            auto &current = current_uniforms[(std::uint64_t)program << 32 | (std::uint32_t)uniform.location];
+            if (current.size() == uniform.size && std::equal(current.begin(), current.end(), data)) {
+                frame_stats.uniforms_elided++;
+                continue;
+            }
+            current.assign(data, data + uniform.size);
+            frame_stats.uniforms_issued++;
+
+            const float *values = reinterpret_cast<const float*>(data);
+            switch (uniform.type) {
+            case uniform_type_t::float1: glUniform1fv(uniform.location, uniform.cnt, values); break;
+            case uniform_type_t::float2: glUniform2fv(uniform.location, uniform.cnt, values); break;
+            case uniform_type_t::float3: glUniform3fv(uniform.location, uniform.cnt, values); break;
+            case uniform_type_t::float4: glUniform4fv(uniform.location, uniform.cnt, values); break;
+            case uniform_type_t::int1: glUniform1iv(uniform.location, uniform.cnt, reinterpret_cast<const GLint*>(data)); break;
+            case uniform_type_t::int2: glUniform2iv(uniform.location, uniform.cnt, reinterpret_cast<const GLint*>(data)); break;
+            case uniform_type_t::mat4: glUniformMatrix4fv(uniform.location, uniform.cnt, GL_FALSE, values); break;
+            case uniform_type_t::mat4x3: glUniformMatrix4x3fv(uniform.location, uniform.cnt, GL_FALSE, values); break;
+            }
+        }
+    }
+
+    void replay(const packet_t &packet) {
+        gl_state::state_cache_t &gl = gl_state::cache();
+        gl.use_program(packet.program);
+
+        apply_state(packet.state);
+
+        for (GLuint unit = 0; unit < packet.textures.size(); unit++) {
+            const auto &texture = packet.textures[unit];
+            if (texture.second != 0) {
+                gl.bind_texture_unit(unit, texture.first, texture.second);
+            }
+        }
+
+        apply_uniforms(packet.program, packet.shared_uniforms);
+        apply_uniforms(packet.program, packet.uniforms);
+
+        gl.bind_vertex_array(packet.vao);
+
+        frame_stats.draw_calls++;
+
+        const void *offset = reinterpret_cast<const void*>(packet.offset);
+        if (packet.indirect_buffer) {
+            frame_stats.multi_draws++;
+            frame_stats.batched_draws += packet.count;
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, packet.indirect_buffer);
+            glMultiDrawElementsIndirect(packet.mode, packet.index_type, offset, packet.count, 0);
+        } else if (packet.index_type) {
+            if (packet.instances) {
+                glDrawElementsInstanced(packet.mode, packet.count, packet.index_type, offset, packet.instances);
+            } else {
+                glDrawElements(packet.mode, packet.count, packet.index_type, offset);
+            }
+        } else {
+            if (packet.instances) {
+                glDrawArraysInstanced(packet.mode, packet.offset, packet.count, packet.instances);
+            } else {
+                glDrawArrays(packet.mode, packet.offset, packet.count);
+            }
+        }
+    }
+};
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, float value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::float1, 1, &value, sizeof(value));
+    return *this;
+}
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, int value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::int1, 1, &value, sizeof(value));
+    return *this;
+}
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, const glm::vec2 &value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::float2, 1, &value, sizeof(value));
+    return *this;
+}
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, const glm::ivec2 &value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::int2, 1, &value, sizeof(value));
+    return *this;
+}
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, const glm::vec3 &value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::float3, 1, &value, sizeof(value));
+    return *this;
+}
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, const glm::vec4 &value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::float4, 1, &value, sizeof(value));
+    return *this;
+}
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, const glm::mat4 &value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::mat4, 1, &value, sizeof(value));
+    return *this;
+}
+
+inline uniform_writer_t &uniform_writer_t::set(GLint location, const std::vector <glm::mat4x3> &value) {
+    queue.add_uniform(location, render_queue_t::uniform_type_t::mat4x3, value.size(), value.data(), value.size() * sizeof(glm::mat4x3));
+    return *this;
+}
+
+inline uniform_writer_t::operator uniform_range_t() const {
+    return {first, (std::uint32_t)queue.uniform_list.size() - first};
+}
+
+}
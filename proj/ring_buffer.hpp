@@ -0,0 +1,250 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cassert>
+#include <iostream>
+
+namespace ring_buffer {
+
+// A piece of the ring for this frame: write `data`, commit it, then point attributes or index
+// draws at `offset` in `buffer`. The buffer name changes when the ring grows, so attributes are
+// re-pointed every frame.
+struct allocation_t {
+    GLuint buffer = 0;
+    std::size_t offset = 0, size = 0;
+    void *data = nullptr;
+
+    template <typename T>
+    T *as() const {
+        return static_cast<T*>(data);
+    }
+};
+
+struct stats_t {
+    std::uint64_t allocations = 0, bytes = 0;
+
+    // frames that had to wait for the GPU to release their region, and for how long
+    std::uint64_t stalls = 0;
+    double stall_ms = 0.0;
+
+    // fallback path: the buffer ran out and was orphaned
+    std::uint64_t orphans = 0;
+
+    // the region was too small for a frame and the buffer was reallocated
+    std::uint64_t grows = 0;
+
+    void reset() {
+        *this = stats_t();
+    }
+
+    stats_t &operator+=(const stats_t &other) {
+        allocations += other.allocations;
+        bytes += other.bytes;
+        stalls += other.stalls;
+        stall_ms += other.stall_ms;
+        orphans += other.orphans;
+        grows += other.grows;
+        return *this;
+    }
+};
+
+// Per-frame dynamic vertex, index and instance data.
+//
+// With GL 4.4 or ARB_buffer_storage the buffer is mapped once, persistently, and split into
+// `frames` regions used round-robin: a frame writes into its region while the GPU still reads the
+// previous ones, and a region is reused only once the fence of the frame that last wrote it has
+// signaled. Waiting for it is counted as a stall.
+//
+// Otherwise every allocation is mapped unsynchronized right after the previous one, and when the
+// buffer is full it's orphaned: the driver hands out fresh storage instead of waiting for the old.
+//
+// All buffer operations go through GL_COPY_WRITE_BUFFER, so they don't disturb the array buffer
+// binding or the element buffer of the bound VAO.
+//
+// Only one allocation may be outstanding: commit it before the next allocate(). The fallback path
+// maps every allocation and a buffer can't be mapped twice, and growing deletes the buffer earlier
+// allocations point into. Data drawn together goes into one allocation, split by offsets.
+struct ring_buffer_t {
+    static const int frames = 3;
+
+    // print stats every this many frames, 0 disables reporting
+    int report_period = 600;
+    const char *name;
+
+    stats_t stats, frame_stats;
+    int frames_since_report = 0;
+
+    ring_buffer_t(const char *name, std::size_t frame_capacity, bool allow_persistent = true)
+        : name(name)
+    {
+        persistent = allow_persistent && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+        create(align(frame_capacity, region_alignment));
+    }
+
+    ring_buffer_t(const ring_buffer_t &) = delete;
+    ring_buffer_t &operator=(const ring_buffer_t &) = delete;
+
+    bool is_persistent() const {
+        return persistent;
+    }
+
+    GLuint buffer() const {
+        return buffer_id;
+    }
+
+    // Call once per frame before the first allocate(). Fences everything issued since the last
+    // call, which includes the draws reading the previous region, and moves to the next region.
+    void next_frame() {
+        if (persistent) {
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+            region = (region + 1) % frames;
+            cursor = region * capacity;
+            wait(region);
+        }
+
+        stats += frame_stats;
+        frame_stats.reset();
+        if (report_period > 0 && ++frames_since_report >= report_period) {
+            report(std::cerr);
+            stats.reset();
+            frames_since_report = 0;
+        }
+    }
+
+    allocation_t allocate(std::size_t size, std::size_t alignment = 16) {
+        if (size == 0) {
+            return {buffer_id, 0, 0, nullptr};
+        }
+        assert(!outstanding && "commit the previous allocation first");
+        outstanding = true;
+
+        frame_stats.allocations++;
+        frame_stats.bytes += size;
+
+        if (persistent) {
+            std::size_t offset = align(cursor, alignment);
+            if (offset + size > (region + 1) * capacity) {
+                // the new buffer is empty, so this frame starts over at the beginning of region 0
+                grow(size + alignment);
+                offset = 0;
+            }
+            cursor = offset + size;
+            return {buffer_id, offset, size, mapped + offset};
+        }
+
+        std::size_t offset = align(cursor, alignment);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id);
+        if (offset + size > capacity * frames) {
+            if (size > capacity * frames) {
+                grow(size + alignment);
+            } else {
+                glBufferData(GL_COPY_WRITE_BUFFER, capacity * frames, nullptr, GL_STREAM_DRAW);
+                frame_stats.orphans++;
+            }
+            offset = 0;
+        }
+        cursor = offset + size;
+
+        void *data = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        return {buffer_id, offset, size, data};
+    }
+
+    // Makes the written data visible to the GPU; the persistent mapping is coherent, there's
+    // nothing to do for it.
+    void commit(const allocation_t &allocation) {
+        if (allocation.size > 0) {
+            outstanding = false;
+        }
+        if (!persistent && allocation.size > 0) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, allocation.buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+    }
+
+    void report(std::ostream &out) const {
+        std::uint64_t frames_cnt = std::max(1, frames_since_report);
+        out << name << " ring (" << (persistent ? "persistent" : "orphaning") << ", " << capacity / 1024 << " KiB/frame): " \
+            << stats.allocations / frames_cnt << " allocations/frame, " << stats.bytes / frames_cnt / 1024 << " KiB/frame, " \
+            << stats.stalls << " stalls (" << stats.stall_ms << " ms), " << stats.orphans << " orphans, " << stats.grows << " grows" << std::endl;
+    }
+
+private:
+    static const std::size_t region_alignment = 256;
+
+    bool persistent;
+    GLuint buffer_id = 0;
+    std::uint8_t *mapped = nullptr;
+
+    std::size_t capacity = 0;   // of one region
+    std::size_t cursor = 0;     // absolute offset of the next allocation
+    int region = 0;
+    std::array <GLsync, frames> fences{};
+
+    // allocated and not committed yet, see the struct comment
+    bool outstanding = false;
+
+    static std::size_t align(std::size_t value, std::size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void create(std::size_t region_capacity) {
+        capacity = region_capacity;
+        glGenBuffers(1, &buffer_id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id);
+
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, capacity * frames, nullptr, flags);
+            mapped = static_cast<std::uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity * frames, flags));
+        } else {
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity * frames, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    void wait(int index) {
+        if (!fences[index]) {
+            return;
+        }
+
+        if (glClientWaitSync(fences[index], 0, 0) == GL_TIMEOUT_EXPIRED) {
+            auto start = std::chrono::steady_clock::now();
+            while (glClientWaitSync(fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+            frame_stats.stalls++;
+            frame_stats.stall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        glDeleteSync(fences[index]);
+        fences[index] = nullptr;
+    }
+
+    // A new buffer, so nothing has to wait for the GPU: draws already issued keep the old storage
+    // alive until they're done, GL deletes it after that.
+    void grow(std::size_t required) {
+        frame_stats.grows++;
+
+        for (auto &fence : fences) {
+            if (fence) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+
+        std::size_t region_capacity = capacity;
+        while (region_capacity < required) {
+            region_capacity *= 2;
+        }
+
+        glDeleteBuffers(1, &buffer_id);
+        create(align(region_capacity, region_alignment));
+        region = 0;
+        cursor = 0;
+    }
+};
+
+}
@@ -7,12 +7,22 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <chrono>
+#include <limits>
 
 #include "common_util.hpp"
+#include "asset_cache.hpp"
 #include "gltf_loader.hpp"
 #include "aabb.hpp"
 #include "frustum.hpp"
 #include "intersect.hpp"
+#include "visibility_cache.hpp"
+#include "thread_pool.hpp"
+#include "lod_selector.hpp"
+#include "instance_world.hpp"
+#include "ring_buffer.hpp"
+#include "indirect_batch.hpp"
+#include "impostor.hpp"
 
 #include "entity.hpp"
 
@@ -20,44 +30,49 @@ namespace roses {
 
 const char vertex_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform bool use_instanced_translation;
 
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_texcoord;
-layout (location = 3) in vec3 in_translation;
+
+#ifdef INSTANCED
+layout (location = 3) in vec4 in_translation;
+layout (location = 4) in float in_scale;
+#endif
 
 out vec3 normal;
 out vec2 texcoord;
 
 void main() {
-    vec3 position;
-    if (use_instanced_translation) {
-        position = (model * vec4(in_position + in_translation, 1.0)).xyz;
-    } else {
-        position = (model * vec4(in_position, 1.0)).xyz;
-    }
+#ifdef INSTANCED
+    float c = cos(in_translation.w);
+    float s = sin(in_translation.w);
+    mat3 rotation = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+
+    vec3 position = (model * vec4(rotation * in_position * in_scale + in_translation.xyz, 1.0)).xyz;
+    normal = mat3(model) * rotation * in_normal;
+#else
+    vec3 position = (model * vec4(in_position, 1.0)).xyz;
+    normal = mat3(model) * in_normal;
+#endif
 
     gl_Position = projection * view * vec4(position, 1.0);
-    normal = mat3(model) * in_normal;
     texcoord = in_texcoord;
 }
 )";
 
 const char fragment_shader_source[] =
 R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
 
+#ifdef USE_TEXTURE
 uniform sampler2D albedo;
+#else
 uniform vec4 color;
-uniform int use_texture;
-
-uniform vec3 light_direction;
-uniform vec3 light_color;
-uniform vec3 ambient_light_color;
+#endif
 
 layout (location = 0) out vec4 out_color;
 
@@ -65,12 +80,11 @@ in vec3 normal;
 in vec2 texcoord;
 
 void main() {
-    vec4 albedo_color;
-
-    if (use_texture == 1)
-        albedo_color = texture(albedo, texcoord);
-    else
-        albedo_color = color;
+#ifdef USE_TEXTURE
+    vec4 albedo_color = texture(albedo, texcoord);
+#else
+    vec4 albedo_color = color;
+#endif
 
     float diffuse = max(0.0, dot(normalize(normal), light_direction));
 
@@ -78,115 +92,317 @@ void main() {
 }
 )";
 
+// Farthest roses are drawn as one quad per instance: the vertex shader picks the atlas cell baked
+// from the direction closest to the camera and orients the quad like that view, the fragment
+// shader restores the surface depth from the atlas.
+const char impostor_vertex_shader_source[] =
+R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
+
+uniform mat4 model;
+
+uniform vec3 impostor_center;
+uniform float impostor_radius;
+uniform ivec2 impostor_views;
+uniform float impostor_max_elevation;
+
+layout (location = 3) in vec4 in_translation;
+layout (location = 4) in float in_scale;
+
+out vec2 texcoord;
+out vec3 position;
+flat out vec3 direction;
+flat out float radius;
+flat out vec2 rotation_cs;
+
+const float PI = 3.14159265359;
+const vec2 corners[4] = vec2[4](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0), vec2(1.0, 1.0));
+
+void main() {
+    float c = cos(in_translation.w);
+    float s = sin(in_translation.w);
+    mat3 rotation = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+
+    vec3 center = (model * vec4(rotation * impostor_center * in_scale + in_translation.xyz, 1.0)).xyz;
+    radius = impostor_radius * in_scale * length(model[0].xyz);
+
+    vec3 local = normalize(transpose(rotation) * (camera_position - center));
+    float azimuth = atan(local.z, local.x);
+    float elevation = asin(clamp(local.y, -1.0, 1.0));
+
+    vec2 views = vec2(impostor_views);
+    vec2 cell;
+    cell.x = mod(round(azimuth / (2.0 * PI) * views.x), views.x);
+    cell.y = views.y > 1.0 ? clamp(round(elevation / impostor_max_elevation * (views.y - 1.0)), 0.0, views.y - 1.0) : 0.0;
+
+    float a = cell.x * 2.0 * PI / views.x;
+    float e = views.y > 1.0 ? impostor_max_elevation * cell.y / (views.y - 1.0) : 0.0;
+    direction = rotation * vec3(cos(e) * cos(a), sin(e), cos(e) * sin(a));
+
+    vec3 right = normalize(cross(-direction, vec3(0.0, 1.0, 0.0)));
+    vec3 up = cross(right, -direction);
+
+    vec2 corner = corners[gl_VertexID];
+    position = center + (right * (corner.x * 2.0 - 1.0) + up * (corner.y * 2.0 - 1.0)) * radius;
+    texcoord = (cell + corner) / views;
+    rotation_cs = vec2(c, s);
+
+    gl_Position = projection * view * vec4(position, 1.0);
+}
+)";
+
+const char impostor_fragment_shader_source[] =
+R"(#version 330 core
+)" FRAME_UNIFORMS_GLSL R"(
+
+uniform sampler2D impostor_albedo;
+uniform sampler2D impostor_normal_depth;
+
+layout (location = 0) out vec4 out_color;
+
+in vec2 texcoord;
+in vec3 position;
+flat in vec3 direction;
+flat in float radius;
+flat in vec2 rotation_cs;
+
+void main() {
+    vec4 albedo_color = texture(impostor_albedo, texcoord);
+    if (albedo_color.a < 0.5)
+        discard;
+
+    vec4 normal_depth = texture(impostor_normal_depth, texcoord);
+
+    mat3 rotation = mat3(rotation_cs.x, 0.0, -rotation_cs.y, 0.0, 1.0, 0.0, rotation_cs.y, 0.0, rotation_cs.x);
+    vec3 normal = rotation * (normal_depth.xyz * 2.0 - 1.0);
+
+    float diffuse = max(0.0, dot(normalize(normal), light_direction));
+
+    out_color = vec4(albedo_color.rgb * (light_color * diffuse + ambient_light_color), 1.0);
+
+    vec3 surface = position + direction * radius * (1.0 - 2.0 * normal_depth.a);
+    vec4 clip = projection * view * vec4(surface, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+}
+)";
+
 struct roses_t : entity::entity {
-    // GLuint vertex_shader, fragment_shader, program;
-    // GLuint model_location, view_location, projection_location;
+    // GLuint program;
+    // GLuint model_location;
     // GLuint vao, vbo, ebo;
-    // GLuint light_direction_location, light_color_location, ambient_light_color_location;
     // std::uint32_t indices_count;
 
-    GLuint albedo_location, color_location, use_texture_location;
-    GLuint use_instanced_translation_location;
+    // permutations of the program, indexed by instanced | textured << 1: INSTANCED places the model by
+    // the per-instance attributes, USE_TEXTURE samples albedo instead of a flat color
+    struct variant_t {
+        GLuint program;
+        GLuint model_location, albedo_location, color_location;
+    };
+
+    std::array <variant_t, 4> variants;
 
     const float scale = .012f;
     const float board_size = 24.f;
-    static const int roses_density = 32;
-    static const int roses_cnt = (roses_density - 1) * (roses_density - 1);
 
-    std::vector <std::array <gltf_mesh, 3>> flowers;
-    std::map <std::string, GLuint> textures;
+    instance_world::instance_world_t world;
+    int roses_cnt;
+
+    // every part of every LOD lives in one arena, parts with equal materials share a material class
+    struct part_t {
+        indirect_batch::range_t range;
+        gltf_model::material material;
+        int material_class;
+    };
+
+    indirect_batch::arena_t arena;
+    std::vector <std::array <part_t, 3>> flowers;
+    std::vector <gltf_model::material> material_classes;
+    std::map <std::string, asset_cache::texture_handle_t> textures;
+
+    // With multi-draw every material class is one draw over all LODs from batch_vao, base instances
+    // select the LOD's instances. GL 3.3 has no base instance, there every LOD has a VAO pointed at
+    // its instances and the parts are drawn one by one.
+    bool multi_draw;
+    GLuint batch_vao;
+    std::vector <GLuint> lod_vaos;
+    indirect_batch::batch_t batch;
+    ring_buffer::ring_buffer_t command_ring{"roses indirect commands", 4096};
+
+    // per LOD bounds of an unscaled rose in world units, widened to contain it at any rotation if
+    // the world rotates instances
     std::vector <std::pair <glm::vec3, glm::vec3>> bounds;
+    std::pair <glm::vec3, glm::vec3> instance_bounds;
+
+    // per chunk slot and per instance slot (chunk slot * chunk capacity + index in the chunk)
+    visibility_cache::visibility_cache_t chunk_visibility, visibility;
+    lod_selector::lod_selector_t lod_selection;
 
-    bool mask[roses_density][roses_density] = { false };
     papich::papich_t *papich_ptr;
     mouse::mouse_t *mouse_ptr;
     int roses_by_player = 0, roses_by_mouse = 0;
 
-    GLuint translations_vbo;
-    std::vector <std::vector <glm::vec3>> translations;
-
-    roses_t(int object_index, papich::papich_t *papich, mouse::mouse_t *mouse) {
+    // The world belongs to the simulation, draw() culls a copy of its resident chunks. A slot's
+    // generation changes whenever the slot gets a new chunk, the per-slot caches of draw() are reset
+    // when it differs from the one they were filled for.
+    struct snapshot_t {
+        std::vector <instance_world::chunk_t> chunks;
+        std::vector <std::uint64_t> generations;
+        std::size_t resident_cnt = 0;
+        int roses_by_player = 0, roses_by_mouse = 0;
+    };
+
+    std::array <snapshot_t, frame_pipeline::slots_cnt> snapshots;
+    std::vector <std::uint64_t> slot_generations, drawn_generations;
+
+    thread_pool::thread_pool_t *pool_ptr;
+
+    struct gpu_instance_t {
+        glm::vec4 translation_rotation;
+        float scale;
+    };
+
+    // billboard drawn past the last LOD, its quad covers the bounding sphere of the full-detail rose
+    impostor_atlas impostor;
+    GLuint impostor_program, impostor_vao;
+    GLuint impostor_albedo_texture, impostor_normal_depth_texture;
+    GLuint impostor_model_location;
+    GLuint impostor_center_location, impostor_radius_location, impostor_views_location, impostor_max_elevation_location;
+    GLuint impostor_albedo_location, impostor_normal_depth_location;
+
+    // visible instances of every LOD (and of the impostor after them) are packed one LOD after another into this frame's
+    // allocation from instance_ring, inside a LOD every chunk gets a contiguous range
+    ring_buffer::ring_buffer_t instance_ring{"roses instances", 1 << 20};
+    std::vector <std::int8_t> instance_lods;
+    std::vector <std::size_t> chunk_offsets;
+    std::vector <std::pair <std::size_t, std::size_t>> lod_ranges;
+
+    roses_t(int object_index, papich::papich_t *papich, mouse::mouse_t *mouse, thread_pool::thread_pool_t *pool) {
         (void)object_index;
 
         papich_ptr = papich;
         mouse_ptr = mouse;
+        update_reads = {static_cast<entity *>(papich), static_cast<entity *>(mouse)};
+        pool_ptr = pool;
+
+        // a 31x31 grid with a step of 1.5 over the board, the row and column on its edge stay empty
+        instance_world::config_t world_config;
+        world_config.min_chunk = glm::ivec2(std::floor(-board_size / world_config.chunk_size));
+        world_config.max_chunk = glm::ivec2(std::ceil(board_size / world_config.chunk_size)) - 1;
+        world_config.area_min = glm::vec2(-board_size + world_config.chunk_size / world_config.instances_per_side);
+        world = instance_world::instance_world_t(world_config);
+        roses_cnt = world.total_instances();
+
+        for (int i = 0; i < (int)variants.size(); i++) {
+            std::vector <std::string> defines;
+            if (i & 1) {
+                defines.push_back("INSTANCED");
+            }
+            if (i & 2) {
+                defines.push_back("USE_TEXTURE");
+            }
 
-        vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-        fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-        program = create_program(vertex_shader, fragment_shader);
-
-        model_location = glGetUniformLocation(program, "model");
-        view_location = glGetUniformLocation(program, "view");
-        projection_location = glGetUniformLocation(program, "projection");
-        use_instanced_translation_location = glGetUniformLocation(program, "use_instanced_translation");
-        albedo_location = glGetUniformLocation(program, "albedo");
-        color_location = glGetUniformLocation(program, "color");
-        use_texture_location = glGetUniformLocation(program, "use_texture");
-        light_direction_location = glGetUniformLocation(program, "light_direction");
-        light_color_location = glGetUniformLocation(program, "light_color");
-        ambient_light_color_location = glGetUniformLocation(program, "ambient_light_color");
+            variant_t &variant = variants[i];
+            variant.program = shader_cache::cache().program(vertex_shader_source, fragment_shader_source, defines);
+            variant.model_location = glGetUniformLocation(variant.program, "model");
+            variant.albedo_location = glGetUniformLocation(variant.program, "albedo");
+            variant.color_location = glGetUniformLocation(variant.program, "color");
+        }
 
         std::string project_root = PROJECT_ROOT;
         const std::string model_path = project_root + "/models/rose/rose.gltf";
 
         gltf_model rose = load_gltf(model_path);
-        
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, rose.buffer.size(), rose.buffer.data(), GL_STATIC_DRAW);
-
-        translations.resize(rose.meshes.size() / 3, std::vector <glm::vec3> ());
-        for (auto &tr : translations) {
-            tr.reserve(roses_cnt);
-        }
 
-        glGenBuffers(1, &translations_vbo);
+        lod_ranges.resize(rose.meshes.size() / 3 + 1);
 
-        auto setup_part = [&](const gltf_model::mesh &src) -> gltf_mesh {
-            gltf_mesh result;
+        auto add_part = [&](const gltf_model::mesh &src) -> part_t {
+            part_t result;
+            result.range = arena.add(rose, src);
+            result.material = src.material;
 
-            glGenVertexArrays(1, &result.vao);
-            glBindVertexArray(result.vao);
+            auto it = std::find_if(material_classes.begin(), material_classes.end(), [&](const gltf_model::material &material) {
+                return material.texture_path == src.material.texture_path && material.color == src.material.color && \
+                       material.two_sided == src.material.two_sided;
+            });
+            result.material_class = it - material_classes.begin();
+            if (it == material_classes.end()) {
+                material_classes.push_back(src.material);
+            }
+
+            return result;
+        };
 
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
-            result.indices = src.indices;
+        for (std::size_t i = 0; i < rose.meshes.size(); i += 3) {
+            part_t leaves = add_part(rose.meshes[i]);
+            part_t stalk = add_part(rose.meshes[i + 1]);
+            part_t flower = add_part(rose.meshes[i + 2]);
+
+            flowers.push_back({leaves, stalk, flower});
 
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            setup_attribute(0, src.position);
-            setup_attribute(1, src.normal);
-            if (src.texcoord) {
-                setup_attribute(2, src.texcoord.value());
+            glm::vec3 min = glm::min(glm::min(rose.meshes[i].min, rose.meshes[i + 1].min), rose.meshes[i + 2].min) * scale;
+            glm::vec3 max = glm::max(glm::max(rose.meshes[i].max, rose.meshes[i + 1].max), rose.meshes[i + 2].max) * scale;
+
+            if (world.config.random_rotation) {
+                float radius = std::sqrt(std::max(min.x * min.x, max.x * max.x) + std::max(min.z * min.z, max.z * max.z));
+                bounds.push_back({glm::vec3(-radius, min.y, -radius), glm::vec3(radius, max.y, radius)});
+            } else {
+                bounds.push_back({min, max});
             }
+        }
 
-            glBindBuffer(GL_ARRAY_BUFFER, translations_vbo);
-            glEnableVertexAttribArray(3);
-            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
-            glVertexAttribDivisor(3, 1);
+        // the impostor stands in for the full-detail rose
+        bounds.push_back(bounds[0]);
 
-            result.material = src.material;
+        arena.upload();
+        multi_draw = indirect_batch::supported();
 
+        auto setup_vao = [&]() {
+            GLuint result;
+            glGenVertexArrays(1, &result);
+            gl_state::cache().bind_vertex_array(result);
+            arena.setup_vertex_attributes();
+            setup_instance_attributes(instance_ring.buffer(), 0);
             return result;
         };
 
-        for (std::size_t i = 0; i < rose.meshes.size(); i += 3) {
-            gltf_mesh leaves = setup_part(rose.meshes[i]);
-            gltf_mesh stalk = setup_part(rose.meshes[i + 1]);
-            gltf_mesh flower = setup_part(rose.meshes[i + 2]);
+        batch_vao = setup_vao();
+        for (std::size_t i = 0; i < flowers.size(); i++) {
+            lod_vaos.push_back(setup_vao());
+        }
 
-            flowers.push_back({leaves, stalk, flower});
-            bounds.push_back({
-                glm::vec3(
-                    std::min({rose.meshes[i].min.x, rose.meshes[i + 1].min.x, rose.meshes[i + 2].min.x}),
-                    std::min({rose.meshes[i].min.y, rose.meshes[i + 1].min.y, rose.meshes[i + 2].min.y}),
-                    std::min({rose.meshes[i].min.z, rose.meshes[i + 1].min.z, rose.meshes[i + 2].min.z})
-                ) * scale,
-                glm::vec3(
-                    std::max({rose.meshes[i].max.x, rose.meshes[i + 1].max.x, rose.meshes[i + 2].max.x}),
-                    std::max({rose.meshes[i].max.y, rose.meshes[i + 1].max.y, rose.meshes[i + 2].max.y}),
-                    std::max({rose.meshes[i].max.z, rose.meshes[i + 1].max.z, rose.meshes[i + 2].max.z})
-                ) * scale
-            });
+        instance_bounds = bounds[0];
+        for (const auto &[min, max] : bounds) {
+            instance_bounds.first = glm::min(instance_bounds.first, min);
+            instance_bounds.second = glm::max(instance_bounds.second, max);
+        }
+        instance_bounds.first *= world.config.max_scale;
+        instance_bounds.second *= world.config.max_scale;
+
+        std::size_t slots_cnt = world.slots.size();
+        std::size_t instance_slots_cnt = slots_cnt * world.chunk_capacity();
+
+        slot_generations.assign(slots_cnt, 0);
+        drawn_generations.assign(slots_cnt, 0);
+        for (auto &snapshot : snapshots) {
+            snapshot.chunks.resize(slots_cnt);
+            snapshot.generations.assign(slots_cnt, 0);
+        }
+
+        chunk_visibility.name = "chunk visibility cache";
+        chunk_visibility.resize(slots_cnt);
+        visibility.resize(instance_slots_cnt);
+        instance_lods.resize(instance_slots_cnt, -1);
+
+        std::vector <std::size_t> lod_triangles;
+        for (const auto &flower : flowers) {
+            lod_triangles.push_back((flower[0].range.count + flower[1].range.count + flower[2].range.count) / 3);
         }
+        float size = glm::length(instance_bounds.second - instance_bounds.first);
+        lod_selection = lod_selector::lod_selector_t(lod_selector::estimate_lods(lod_triangles, size), instance_slots_cnt);
+
+        setup_impostor(rose, model_path);
+        lod_selection.impostor_size = 2.f * impostor.radius * scale;
+        lod_selection.impostor_pixels = impostor.params.view_size;
 
         for (const auto &flower : flowers) {
             for (const auto &part : flower) {
@@ -194,174 +410,402 @@ struct roses_t : entity::entity {
                     continue;
                 }
 
-                if (textures.contains(*part.material.texture_path)) {
-                    continue;
-                }
-
                 auto path = std::filesystem::path(model_path).parent_path() / *part.material.texture_path;
 
-                textures[*part.material.texture_path] = load_texture(path.string());
+                textures[*part.material.texture_path] = asset_cache::cache().texture(path.string());
             }
         }
     }
 
+    void setup_impostor(const gltf_model &rose, const std::string &model_path) {
+        std::filesystem::path cache_path = std::filesystem::path(model_path).replace_extension(".impostor");
+
+        if (!load_impostor(impostor, cache_path, model_path, impostor_atlas::settings())) {
+            auto start = std::chrono::steady_clock::now();
+            impostor = bake_impostor(rose, {0, 1, 2}, std::filesystem::path(model_path).parent_path());
+            std::cerr << "rose impostor baked in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+            save_impostor(impostor, cache_path);
+        }
+
+        impostor_program = shader_cache::cache().program(impostor_vertex_shader_source, impostor_fragment_shader_source);
+
+        impostor_model_location = glGetUniformLocation(impostor_program, "model");
+        impostor_center_location = glGetUniformLocation(impostor_program, "impostor_center");
+        impostor_radius_location = glGetUniformLocation(impostor_program, "impostor_radius");
+        impostor_views_location = glGetUniformLocation(impostor_program, "impostor_views");
+        impostor_max_elevation_location = glGetUniformLocation(impostor_program, "impostor_max_elevation");
+        impostor_albedo_location = glGetUniformLocation(impostor_program, "impostor_albedo");
+        impostor_normal_depth_location = glGetUniformLocation(impostor_program, "impostor_normal_depth");
+
+        auto upload = [&](const std::vector <std::uint8_t> &pixels) {
+            GLuint result;
+            glGenTextures(1, &result);
+            gl_state::cache().bind_texture(GL_TEXTURE_2D, result);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, impostor.width, impostor.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            return result;
+        };
+
+        impostor_albedo_texture = upload(impostor.albedo);
+        impostor_normal_depth_texture = upload(impostor.normal_depth);
+
+        // the quad corners come from gl_VertexID, only the per-instance attributes are needed
+        glGenVertexArrays(1, &impostor_vao);
+        gl_state::cache().bind_vertex_array(impostor_vao);
+        setup_instance_attributes(instance_ring.buffer(), 0);
+    }
+
+    // per-instance attributes 3 and 4 of the bound VAO, reading instances from `offset` in `buffer`
+    static void setup_instance_attributes(GLuint buffer, std::size_t offset) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(gpu_instance_t), reinterpret_cast<void*>(offset + offsetof(gpu_instance_t, translation_rotation)));
+        glVertexAttribDivisor(3, 1);
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(gpu_instance_t), reinterpret_cast<void*>(offset + offsetof(gpu_instance_t, scale)));
+        glVertexAttribDivisor(4, 1);
+    }
+
     static bool in_bounds(glm::vec3 x, glm::vec3 a, glm::vec3 b) {
         return a.x <= x.x && x.x <= b.x && \
                a.y <= x.y && x.y <= b.y && \
                a.z <= x.z && x.z <= b.z;
     }
 
+    void update_size(int width, int height) {
+        lod_selection.update_size(width, height);
+    }
+
     void update_state(float time, float dt, std::map <SDL_Keycode, bool> &button_down) {
         (void)time; (void)dt; (void)button_down;
 
-        for (int i = 1; i < roses_density; i++) {
-            for (int j = 1; j < roses_density; j++) {
-                if (mask[i][j]) {
-                    continue;
+        // only the chunks around the collector are looked at, they are generated if not resident
+        auto collect = [&](const glm::vec3 &position, float margin, int &counter) {
+            glm::vec3 reach = glm::vec3(instance_bounds.second.x + margin);
+            glm::ivec2 from = world.chunk_coord(position - reach);
+            glm::ivec2 to = world.chunk_coord(position + reach);
+
+            for (int x = from.x; x <= to.x; x++) {
+                for (int z = from.y; z <= to.y; z++) {
+                    instance_world::chunk_t *chunk = world.acquire({x, z});
+                    if (!chunk) {
+                        continue;
+                    }
+
+                    for (auto &instance : chunk->instances) {
+                        if (instance.state & (instance_world::collected | instance_world::absent)) {
+                            continue;
+                        }
+
+                        glm::vec3 offset = world.position(*chunk, instance);
+                        float instance_scale = world.scale(instance);
+
+                        if (in_bounds(position, bounds[0].first * instance_scale + offset - glm::vec3(margin), bounds[0].second * instance_scale + offset + glm::vec3(margin))) {
+                            counter++;
+                            instance.state |= instance_world::collected;
+                        }
+                    }
                 }
+            }
+        };
 
-                float step = board_size / roses_density * 2;
-                glm::vec3 offset(-board_size + i * step, 0.f, -board_size + j * step);
+        collect(mouse_ptr->position, 1.f, roses_by_mouse);
+        collect(papich_ptr->position, .5f, roses_by_player);
+    }
 
-                if (in_bounds(mouse_ptr->position, bounds[0].first + offset - glm::vec3(1.f), bounds[0].second + offset + glm::vec3(1.f))) {
-                    roses_by_mouse++;
-                    mask[i][j] = true;
-                    continue;
-                }
+    // streams chunks around the camera, on the simulation thread once the camera has moved
+    void stream(const glm::vec3 &camera_position) {
+        world.update(camera_position);
+    }
 
-                if (in_bounds(papich_ptr->position, bounds[0].first + offset - glm::vec3(.5f), bounds[0].second + offset + glm::vec3(.5f))) {
-                    roses_by_player++;
-                    mask[i][j] = true;
-                    continue;
-                }
+    void capture(std::size_t slot) {
+        snapshot_t &snapshot = snapshots[slot];
+
+        for (std::size_t i = 0; i < world.slots.size(); i++) {
+            instance_world::chunk_t &chunk = world.slots[i];
+            if (chunk.fresh) {
+                slot_generations[i]++;
+                chunk.fresh = false;
+            }
+
+            // the instances of free slots are never read
+            if (chunk.resident) {
+                snapshot.chunks[i] = chunk;
+            } else {
+                snapshot.chunks[i].resident = false;
             }
         }
+
+        snapshot.generations = slot_generations;
+        snapshot.resident_cnt = world.resident_cnt();
+        snapshot.roses_by_player = roses_by_player;
+        snapshot.roses_by_mouse = roses_by_mouse;
     }
 
-    void draw(
-        const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position,
-        const glm::vec3 &light_direction, const glm::vec3 &light_color, const glm::vec3 &ambient_light_color,
-        float time
-    ) {
+    void draw(const frame_uniforms::block_t &frame) {
         glm::mat4 model = glm::mat4(1.f);
         model = glm::scale(model, glm::vec3(scale));
 
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-        glDisable(GL_BLEND);
-
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<const float*>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<const float*>(&projection));
-        glUniform1i(use_instanced_translation_location, true);
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<const float*>(&light_direction));
-        glUniform3fv(light_color_location, 1, reinterpret_cast<const float*>(&light_color));
-        glUniform3fv(ambient_light_color_location, 1, reinterpret_cast<const float*>(&ambient_light_color));
-
-        frustum fr(projection * view);
-
-        for (int i = 1; i < roses_density; i++) {
-            for (int j = 1; j < roses_density; j++) {
-                if (mask[i][j]) {
+        const snapshot_t &drawn = snapshots[drawn_slot];
+
+        frustum fr(frame.projection * frame.view);
+
+        chunk_visibility.begin_frame(frame.view, frame.projection, frame.camera_position);
+        visibility.begin_frame(frame.view, frame.projection, frame.camera_position);
+        lod_selection.begin_frame(frame.projection);
+
+        // pass 1: cull resident chunks in parallel, then the instances of chunks crossing the frustum
+        // boundary, and count visible instances per chunk and LOD
+        std::size_t lods_cnt = lod_ranges.size();
+        std::size_t slots_cnt = drawn.chunks.size();
+        std::size_t capacity = world.chunk_capacity();
+        chunk_offsets.assign(slots_cnt * lods_cnt, 0);
+        std::vector <visibility_cache::stats_t> chunk_stats(slots_cnt), instance_stats(slots_cnt);
+
+        // of the nearest visible rose per chunk, how sharp the textures have to be
+        std::vector <float> nearest(slots_cnt, std::numeric_limits<float>::infinity());
+
+        glm::vec3 center = (instance_bounds.first + instance_bounds.second) * .5f / world.config.max_scale;
+
+        pool_ptr->parallel_for(slots_cnt, 1, [&](std::size_t slot, std::size_t, std::size_t) {
+            const instance_world::chunk_t &chunk = drawn.chunks[slot];
+            std::int8_t *lods = &instance_lods[slot * capacity];
+            std::fill(lods, lods + capacity, -1);
+
+            if (!chunk.resident) {
+                return;
+            }
+
+            if (drawn_generations[slot] != drawn.generations[slot]) {
+                chunk_visibility.invalidate(slot);
+                for (std::size_t i = 0; i < capacity; i++) {
+                    visibility.invalidate(slot * capacity + i);
+                    lod_selection.reset(slot * capacity + i);
+                }
+                drawn_generations[slot] = drawn.generations[slot];
+            }
+
+            glm::vec3 chunk_min = chunk.min + instance_bounds.first;
+            glm::vec3 chunk_max = chunk.max + instance_bounds.second;
+            bool chunk_visible = chunk_visibility.visible(slot, chunk_min, chunk_max, [&]() {
+                return intersect(fr, aabb(chunk_min, chunk_max));
+            }, chunk_stats[slot]);
+
+            if (!chunk_visible) {
+                return;
+            }
+
+            bool chunk_inside = chunk_visibility.states[slot] == visibility_cache::state_t::inside;
+
+            for (std::size_t i = 0; i < chunk.instances.size(); i++) {
+                const instance_world::instance_t &instance = chunk.instances[i];
+                if (instance.state & (instance_world::collected | instance_world::absent)) {
                     continue;
                 }
 
-                float step = board_size / roses_density * 2;
-                glm::vec3 offset(-board_size + i * step, 0.f, -board_size + j * step);
+                std::size_t index = slot * capacity + i;
+                glm::vec3 offset = world.position(chunk, instance);
+                float instance_scale = world.scale(instance);
+
+                float dist = glm::length(frame.camera_position - (offset + center * instance_scale));
+                int lod = lod_selection.select(index, dist);
 
-                float dist = glm::length(camera_position - offset);
-                int lod = std::min((int)floor(dist / 4), (int)flowers.size() - 1);
+                bool visible = chunk_inside || visibility.visible(index, instance_bounds.first + offset, instance_bounds.second + offset, [&]() {
+                    return intersect(fr, aabb(bounds[lod].first * instance_scale + offset, bounds[lod].second * instance_scale + offset));
+                }, instance_stats[slot]);
 
-                aabb ab(bounds[lod].first + offset, bounds[lod].second + offset);
-                if (intersect(fr, ab)) {
-                    translations[lod].push_back(offset / scale);
+                if (visible) {
+                    lods[i] = lod;
+                    chunk_offsets[slot * lods_cnt + lod]++;
+                    nearest[slot] = std::min(nearest[slot], dist);
                 }
             }
+        });
+
+        float nearest_distance = std::numeric_limits<float>::infinity();
+        for (std::size_t slot = 0; slot < slots_cnt; slot++) {
+            chunk_visibility.frame_stats += chunk_stats[slot];
+            visibility.frame_stats += instance_stats[slot];
+            nearest_distance = std::min(nearest_distance, nearest[slot]);
+        }
+
+        // no visible rose asks for nothing, the textures go down to their coarsest levels
+        if (nearest_distance < std::numeric_limits<float>::infinity()) {
+            float rose_size = 2.f * impostor.radius * scale * world.config.max_scale;
+            float pixels = asset_cache::cache().projected_pixels(frame.projection, rose_size, nearest_distance);
+            for (auto &[path, texture] : textures) {
+                asset_cache::cache().request(texture, pixels);
+            }
+        }
+        chunk_visibility.end_frame();
+        visibility.end_frame();
+
+        // exclusive prefix sums over (LOD, chunk) turn the counts into the first slot of every chunk
+        std::size_t total = 0;
+        for (std::size_t lod = 0; lod < lods_cnt; lod++) {
+            lod_ranges[lod].first = total;
+            for (std::size_t slot = 0; slot < slots_cnt; slot++) {
+                std::size_t cnt = chunk_offsets[slot * lods_cnt + lod];
+                chunk_offsets[slot * lods_cnt + lod] = total;
+                total += cnt;
+            }
+            lod_ranges[lod].second = total - lod_ranges[lod].first;
         }
 
-        glActiveTexture(GL_TEXTURE0);
+        std::size_t triangles = 0;
+        for (std::size_t lod = 0; lod < lods_cnt; lod++) {
+            triangles += lod_selection.triangles(lod, lod_ranges[lod].second);
+        }
+        lod_selection.end_frame(triangles);
+
+        // pass 2: every chunk writes its instances to its own range of the mapped allocation, no locking needed
+        instance_ring.next_frame();
+        ring_buffer::allocation_t instances = instance_ring.allocate(total * sizeof(gpu_instance_t), sizeof(gpu_instance_t));
+        if (total > 0) {
+            auto *mapped = instances.as<gpu_instance_t>();
+
+            pool_ptr->parallel_for(slots_cnt, 1, [&](std::size_t slot, std::size_t, std::size_t) {
+                const instance_world::chunk_t &chunk = drawn.chunks[slot];
+                const std::int8_t *lods = &instance_lods[slot * capacity];
+                std::size_t *offsets = &chunk_offsets[slot * lods_cnt];
+
+                for (std::size_t i = 0; i < capacity; i++) {
+                    if (lods[i] < 0) {
+                        continue;
+                    }
+
+                    const instance_world::instance_t &instance = chunk.instances[i];
+                    mapped[offsets[lods[i]]++] = {
+                        glm::vec4(world.position(chunk, instance) / scale, world.rotation(instance)),
+                        world.scale(instance)
+                    };
+                }
+            });
+
+            instance_ring.commit(instances);
+        }
 
+        // starts a packet with the program, state, texture and material uniforms of a part, nullptr
+        // for a part without a material
+        auto submit_material = [&](const gltf_model::material &material, GLuint part_vao, bool instanced, const glm::mat4 &part_model) -> render_queue::packet_t * {
+            if (!material.texture_path && !material.color) {
+                return nullptr;
+            }
+
+            const variant_t &variant = variants[(instanced ? 1 : 0) | (material.texture_path ? 2 : 0)];
+
+            render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::opaque, variant.program, part_vao);
+            packet.state = render_queue::depth_test | render_queue::depth_write | \
+                (material.two_sided ? 0 : render_queue::cull_face);
+
+            render_queue::uniform_writer_t uniforms = render_queue_ptr->uniforms();
+            uniforms.set(variant.model_location, part_model);
+            if (material.texture_path) {
+                packet.textures[0] = {GL_TEXTURE_2D, textures[*material.texture_path].get()};
+                uniforms.set(variant.albedo_location, 0);
+            } else {
+                uniforms.set(variant.color_location, *material.color);
+            }
+            packet.uniforms = uniforms;
+
+            return &packet;
+        };
+
+        // instance attributes are pointed at this frame's allocation right away, before the queue
+        // replays the draws: every VAO is used with one range of it per frame
+        batch.begin_frame(material_classes.size());
         for (std::size_t i = 0; i < flowers.size(); i++) {
-            const auto &flower = flowers[i];
-            
-            if (translations[i].empty()) {
+            const auto [first, count] = lod_ranges[i];
+
+            if (count == 0) {
                 continue;
             }
 
-            glBindBuffer(GL_ARRAY_BUFFER, translations_vbo);
-            glBufferData(GL_ARRAY_BUFFER, translations[i].size() * sizeof(glm::vec3), translations[i].data(), GL_STATIC_DRAW);
+            if (multi_draw) {
+                for (const auto &part : flowers[i]) {
+                    batch.add(part.material_class, part.range, count, first);
+                }
+                continue;
+            }
 
-            for (const auto &part : flower) {
-                if (part.material.two_sided)
-                    glDisable(GL_CULL_FACE);
-                else
-                    glEnable(GL_CULL_FACE);
-
-                if (part.material.texture_path) {
-                    glBindTexture(GL_TEXTURE_2D, textures[*part.material.texture_path]);
-                    glUniform1i(use_texture_location, 1);
-                    glUniform1i(albedo_location, 0);
-                } else if (part.material.color) {
-                    glUniform1i(use_texture_location, 0);
-                    glUniform4fv(color_location, 1, reinterpret_cast<const float*>(&(*part.material.color)));
-                } else {
-                    continue;
+            gl_state::cache().bind_vertex_array(lod_vaos[i]);
+            setup_instance_attributes(instances.buffer, instances.offset + first * sizeof(gpu_instance_t));
+
+            for (const auto &part : flowers[i]) {
+                if (auto *packet = submit_material(part.material, lod_vaos[i], true, model)) {
+                    packet->draw_elements(GL_TRIANGLES, part.range.count, GL_UNSIGNED_INT, indirect_batch::arena_t::byte_offset(part.range), count);
+                }
+            }
+        }
+
+        command_ring.next_frame();
+        if (batch.commands_cnt() > 0) {
+            gl_state::cache().bind_vertex_array(batch_vao);
+            setup_instance_attributes(instances.buffer, instances.offset);
+
+            ring_buffer::allocation_t commands = command_ring.allocate(batch.commands_cnt() * sizeof(indirect_batch::command_t), sizeof(indirect_batch::command_t));
+            for (const auto &draw : batch.write(commands)) {
+                if (auto *packet = submit_material(material_classes[draw.material_class], batch_vao, true, model)) {
+                    packet->multi_draw_elements_indirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands.buffer, draw.offset, draw.cnt);
                 }
+            }
+            command_ring.commit(commands);
+        }
 
-                glBindVertexArray(part.vao);
-                glDrawElementsInstanced(GL_TRIANGLES, part.indices.count, part.indices.type, reinterpret_cast<void*>(part.indices.view.offset), translations[i].size());
+        {
+            const auto [first, count] = lod_ranges.back();
+
+            if (count > 0) {
+                std::size_t offset = instances.offset + first * sizeof(gpu_instance_t);
+                glm::ivec2 views(impostor.params.azimuths, impostor.params.elevations);
+
+                gl_state::cache().bind_vertex_array(impostor_vao);
+                setup_instance_attributes(instances.buffer, offset);
+
+                render_queue::packet_t &packet = render_queue_ptr->submit(render_queue::layer_t::opaque, impostor_program, impostor_vao);
+                packet.state = render_queue::depth_test | render_queue::depth_write;
+                packet.textures[0] = {GL_TEXTURE_2D, impostor_albedo_texture};
+                packet.textures[1] = {GL_TEXTURE_2D, impostor_normal_depth_texture};
+                packet.uniforms = render_queue_ptr->uniforms()
+                    .set(impostor_model_location, model)
+                    .set(impostor_center_location, impostor.center)
+                    .set(impostor_radius_location, impostor.radius)
+                    .set(impostor_views_location, views)
+                    .set(impostor_max_elevation_location, impostor.params.max_elevation)
+                    .set(impostor_albedo_location, 0)
+                    .set(impostor_normal_depth_location, 1);
+                packet.draw_arrays(GL_TRIANGLE_STRIP, 0, 4, count);
             }
         }
 
         auto count_instances = [&]() {
             int drawn_cnt = 0;
-            for (int i = 0; i + 1 < flowers.size(); i++) {
-                std::cerr << translations[i].size() << " + ";
-                drawn_cnt += translations[i].size();
+            for (int i = 0; i + 1 < lod_ranges.size(); i++) {
+                std::cerr << lod_ranges[i].second << " + ";
+                drawn_cnt += lod_ranges[i].second;
             }
-            std::cerr << translations.back().size();
-            drawn_cnt += translations.back().size();
+            std::cerr << lod_ranges.back().second;
+            drawn_cnt += lod_ranges.back().second;
             
-            std::cerr << " = " << drawn_cnt << std::endl;
+            std::cerr << " = " << drawn_cnt << " of " << drawn.resident_cnt * capacity << " resident" << std::endl;
         };
 
         // count_instances(); // used for debug
 
-        for (auto &tr : translations) {
-            tr.clear();
-        }
-
         // draw LODs for demonstration
-        glUniform1i(use_instanced_translation_location, false);
-
         model = glm::translate(model, glm::vec3(board_size + 1.f, 10.f, -2.f) / scale);
         for (std::size_t i = 0; i < flowers.size(); i++) {
-            const auto &flower = flowers[i];
-
             model = glm::translate(model, glm::vec3(0.f, 0.f, 1.f) / scale);
-            glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<const float*>(&model));
 
-            for (const auto &part : flower) {
-                if (part.material.two_sided)
-                    glDisable(GL_CULL_FACE);
-                else
-                    glEnable(GL_CULL_FACE);
-
-                if (part.material.texture_path) {
-                    glBindTexture(GL_TEXTURE_2D, textures[*part.material.texture_path]);
-                    glUniform1i(use_texture_location, 1);
-                    glUniform1i(albedo_location, 0);
-                } else if (part.material.color) {
-                    glUniform1i(use_texture_location, 0);
-                    glUniform4fv(color_location, 1, reinterpret_cast<const float*>(&(*part.material.color)));
-                } else {
-                    continue;
+            for (const auto &part : flowers[i]) {
+                if (auto *packet = submit_material(part.material, lod_vaos[i], false, model)) {
+                    packet->draw_elements(GL_TRIANGLES, part.range.count, GL_UNSIGNED_INT, indirect_batch::arena_t::byte_offset(part.range));
                 }
-
-                glBindVertexArray(part.vao);
-                glDrawElements(GL_TRIANGLES, part.indices.count, part.indices.type, reinterpret_cast<void*>(part.indices.view.offset));
             }
         }
     }
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <iostream>
+
+#include "frame_uniforms.hpp"
+
+namespace shader_cache {
+
+// A permutation of a shader is its source with `#define <entry>` lines inserted after the version
+// line, so features are switched at compile time instead of branching on a uniform.
+inline std::string with_defines(const char *source, const std::vector <std::string> &defines) {
+    std::string result = source;
+    std::string lines;
+    for (const auto &define : defines) {
+        lines += "#define " + define + "\n";
+    }
+
+    std::size_t line_end = result.find('\n');
+    result.insert(line_end == std::string::npos ? result.size() : line_end + 1, lines);
+    return result;
+}
+
+// FNV-1a
+inline std::uint64_t hash(std::string_view data, std::uint64_t seed = 14695981039346656037ull) {
+    std::uint64_t result = seed;
+    for (unsigned char c : data) {
+        result = (result ^ c) * 1099511628211ull;
+    }
+    return result;
+}
+
+struct stats_t {
+    int compiled = 0, loaded = 0;
+    double compile_ms = 0.0, load_ms = 0.0;
+};
+
+// Links programs from vertex and fragment sources and keeps their binaries on disk, keyed by the
+// hash of the sources and of the driver string: a new driver or an edited shader gets a new file.
+// A binary the driver refuses to load is compiled again and overwritten. Without
+// ARB_get_program_binary, or when the driver has no binary formats, every program is compiled.
+struct shader_cache_t {
+    std::filesystem::path directory = std::filesystem::path(PROJECT_ROOT) / ".shader_cache";
+    stats_t stats;
+
+    shader_cache_t() = default;
+
+    shader_cache_t(const shader_cache_t &) = delete;
+    shader_cache_t &operator=(const shader_cache_t &) = delete;
+
+    GLuint program(const char *vertex_source, const char *fragment_source, const std::vector <std::string> &defines = {}) {
+        init();
+
+        std::string vertex = with_defines(vertex_source, defines);
+        std::string fragment = with_defines(fragment_source, defines);
+        std::uint64_t key = hash(fragment, hash(vertex, hash(driver)));
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        std::filesystem::path path = directory / name;
+
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed = [&]() {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        if (enabled) {
+            if (GLuint result = load(path, key)) {
+                stats.loaded++;
+                stats.load_ms += elapsed();
+                return result;
+            }
+        }
+
+        GLuint vertex_shader = compile(GL_VERTEX_SHADER, vertex);
+        GLuint fragment_shader = compile(GL_FRAGMENT_SHADER, fragment);
+
+        GLuint result = glCreateProgram();
+        if (enabled) {
+            glProgramParameteri(result, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glAttachShader(result, vertex_shader);
+        glAttachShader(result, fragment_shader);
+        glLinkProgram(result);
+
+        GLint status;
+        glGetProgramiv(result, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            GLint info_log_length;
+            glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
+            std::string info_log(info_log_length, '\0');
+            glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
+            throw std::runtime_error("Program linkage failed: " + info_log);
+        }
+
+        // the program keeps its own copy of the code
+        glDetachShader(result, vertex_shader);
+        glDetachShader(result, fragment_shader);
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+
+        bind_blocks(result);
+
+        if (enabled) {
+            store(path, key, result);
+        }
+
+        stats.compiled++;
+        stats.compile_ms += elapsed();
+        return result;
+    }
+
+    void report(std::ostream &out) const {
+        out << "shaders: " << stats.compiled << " programs compiled in " << stats.compile_ms << " ms, " \
+            << stats.loaded << " loaded from the binary cache in " << stats.load_ms << " ms" \
+            << (enabled ? "" : " (binary cache not supported)") << std::endl;
+    }
+
+private:
+    struct header_t {
+        char magic[4] = {'P', 'B', 'I', 'N'};
+        std::uint32_t version = 1;
+        std::uint64_t key = 0;
+        GLenum format = 0;
+        std::uint32_t size = 0;
+    };
+
+    bool initialized = false, enabled = false;
+    std::string driver;
+
+    void init() {
+        if (initialized) {
+            return;
+        }
+        initialized = true;
+
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const GLubyte *value = glGetString(name);
+            driver += value ? reinterpret_cast<const char*>(value) : "";
+            driver += '\n';
+        }
+
+        GLint formats_cnt = 0;
+        if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats_cnt);
+        }
+        enabled = formats_cnt > 0;
+    }
+
+    static GLuint compile(GLenum type, const std::string &source) {
+        GLuint result = glCreateShader(type);
+        const char *data = source.data();
+        glShaderSource(result, 1, &data, nullptr);
+        glCompileShader(result);
+        GLint status;
+        glGetShaderiv(result, GL_COMPILE_STATUS, &status);
+        if (status != GL_TRUE) {
+            GLint info_log_length;
+            glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
+            std::string info_log(info_log_length, '\0');
+            glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
+            throw std::runtime_error("Shader compilation failed: " + info_log);
+        }
+        return result;
+    }
+
+    // block bindings aren't part of the binary, they are set again after loading it
+    static void bind_blocks(GLuint program) {
+        // every program that declares the per-frame block reads it from the same buffer
+        GLuint frame_block = glGetUniformBlockIndex(program, "frame_uniforms");
+        if (frame_block != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, frame_block, frame_uniforms::binding);
+        }
+    }
+
+    GLuint load(const std::filesystem::path &path, std::uint64_t key) const {
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            return 0;
+        }
+
+        header_t header, expected;
+        input.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!input || std::string_view(header.magic, 4) != std::string_view(expected.magic, 4) || \
+            header.version != expected.version || header.key != key) {
+            return 0;
+        }
+
+        std::vector <char> binary(header.size);
+        input.read(binary.data(), binary.size());
+        if (!input) {
+            return 0;
+        }
+
+        GLuint result = glCreateProgram();
+        glProgramBinary(result, header.format, binary.data(), binary.size());
+
+        GLint status;
+        glGetProgramiv(result, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            glDeleteProgram(result);
+            return 0;
+        }
+
+        bind_blocks(result);
+        return result;
+    }
+
+    // failing to store only means compiling again next time
+    void store(const std::filesystem::path &path, std::uint64_t key, GLuint program) const {
+        GLint size = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+        if (size <= 0) {
+            return;
+        }
+
+        header_t header;
+        header.key = key;
+        std::vector <char> binary(size);
+        GLsizei length = 0;
+        glGetProgramBinary(program, size, &length, &header.format, binary.data());
+        header.size = length;
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+
+        // written under a temporary name, a crash mid-write never leaves a truncated binary behind
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream output(temporary, std::ios::binary);
+            output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            output.write(binary.data(), length);
+            if (!output) {
+                return;
+            }
+        }
+        std::filesystem::rename(temporary, path, error);
+    }
+};
+
+// one GL context per process, so one cache
+inline shader_cache_t &cache() {
+    static shader_cache_t instance;
+    return instance;
+}
+
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+namespace task_graph {
+
+// Any address identifies a piece of state, usually the object holding it.
+using resource_t = const void *;
+
+struct task_t {
+    std::string name;
+    std::function <void()> run;
+    std::vector <resource_t> reads, writes;
+
+    std::vector <std::size_t> successors;
+    std::size_t predecessors_cnt = 0;
+
+    // last run, relative to its start
+    double start_ms = 0.0, duration_ms = 0.0;
+    std::size_t thread = 0;
+
+    // since the last report
+    double total_ms = 0.0;
+};
+
+// Tasks in the order they would run serially. A task depends on every earlier task it conflicts
+// with: one writes a resource the other reads or writes. Everything else may run in parallel, the
+// result is the same as running the tasks in order.
+struct task_graph_t {
+    // print stats every this many runs, 0 disables reporting
+    int report_period = 600;
+    const char *name;
+
+    std::vector <task_t> tasks;
+    double wall_ms = 0.0, total_wall_ms = 0.0;
+    int runs_since_report = 0;
+
+    task_graph_t(const char *name) : name(name) {
+    }
+
+    std::size_t add(std::string task_name, std::function <void()> run, std::vector <resource_t> reads, std::vector <resource_t> writes) {
+        task_t task;
+        task.name = std::move(task_name);
+        task.run = std::move(run);
+        task.reads = std::move(reads);
+        task.writes = std::move(writes);
+
+        std::size_t index = tasks.size();
+        for (std::size_t i = 0; i < index; i++) {
+            if (conflict(tasks[i], task)) {
+                tasks[i].successors.push_back(index);
+                task.predecessors_cnt++;
+            }
+        }
+
+        tasks.push_back(std::move(task));
+        return index;
+    }
+
+    // longest chain of dependent tasks in the last run, the lower bound of its wall time
+    double critical_path_ms() const {
+        std::vector <double> finish(tasks.size(), 0.0);
+        double result = 0.0;
+        for (std::size_t i = 0; i < tasks.size(); i++) {
+            finish[i] += tasks[i].duration_ms;
+            for (std::size_t next : tasks[i].successors) {
+                finish[next] = std::max(finish[next], finish[i]);
+            }
+            result = std::max(result, finish[i]);
+        }
+        return result;
+    }
+
+    void end_run() {
+        total_wall_ms += wall_ms;
+        for (auto &task : tasks) {
+            task.total_ms += task.duration_ms;
+        }
+
+        if (report_period > 0 && ++runs_since_report >= report_period) {
+            report(std::cerr);
+            total_wall_ms = 0.0;
+            for (auto &task : tasks) {
+                task.total_ms = 0.0;
+            }
+            runs_since_report = 0;
+        }
+    }
+
+    void report(std::ostream &out) const {
+        double runs = std::max(1, runs_since_report);
+        double serial_ms = 0.0;
+        for (const auto &task : tasks) {
+            serial_ms += task.total_ms;
+        }
+
+        out << name << ": " << total_wall_ms / runs << " ms/run, " << serial_ms / runs << " ms of tasks" << std::endl;
+        for (const auto &task : tasks) {
+            out << "  " << task.name << ": " << task.total_ms / runs << " ms" << std::endl;
+        }
+    }
+
+    // Graphviz graph of the dependencies with the timings of the last run:
+    //     dot -Tsvg update_graph.dot -o update_graph.svg
+    void write_dot(std::ostream &out) const {
+        out << "digraph \"" << name << "\" {" << std::endl;
+        out << "    label=\"" << name << ": " << wall_ms << " ms, critical path " << critical_path_ms() << " ms\";" << std::endl;
+        out << "    node [shape=box];" << std::endl;
+        for (std::size_t i = 0; i < tasks.size(); i++) {
+            const task_t &task = tasks[i];
+            out << "    t" << i << " [label=\"" << task.name << "\\n" << task.duration_ms << " ms, thread " << task.thread \
+                << "\\nstarted at " << task.start_ms << " ms\"];" << std::endl;
+        }
+        for (std::size_t i = 0; i < tasks.size(); i++) {
+            for (std::size_t next : tasks[i].successors) {
+                out << "    t" << i << " -> t" << next << ";" << std::endl;
+            }
+        }
+        out << "}" << std::endl;
+    }
+
+private:
+    static bool intersect(const std::vector <resource_t> &a, const std::vector <resource_t> &b) {
+        for (resource_t resource : a) {
+            if (std::find(b.begin(), b.end(), resource) != b.end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool conflict(const task_t &a, const task_t &b) {
+        return intersect(a.writes, b.writes) || intersect(a.writes, b.reads) || intersect(a.reads, b.writes);
+    }
+};
+
+// Runs task graphs on a set of workers and the calling thread. Every thread has its own deque of
+// ready tasks: it pushes the tasks its work made ready and pops them back LIFO, threads that ran
+// out of work steal from the front of the others' deques.
+struct scheduler_t {
+    scheduler_t(std::size_t threads_cnt = std::max(1u, std::thread::hardware_concurrency())) {
+        for (std::size_t i = 0; i < threads_cnt; i++) {
+            queues.push_back(std::make_unique<queue_t>());
+        }
+        for (std::size_t i = 1; i < threads_cnt; i++) {
+            workers.emplace_back([this, i]() { worker_loop(i); });
+        }
+    }
+
+    scheduler_t(const scheduler_t &) = delete;
+    scheduler_t &operator=(const scheduler_t &) = delete;
+
+    ~scheduler_t() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        run_cv.notify_all();
+
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    std::size_t size() const {
+        return queues.size();
+    }
+
+    // Returns when every task has run. The first exception thrown by a task is rethrown here, after
+    // the rest of the graph has finished.
+    void run(task_graph_t &graph) {
+        if (graph.tasks.empty()) {
+            return;
+        }
+
+        run_t run_state;
+        run_state.graph = &graph;
+        run_state.start = std::chrono::steady_clock::now();
+        run_state.pending = graph.tasks.size();
+        run_state.remaining = std::make_unique<std::atomic <std::size_t>[]>(graph.tasks.size());
+
+        // tasks without dependencies are dealt out to all threads
+        std::size_t next_queue = 0;
+        for (std::size_t i = 0; i < graph.tasks.size(); i++) {
+            run_state.remaining[i] = graph.tasks[i].predecessors_cnt;
+            if (graph.tasks[i].predecessors_cnt == 0) {
+                queues[next_queue]->tasks.push_back(i);
+                next_queue = (next_queue + 1) % queues.size();
+            }
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            current = &run_state;
+            generation++;
+        }
+        run_cv.notify_all();
+
+        work(run_state, 0);
+
+        // workers that joined the run must leave it before it goes out of scope
+        {
+            std::unique_lock lock(mutex);
+            done_cv.wait(lock, [&]() { return active_workers == 0; });
+            current = nullptr;
+        }
+
+        graph.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - run_state.start).count();
+        graph.end_run();
+
+        if (run_state.error) {
+            std::rethrow_exception(run_state.error);
+        }
+    }
+
+private:
+    struct queue_t {
+        std::mutex mutex;
+        std::deque <std::size_t> tasks;
+    };
+
+    struct run_t {
+        task_graph_t *graph;
+        std::chrono::steady_clock::time_point start;
+        std::unique_ptr <std::atomic <std::size_t>[]> remaining;
+        std::atomic <std::size_t> pending;
+
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    std::vector <std::unique_ptr <queue_t>> queues;
+    std::vector <std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable run_cv, done_cv;
+    run_t *current = nullptr;
+    std::size_t active_workers = 0;
+    std::uint64_t generation = 0;
+    bool stopping = false;
+
+    bool pop(std::size_t thread, std::size_t &task) {
+        queue_t &own = *queues[thread];
+        {
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (std::size_t i = 1; i < queues.size(); i++) {
+            queue_t &victim = *queues[(thread + i) % queues.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(run_t &run_state, std::size_t thread, std::size_t index) {
+        task_t &task = run_state.graph->tasks[index];
+
+        auto start = std::chrono::steady_clock::now();
+        try {
+            task.run();
+        } catch (...) {
+            std::lock_guard lock(run_state.error_mutex);
+            if (!run_state.error) {
+                run_state.error = std::current_exception();
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        task.start_ms = std::chrono::duration<double, std::milli>(start - run_state.start).count();
+        task.duration_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        task.thread = thread;
+
+        for (std::size_t next : task.successors) {
+            if (run_state.remaining[next].fetch_sub(1) == 1) {
+                std::lock_guard lock(queues[thread]->mutex);
+                queues[thread]->tasks.push_back(next);
+            }
+        }
+
+        run_state.pending.fetch_sub(1);
+    }
+
+    // a frame's graph is short, threads without work yield instead of sleeping until it's done
+    void work(run_t &run_state, std::size_t thread) {
+        while (run_state.pending.load() > 0) {
+            std::size_t task;
+            if (pop(thread, task)) {
+                execute(run_state, thread, task);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void worker_loop(std::size_t thread) {
+        std::uint64_t seen_generation = 0;
+
+        while (true) {
+            run_t *run_state;
+            {
+                std::unique_lock lock(mutex);
+                run_cv.wait(lock, [&]() { return stopping || (current && generation != seen_generation); });
+                if (stopping) {
+                    return;
+                }
+                seen_generation = generation;
+                run_state = current;
+                active_workers++;
+            }
+
+            work(*run_state, thread);
+
+            std::lock_guard lock(mutex);
+            active_workers--;
+            if (active_workers == 0) {
+                done_cv.notify_all();
+            }
+        }
+    }
+};
+
+}
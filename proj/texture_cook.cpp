@@ -0,0 +1,136 @@
+// Offline texture cooking: compresses every texture of the project into BC1/BC3/BC7 with its full
+// mip chain (see generate_mips), next to the source (see cooked_texture_path), so that the game
+// uploads blocks instead of decoding JPEGs and building mipmaps at startup.
+//
+//   texture-cook [--format auto|bc1|bc3|bc7] [--threads N] [paths...]
+//
+// Without paths every .jpg and .png under models/ is cooked. Prints size, PSNR and time per texture.
+
+#include "block_compression.hpp"
+#include "thread_pool.hpp"
+#include "stb_image.h"
+
+#include <filesystem>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cctype>
+#include <stdexcept>
+
+namespace {
+
+struct options_t {
+    bool automatic = true;
+    block_format format = block_format::bc1;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector <std::filesystem::path> paths;
+};
+
+options_t parse_args(int argc, char **argv) {
+    options_t options;
+
+    auto value = [&](int &i) -> std::string {
+        if (i + 1 >= argc) {
+            throw std::runtime_error(std::string("missing value for ") + argv[i]);
+        }
+        return argv[++i];
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--format") {
+            std::string format = value(i);
+            options.automatic = format == "auto";
+            if (format == "bc1") {
+                options.format = block_format::bc1;
+            } else if (format == "bc3") {
+                options.format = block_format::bc3;
+            } else if (format == "bc7") {
+                options.format = block_format::bc7;
+            } else if (format != "auto") {
+                throw std::runtime_error("unknown format: " + format);
+            }
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::stoi(value(i)));
+        } else if (arg.starts_with("--")) {
+            throw std::runtime_error("unknown argument: " + arg);
+        } else {
+            options.paths.push_back(arg);
+        }
+    }
+
+    return options;
+}
+
+std::vector <std::filesystem::path> project_textures() {
+    std::vector <std::filesystem::path> result;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(std::string(PROJECT_ROOT) + "/models")) {
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        if (entry.is_regular_file() && (extension == ".jpg" || extension == ".png")) {
+            result.push_back(entry.path());
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}
+
+int main(int argc, char **argv) try {
+    options_t options = parse_args(argc, argv);
+    if (options.paths.empty()) {
+        options.paths = project_textures();
+    }
+
+    thread_pool::thread_pool_t pool(options.threads);
+
+    std::size_t total_raw = 0, total_compressed = 0, failed = 0;
+    auto total_start = std::chrono::steady_clock::now();
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto &path : options.paths) {
+        auto start = std::chrono::steady_clock::now();
+
+        int width, height, channels;
+        unsigned char *pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+        if (!pixels) {
+            std::cerr << path.string() << ": " << stbi_failure_reason() << std::endl;
+            failed++;
+            continue;
+        }
+
+        block_format format = options.automatic ? choose_block_format(path, pixels, width, height) : options.format;
+        compressed_texture texture = compress_texture(pixels, width, height, format, mip_settings_for(path), &pool);
+        double psnr = compression_psnr(texture, pixels);
+        stbi_image_free(pixels);
+
+        save_compressed_texture(texture, cooked_texture_path(path));
+
+        // what glGenerateMipmap would allocate for the RGBA8 upload
+        std::size_t raw = 0;
+        for (const auto &level : texture.levels) {
+            raw += 4 * (std::size_t)level.width * level.height;
+        }
+        total_raw += raw;
+        total_compressed += texture.size();
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << path.string() << ": " << width << "x" << height << " " << format_name(format)
+                  << ", " << texture.levels.size() << " levels, " << raw / 1024 << " -> " << texture.size() / 1024 << " KiB ("
+                  << (double)raw / texture.size() << ":1), PSNR " << psnr << " dB, " << ms << " ms" << std::endl;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - total_start).count();
+    std::cout << "cooked " << options.paths.size() - failed << " textures with " << pool.size() << " threads in " << seconds << " s, "
+              << total_raw / (1024 * 1024) << " -> " << total_compressed / (1024 * 1024) << " MiB" << std::endl;
+
+    return failed == 0 ? 0 : 1;
+} catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
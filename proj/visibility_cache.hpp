@@ -0,0 +1,229 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_access.hpp>
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+
+namespace visibility_cache {
+
+// Culling result of a static instance (or a node of instances) that is reused between frames.
+// Instances that are far enough from every frustum plane are classified as inside/outside and
+// are not tested again until the camera moves or rotates beyond a threshold; instances near
+// the frustum boundary are re-tested with the exact test every frame.
+enum class state_t : std::uint8_t {
+    unknown,
+    inside,
+    outside,
+    boundary,
+};
+
+struct stats_t {
+    std::uint64_t hits = 0, misses = 0;
+    std::uint64_t exact_tests = 0;
+    std::uint64_t revalidations = 0;
+    double exact_seconds = 0.0;
+
+    void reset() {
+        *this = stats_t();
+    }
+
+    stats_t &operator+=(const stats_t &other) {
+        hits += other.hits;
+        misses += other.misses;
+        exact_tests += other.exact_tests;
+        revalidations += other.revalidations;
+        exact_seconds += other.exact_seconds;
+        return *this;
+    }
+};
+
+struct visibility_cache_t {
+    // camera movement after which the whole cache is reclassified
+    float move_threshold = .5f;
+    float rotate_threshold = .03f;
+
+    // print stats every this many frames, 0 disables reporting
+    int report_period = 600;
+    std::string name = "visibility cache";
+
+    std::vector <state_t> states;
+
+    stats_t stats, frame_stats;
+    int frames_since_report = 0;
+
+    visibility_cache_t(std::size_t count = 0) {
+        resize(count);
+    }
+
+    void resize(std::size_t count) {
+        states.assign(count, state_t::unknown);
+        valid = false;
+    }
+
+    void invalidate(std::size_t index) {
+        states[index] = state_t::unknown;
+    }
+
+    // Must be called once per frame before any query. Returns true if all cached states were dropped.
+    bool begin_frame(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &camera_position) {
+        glm::vec3 forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+        glm::vec3 up = glm::vec3(view[0][1], view[1][1], view[2][1]);
+
+        frame_stats.reset();
+
+        bool moved = !valid || projection != cached_projection || \
+                     glm::length(camera_position - cached_camera_position) > move_threshold || \
+                     angle(forward, cached_forward) > rotate_threshold || \
+                     angle(up, cached_up) > rotate_threshold;
+
+        if (moved) {
+            std::fill(states.begin(), states.end(), state_t::unknown);
+
+            cached_view_projection = projection * view;
+            cached_projection = projection;
+            cached_camera_position = camera_position;
+            cached_forward = forward;
+            cached_up = up;
+            valid = true;
+
+            for (int i = 0; i < 3; i++) {
+                glm::vec4 row = glm::row(cached_view_projection, i);
+                glm::vec4 w = glm::row(cached_view_projection, 3);
+                planes[2 * i] = normalize_plane(w + row);
+                planes[2 * i + 1] = normalize_plane(w - row);
+            }
+
+            frame_stats.revalidations++;
+        }
+
+        return moved;
+    }
+
+    // Returns whether the box [min, max] of instance `index` is visible. `exact_test` is called only when
+    // the cached state can't answer. The box must contain every box the exact test may be asked about.
+    template <typename ExactTest>
+    bool visible(std::size_t index, const glm::vec3 &min, const glm::vec3 &max, ExactTest &&exact_test) {
+        return visible(index, min, max, exact_test, frame_stats);
+    }
+
+    // Same as above, but safe to call concurrently for different instances: stats are gathered into
+    // `local_stats` and have to be merged into frame_stats by the caller.
+    template <typename ExactTest>
+    bool visible(std::size_t index, const glm::vec3 &min, const glm::vec3 &max, ExactTest &&exact_test, stats_t &local_stats) {
+        state_t &state = states[index];
+
+        if (state == state_t::unknown) {
+            state = classify(min, max);
+        } else if (state != state_t::boundary) {
+            local_stats.hits++;
+            return state == state_t::inside;
+        }
+
+        local_stats.misses++;
+
+        if (state == state_t::inside) {
+            return true;
+        }
+        if (state == state_t::outside) {
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool result = exact_test();
+        local_stats.exact_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        local_stats.exact_tests++;
+
+        return result;
+    }
+
+    // Accumulates per-frame stats (e.g. gathered by worker threads) and reports them periodically.
+    void end_frame() {
+        stats += frame_stats;
+
+        if (report_period == 0 || ++frames_since_report < report_period) {
+            return;
+        }
+
+        report(std::cerr);
+        stats.reset();
+        frames_since_report = 0;
+    }
+
+    double hit_rate() const {
+        std::uint64_t total = stats.hits + stats.misses;
+        return total ? (double)stats.hits / total : 0.0;
+    }
+
+    // Time the exact test would have taken for the instances answered from the cache.
+    double saved_seconds() const {
+        if (stats.exact_tests == 0) {
+            return 0.0;
+        }
+        return stats.hits * (stats.exact_seconds / stats.exact_tests);
+    }
+
+    void report(std::ostream &out) const {
+        out << std::fixed << std::setprecision(3) \
+            << name << ": hit rate " << hit_rate() * 100.0 << "%, " \
+            << stats.exact_tests << " exact tests, " \
+            << stats.revalidations << " revalidations, " \
+            << "saved " << saved_seconds() * 1e3 << " ms over " << frames_since_report << " frames" << std::endl;
+    }
+
+private:
+    bool valid = false;
+    std::array <glm::vec4, 6> planes;
+
+    glm::mat4 cached_view_projection, cached_projection;
+    glm::vec3 cached_camera_position, cached_forward, cached_up;
+
+    static glm::vec4 normalize_plane(const glm::vec4 &plane) {
+        return plane / glm::length(glm::vec3(plane));
+    }
+
+    static float angle(const glm::vec3 &a, const glm::vec3 &b) {
+        return std::acos(std::clamp(glm::dot(glm::normalize(a), glm::normalize(b)), -1.f, 1.f));
+    }
+
+    // Boxes are classified against the cached frustum. A box is stable if it stays on the same side
+    // of the frustum boundary for any camera within the thresholds of the cached one: translation
+    // moves planes by at most move_threshold, rotation (forward and up both within the threshold)
+    // moves a point at distance r relative to them by at most 2 * r * rotate_threshold.
+    state_t classify(const glm::vec3 &min, const glm::vec3 &max) const {
+        glm::vec3 center = (min + max) * .5f;
+        glm::vec3 extent = (max - min) * .5f;
+
+        float distance = glm::length(center - cached_camera_position) + glm::length(extent);
+        float margin = move_threshold + 2.f * distance * rotate_threshold;
+
+        bool inside = true;
+        for (const auto &plane : planes) {
+            glm::vec3 n(plane);
+            float d = glm::dot(n, center) + plane.w;
+            float r = glm::dot(glm::abs(n), extent);
+
+            if (d + r < -margin) {
+                return state_t::outside;
+            }
+            if (d - r <= margin) {
+                inside = false;
+            }
+        }
+
+        return inside ? state_t::inside : state_t::boundary;
+    }
+};
+
+}